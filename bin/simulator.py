@@ -35,24 +35,62 @@ def main():
             msg('simulation complete')
             return
     cexinf = create_cex()
-    sim = Simulator.create(cexinf,
-                           parameters=parameters,
-                           configuration=configuration,
-                           random_seed=config.random_seed)
+    if config.checkpoint and os.path.exists(config.checkpoint + '.0'):
+        sim = Simulator.restore(cexinf, parameters, config.checkpoint,
+                                threads=config.threads)
+        #checkpoints are written along with each saved configuration
+        sim.start_time = configuration.time - sim.simulated_cycles * parameters.time_step
+        msg("restored checkpoint %s", config.checkpoint)
+    else:
+        sim = Simulator.create(cexinf,
+                               parameters=parameters,
+                               configuration=configuration,
+                               divisions='bisect' if config.bisect else None,
+                               random_seed=config.random_seed,
+                               threads=config.threads)
+    if config.balance_interval:
+        sim.configure_balancing(config.balance_interval)
     outstream = initialize_output_stream(parameters, configuration)
     save_cycles = (duration and
                    int(ceil(duration / config.save_rate)))
     integration_cycles = int(ceil(config.save_rate / parameters.time_step))
     msg("simulating %s cycles of length %.3g mcs (%d integrations)",
         save_cycles or 'oo', config.save_rate / mcs, integration_cycles)
+    #unless each save must match a checkpoint, configurations are taken
+    #as snapshots, collected while simulating the next save and written
+    #while simulating the one after
+    overlap = not (config.thread_dump or config.checkpoint)
+    write_previous = None
     for save_i in xrange(1,1+save_cycles) if save_cycles else count(1):
         sim.simulate(integration_cycles,
-                     max_c_cycles=config.max_c_integrations)
-        msg("saving cycle %d of %s", save_i, save_cycles or 'oo')
-        outstream.write(sim.get_configuration()
-                        if not config.thread_dump else
-                        sim.get_state())
-        outstream.flush()
+                     max_c_cycles=config.max_c_integrations,
+                     background=write_previous)
+        if overlap:
+            write_previous = None
+            if save_i > 1:
+                write_previous = snapshot_writer(outstream, save_i-1, save_cycles,
+                                                 sim.fetch_snapshot())
+            sim.take_snapshot()
+            continue
+        save(outstream, save_i, save_cycles,
+             sim.get_configuration()
+             if not config.thread_dump else
+             sim.get_state())
+        if config.checkpoint:
+            sim.write_checkpoint(config.checkpoint)
+    if overlap and save_cycles:
+        if write_previous is not None:
+            write_previous()
+        save(outstream, save_cycles, save_cycles,
+             sim.fetch_snapshot().get_configuration())
+
+def save(outstream, save_i, save_cycles, obj):
+    msg("saving cycle %d of %s", save_i, save_cycles or 'oo')
+    outstream.write(obj)
+    outstream.flush()
+
+def snapshot_writer(outstream, save_i, save_cycles, snapshot):
+    return lambda: save(outstream, save_i, save_cycles, snapshot.get_configuration())
 
 def configure():
     parser = OptionParser(usage='%prog [OPTIONS] <filename>',
@@ -112,6 +150,26 @@ def configure():
                       action='store',
                       metavar='SEED',
                       help='specify random seed; otherwise randomly seeded from system entropy')
+    parser.add_option('--bisect',
+                      dest='bisect',
+                      default=False,
+                      action='store_true',
+                      help='divide space between threads by recursive bisection of the ' +
+                           'initial positions instead of a regular grid')
+    parser.add_option('--balance-interval',
+                      dest='balance_interval',
+                      default=0,
+                      type='int',
+                      action='store',
+                      metavar='N',
+                      help='balance work between threads every N neighbor list rebuilds')
+    parser.add_option('--checkpoint',
+                      dest='checkpoint',
+                      default=None,
+                      action='store',
+                      metavar='PREFIX',
+                      help='write the state of every thread to files PREFIX.RANK after ' +
+                           'each save and continue from these files when they exist')
     parser.add_option('--nproc',
                       dest='nproc',
                       default=1,
@@ -119,12 +177,25 @@ def configure():
                       action='store',
                       metavar='N',
                       help='specify number of threads to use in simulation')
+    parser.add_option('--threads',
+                      dest='threads',
+                      default=None,
+                      type='int',
+                      action='store',
+                      metavar='N',
+                      help='specify number of OpenMP threads used by each process')
     parser.add_option('-m','--mpi',
                       dest='mpiargs',
                       default=[],
                       action='append',
                       metavar='ARGS',
                       help='pass argument onto mpirun')
+    parser.add_option('--shm',
+                      dest='shm',
+                      default=False,
+                      action='store_true',
+                      help='exchange messages with simulation through shared memory ' +
+                           'instead of fifos')
     parser.add_option('--mpirun',
                       dest='mpirun',
                       default=None,
@@ -214,10 +285,11 @@ def create_objstream(s, mode='r', stdfileobj=None):
 
 def create_cex():
     if config.nproc == 1 and not config.mpiargs and config.mpirun is None:
-        return CexInterface.create()
+        return CexInterface.create(shm=config.shm)
     return CexInterface.create_mpi(nproc=config.nproc,
                                    mpiargs=config.mpiargs,
-                                   mpirun=config.mpirun)
+                                   mpirun=config.mpirun,
+                                   shm=config.shm)
 
 
 __name__ == '__main__' and main()
@@ -9,9 +9,8 @@ from __future__ import absolute_import
 from numpy import *
 from collections import defaultdict
 
-from jamenson.runtime.atypes import typep, as_optimized_type, anytype
+from jamenson.runtime.atypes import typep
 from jamenson.runtime.atypes.ptypes import integer_type
-from jamenson.runtime.multimethod import MultiMethod, defmethod
 
 class Extent(object):
 
@@ -62,65 +61,9 @@ divs = divs()
 def get_divs(size):
     return divs[size]
 
-# Calculate the offset that describe the junction data
-# structures in md.c.  See the section on junctions in
-# this source file for an explaination.
-offsets = [
-    ['surface', [
-     [axis,i]
-      for axis in 'xyz' for i in [-1,1]]],
-    ['line', [
-     (x,y,z)
-     for x in [-1,0,1] for y in [-1,0,1] for z in [-1,0,1]
-     if sum(abs(array([x,y,z])))==2
-     ]],
-    ['point', [
-     [x,y,z]
-     for x in [-1,1] for y in [-1,1] for z in [-1,1]]]]
-
-calculate_junction_offset = MultiMethod('calculate_junction_offset',
-                                        signature='name,cell,box_size,data')
-
-def offset_shift(off, cell):
-    one = ones_like(off)
-    return ((cell.extent.max_extent - cell.extent.min_extent) *
-            (one + (off - one) * 0.5) +
-            cell.extent.min_extent)
-
-@defmethod(calculate_junction_offset, '"surface",Cell,ndarray,anytype')
-def meth(name, cell, box_size, (axis, axis_off)):
-    offset = array(dict(x=[1,0,0], y=[0,1,0], z=[0,0,1])[axis]) * axis_off
-    return offset, (axis, '-' if axis_off==-1 else '+')
-
-@defmethod(calculate_junction_offset, '"line",Cell,ndarray,anytype')
-def meth(name, cell, box_size, (x,y,z)):
-    v = array([x,y,z])
-    axis = 'xyz'[where(v==0)[0]]
-    off1,off2 = [i for i in v if i!=0]
-    if axis=='x':
-        offset = [0,off1,off2]
-    elif axis=='y':
-        offset = [off1,0,off2]
-    elif axis=='z':
-        offset = [off1,off2,0]
-    else:
-        raise 'hell'
-    offset =  array(offset)
-    return offset, (axis,) + tuple(offset_shift(offset, cell)[where(offset!=0)])
-
-@defmethod(calculate_junction_offset, '"point",Cell,ndarray,anytype')
-def meth(name, cell, box_size, offset):
-    offset = array(offset)
-    return offset, tuple(offset_shift(offset, cell))
-
-
-class Junction(object):
-
-    def __init__(self, cell, df):
-        self.cell = cell
-        self.df = df
-
 def partition_positions(size, positions, divs):
+    '''divide space into a regular grid of divs cells of uniform dimensions
+    '''
     if typep(divs, integer_type):
         divs = get_divs(divs)
     divs = asarray(divs, int)
@@ -137,14 +80,84 @@ def partition_positions(size, positions, divs):
         min_extent = (cell.index / divs) * size
         max_extent = ((cell.index + adj) / divs) * size
         cell.extent = Extent(min_extent, max_extent)
-        for name,defs in offsets:
-            for df in defs:
-                off, junction_df = calculate_junction_offset(name, cell, size, df)
-                junction_cell = cells[tuple((cell.index + off) % divs)]
-                if junction_cell is not cell:
-                    cell.junctions.append(Junction(junction_cell, (name,) + tuple(junction_df)))
     return sorted(cells.itervalues(), key=lambda cell: tuple(cell.index))
 
+def bisect_positions(size, positions, n_cells):
+    '''divide space into n_cells cells by recursive coordinate bisection.
+       each box is cut perpendicular to its longest axis s.t. the number of
+       particles on each side is proportional to the number of cells that
+       side is further divided into.  any number of cells can be used and
+       clustered configurations are divided evenly between cells
+    '''
+    positions = asarray(positions).reshape(len(positions), 3)
+    leaves = []
+    def bisect(min_extent, max_extent, positions, n):
+        if n == 1:
+            leaves.append((min_extent, max_extent, positions))
+            return
+        n_lower = n // 2
+        axis = argmax(max_extent - min_extent)
+        coordinates = sort(positions[:, axis])
+        k = int(round(len(coordinates) * n_lower / n))
+        if 0 < k < len(coordinates) and coordinates[k-1] < coordinates[k]:
+            plane = 0.5 * (coordinates[k-1] + coordinates[k])
+        else:
+            plane = (min_extent[axis] +
+                     (max_extent[axis] - min_extent[axis]) * n_lower / n)
+        lower = positions[:, axis] < plane
+        lower_max = max_extent.copy()
+        lower_max[axis] = plane
+        upper_min = min_extent.copy()
+        upper_min[axis] = plane
+        bisect(min_extent, lower_max, positions[lower], n_lower)
+        bisect(upper_min, max_extent, positions[~lower], n - n_lower)
+    size = asarray(size, float)
+    bisect(zeros(3), size.copy(), positions, n_cells)
+    return [Cell(array([i]), Extent(min_extent, max_extent), positions)
+            for i,(min_extent,max_extent,positions) in enumerate(leaves)]
+
+# Junctions between cells
+# Two cells are junctioned when any points within their extents are within
+# the neighbor distance, accounting for periodic bondary conditions.  This
+# makes no assumption about how space is divided.  Junctions are
+# characterized by the number of axes along which the cells overlap, which
+# for a regular grid corresponds to junctions across a surface (2), a line
+# (1) or a point (0), and is used to order communications.
+
+def axis_separation(min_i, max_i, min_j, max_j, length):
+    '''gap and overlap between two intervals along a periodic axis
+    '''
+    gap = length
+    overlap = 0
+    for shift in (-length, 0, length):
+        lower = maximum(min_i, min_j + shift)
+        upper = minimum(max_i, max_j + shift)
+        gap = minimum(gap, maximum(0, lower - upper))
+        overlap = maximum(overlap, upper - lower)
+    return gap, overlap
+
+def find_junctions(cells, size, r_neighbor):
+    '''set the junctions of each cell as pairs of junctioned cell and
+       the number of axes along which the two cells overlap
+    '''
+    for cell in cells:
+        cell.junctions = []
+    for i,cell_i in enumerate(cells):
+        for cell_j in cells[i+1:]:
+            distance_sqr = 0
+            n_overlap = 0
+            for axis in xrange(3):
+                gap, overlap = axis_separation(cell_i.extent.min_extent[axis],
+                                               cell_i.extent.max_extent[axis],
+                                               cell_j.extent.min_extent[axis],
+                                               cell_j.extent.max_extent[axis],
+                                               size[axis])
+                distance_sqr += gap ** 2
+                n_overlap += overlap > 0
+            if distance_sqr <= r_neighbor ** 2:
+                cell_i.junctions.append((cell_j, n_overlap))
+                cell_j.junctions.append((cell_i, n_overlap))
+
 # Calculation of communication rules between cells
 # TODO: Explain this
 
@@ -171,21 +184,23 @@ class Link(object):
 
 
 def group_junctions(cells):
-    precedence_map = {None: 0,
-                      'point': -1,
-                      'line': -2,
-                      'surface': -3}
-    comms = defaultdict(int)
+    '''group links by the number of axes along which the cells overlap,
+       ordering groups with the most overlap first
+    '''
+    links = {}
+    link_indices = []
+    precs = []
     for cell in cells:
-        for junction in cell.junctions:
-            link = Link(cell, junction.cell)
-            prec = precedence_map[junction.df[0]]
-            comms[link] = min(prec, comms[link])
-    groups = defaultdict(list)
-    for link,prec in comms.iteritems():
-        groups[prec].append(link)
-    if not groups:
+        for jcell,n_overlap in cell.junctions:
+            link_indices.append(links.setdefault(Link(cell, jcell), len(links)))
+            precs.append(-1 - n_overlap)
+    if not links:
         return []
+    link_precs = zeros(len(links), dtype=int)
+    minimum.at(link_precs, link_indices, precs)
+    groups = defaultdict(list)
+    for link,index in links.iteritems():
+        groups[int(link_precs[index])].append(link)
     _,groups = zip(*sorted(groups.iteritems()))
     return groups
 
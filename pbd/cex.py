@@ -22,6 +22,8 @@ from __future__ import with_statement
 
 import os
 import signal
+import mmap
+import struct
 from subprocess import Popen
 import random
 import atexit
@@ -46,13 +48,15 @@ class CexInterface(object):
     # # # #
 
     @classmethod
-    def create(self):
-        '''create an interface to a single threaded simulation process
+    def create(self, shm=False):
+        '''create an interface to a single threaded simulation process.
+           with shm, messages are exchanged through a shared memory file
+           instead of the fifos
         '''
-        return self.create_ex([setup.paths.cex.abspath()])
+        return self.create_ex([setup.paths.cex.abspath()], shm=shm)
 
     @classmethod
-    def create_mpi(self, nproc=1, mpiargs=[], mpirun=None, nodes=None):
+    def create_mpi(self, nproc=1, mpiargs=[], mpirun=None, nodes=None, shm=False):
         '''create an interface to a process launched over MPI
         '''
         assert typep(nproc, positive_integer_type)
@@ -73,7 +77,7 @@ class CexInterface(object):
         return self.create_ex([mpirun] + list(mpiargs) +
                               [#'-machinefile', machine_path,
                                '-np', nproc, setup.paths.cex.abspath()],
-                              basedir=basedir)
+                              basedir=basedir, shm=shm)
 
     shutting_down = False
     def shutdown(self):
@@ -105,6 +109,17 @@ class CexInterface(object):
         self.req_active()
         return self.do_command(rank, msg)
 
+    def perform_command_async_send(self, rank, msg):
+        '''send a writing msg to the process of specified rank without
+           waiting for it to be performed.  no other command may be sent
+           until the reading msg is retrieved by perform_command_async_recv
+        '''
+        self.req_active()
+        self.send_command(rank, msg)
+
+    def perform_command_async_recv(self):
+        return self.recv_reply()
+
     def map_slave(self, msgs):
         '''map a sequence of writing msgs across all slave
            and return the resulting reading msgs
@@ -127,20 +142,35 @@ class CexInterface(object):
         return self.map_all([msg] * self.get_size())
 
     def map_slave_async(self, msgs):
+        '''map a sequence of writing msgs across all slaves, which
+           perform them concurrently, in a single round trip through
+           the master
+        '''
         self.req_active()
-        self.map_slave_async_send(msgs)
-        return self.map_slave_async_recv()
+        return self.do_batch(list(self.iter_slave_msgs(msgs)))
 
     def on_each_slave_async(self, msg):
         return self.map_slave_async([msg] * (self.get_size()-1))
 
     def map_all_async(self, msgs):
+        self.map_all_async_send(msgs)
+        return self.map_all_async_recv()
+
+    def map_all_async_send(self, msgs):
+        '''send a writing msg to each process, the first to the master,
+           without waiting for them to be performed.  no other command may
+           be sent until the reading msgs are retrieved by
+           map_all_async_recv
+        '''
         self.req_active()
         if not isinstance(msgs, list):
             msgs = list(msgs)
-        self.map_slave_async_send(msgs[1:])
-        return ReadingMessageList([self.do_command(0,msgs[0])] +
-                                  self.map_slave_async_recv().msgs)
+        rank_msgs = [(0, msgs[0])] + list(self.iter_slave_msgs(msgs[1:]))
+        self.send_command(0, self.make_batch_msg('map_msgs', rank_msgs))
+        self.batch_ranks = [rank for rank,msg in rank_msgs]
+
+    def map_all_async_recv(self):
+        return self.read_batch_reply(self.recv_reply(), self.batch_ranks)
 
     def on_each_async(self, msg):
         return self.map_all_async([msg] * self.get_size())
@@ -152,32 +182,42 @@ class CexInterface(object):
 
     # Process Management
     @classmethod
-    def create_ex(cls, launch_args, basedir=None):
+    def create_ex(cls, launch_args, basedir=None, shm=False):
         #print launch_args
         if basedir is None:
             basedir = make_tmp_directory()
+        ring = None
         try:
             write_fifo_path = basedir.child('python2c-fifo')
             read_fifo_path = basedir.child('c2python-fifo')
             os.mkfifo(write_fifo_path)
             os.mkfifo(read_fifo_path)
-            proc = Popen(map(str, launch_args + [write_fifo_path, read_fifo_path]))
+            cex_args = [write_fifo_path, read_fifo_path]
+            if shm:
+                ring = SharedRing.create(shared_memory_path(basedir))
+                cex_args.append(ring.path)
+            proc = Popen(map(str, launch_args + cex_args))
             try:
                 write_fifo, read_fifo = open_fifos(write_fifo_path, read_fifo_path)
             except IOError:
                 force_proc_exit(proc)
                 raise
             else:
-                return cls(proc, write_fifo, read_fifo)
+                return cls(proc, write_fifo, read_fifo, ring)
         except:
+            if ring is not None:
+                ring.close()
             remove_directory(basedir)
             raise
 
-    def __init__(self, proc, write_fp, read_fp):
+    def __init__(self, proc, write_fp, read_fp, ring=None):
         self.proc = proc
         self.write_fp = write_fp
         self.read_fp = read_fp
+        self.ring = ring
         atexit.register(self.shutdown)
+        if ring is not None:
+            atexit.register(ring.close)
 
     active = True
     def req_active(self):
@@ -215,12 +255,35 @@ class CexInterface(object):
     def read_uint(self):
         return str2uint(self.read(4))
 
+    #message lengths are 64-bit, s.t. messages can exceed 4 GB
+    length_struct = struct.Struct('>Q')
+
+    def write_length(self, value):
+        self.write(self.length_struct.pack(value))
+
+    def read_length(self):
+        return self.length_struct.unpack(self.read(8))[0]
+
     def do_command(self, rank, msg):
-        self.write_uint(rank)
+        self.send_command(rank, msg)
+        return self.recv_reply()
+
+    def send_command(self, rank, msg):
         bytes = msg.prepare()
-        self.write_uint(len(bytes))
+        if self.ring is not None:
+            #fifos only carry a doorbell byte each way
+            self.ring.write_command(rank, bytes)
+            self.write('\x01')
+            return
+        self.write_uint(rank)
+        self.write_length(len(bytes))
         self.write(bytes)
-        return ReadingMessage(self.read(self.read_uint()))
+
+    def recv_reply(self):
+        if self.ring is not None:
+            self.read(1)
+            return ReadingMessage(self.ring.read_reply())
+        return ReadingMessage(self.read(self.read_length()))
 
     def check_slave_msgs(self, msgs):
         if not isinstance(msgs, list):
@@ -234,13 +297,161 @@ class CexInterface(object):
             yield i+1,msg
 
     def map_slave_async_send(self, msgs):
-        for rank,msg in self.iter_slave_msgs(msgs):
-            self.do_command(0, make_writing_message('send_msg', 'im', rank, msg))
+        self.do_command(0, self.make_batch_msg('send_msgs', list(self.iter_slave_msgs(msgs)))
+                        ).read_frmt('x')
 
     def map_slave_async_recv(self):
-        return ReadingMessageList(self.do_command(0, make_writing_message('recv_msg', 'i', rank))
-                                  for rank in xrange(1, self.get_size()))
+        ranks = range(1, self.get_size())
+        return self.read_batch_reply(
+            self.do_command(0, make_writing_message('recv_msgs', 'J', ranks)), ranks)
+
+    # Batches
+    # a batch is a single command to the master carrying a command for
+    # each of several ranks, which the master forwards to the slaves
+    # (performing its own, if any) and returns their replies together
+    def do_batch(self, rank_msgs):
+        return self.read_batch_reply(
+            self.do_command(0, self.make_batch_msg('map_msgs', rank_msgs)),
+            [rank for rank,msg in rank_msgs])
+
+    @staticmethod
+    def make_batch_msg(name, rank_msgs):
+        batch = make_writing_message(name).write_uint(len(rank_msgs))
+        for rank,msg in rank_msgs:
+            batch.write_int(rank).write_submsg(msg)
+        return batch
+
+    @staticmethod
+    def read_batch_reply(reply, ranks):
+        #replies are in order of arrival
+        replies = {}
+        for i in xrange(reply.read_uint()):
+            rank = reply.read_int()
+            replies[rank] = reply.read_submsg()
+        reply.req_eofp()
+        return ReadingMessageList(replies[rank] for rank in ranks)
+
+
+
+class SharedRing(object):
+    '''shared memory file through which commands and replies are
+       exchanged with the master process; layout as in src/ring.c.
+
+       commands are written to a single-producer/single-consumer ring,
+       except those too large for it, which are written to the payload
+       region along with all replies.  the ring counters and the reply
+       length are only written by one side each.  region_size is
+       written by both, as either side grows the region, but only by
+       the control process while writing a command and by the master
+       while writing a reply; each waits on the doorbell of the other
+       in between, s.t. the two never write it at once and no locks are
+       needed.  this relies on the stores to the mapping becoming
+       visible in program order (as on x86) as python can't issue
+       memory barriers.
+    '''
 
+    header_struct = struct.Struct('=IIQQQQQ')
+    record_struct = struct.Struct('=IIQ')
+    magic = 0x50424452
+    version = 2
+    header_size = 4096
+    #byte offsets of header fields
+    region_size_offset = 16
+    cmd_head_offset = 24
+    cmd_tail_offset = 32
+    reply_length_offset = 40
+
+    @classmethod
+    def create(cls, path, ring_size=1<<20, region_size=1<<24):
+        assert ring_size > 0 and not ring_size & (ring_size-1)
+        fd = os.open(path, os.O_RDWR | os.O_CREAT | os.O_EXCL, 0600)
+        try:
+            os.ftruncate(fd, cls.header_size + ring_size + region_size)
+            ring = cls(path, fd, ring_size, region_size)
+        except:
+            os.close(fd)
+            os.unlink(path)
+            raise
+        cls.header_struct.pack_into(ring.mm, 0, cls.magic, cls.version,
+                                    ring_size, region_size, 0, 0, 0)
+        return ring
+
+    def __init__(self, path, fd, ring_size, region_size):
+        self.path = path
+        self.fd = fd
+        self.ring_size = ring_size
+        self.region_size = region_size
+        self.region_offset = self.header_size + ring_size
+        self.head = 0
+        self.mm = None
+        self.map()
+
+    def map(self):
+        if self.mm is not None:
+            self.mm.close()
+        self.mm = mmap.mmap(self.fd, self.region_offset + self.region_size)
+
+    def close(self):
+        if self.fd is None:
+            return
+        self.mm.close()
+        os.close(self.fd)
+        self.fd = None
+        try:
+            os.unlink(self.path)
+        except OSError:
+            pass
+
+    def get_field(self, offset):
+        return struct.unpack_from('=Q', self.mm, offset)[0]
+
+    def set_field(self, offset, value):
+        struct.pack_into('=Q', self.mm, offset, value)
+
+    def write_command(self, rank, bytes):
+        n = len(bytes)
+        in_region = n > self.ring_size // 4
+        size = self.record_struct.size
+        if not in_region:
+            size += (n + 7) & ~7
+        if self.head + size - self.get_field(self.cmd_tail_offset) > self.ring_size:
+            raise RuntimeError('command ring full')
+        if in_region:
+            self.reserve_region(n)
+            self.mm[self.region_offset:self.region_offset+n] = bytes
+        record = self.record_struct.pack(rank, in_region, n)
+        self.copy_to_ring(self.head, record)
+        if not in_region:
+            self.copy_to_ring(self.head + len(record), bytes)
+        self.head += size
+        self.set_field(self.cmd_head_offset, self.head)
+
+    def copy_to_ring(self, position, bytes):
+        offset = position & (self.ring_size - 1)
+        first = self.ring_size - offset
+        base = self.header_size
+        if len(bytes) <= first:
+            self.mm[base+offset:base+offset+len(bytes)] = bytes
+        else:
+            self.mm[base+offset:base+self.ring_size] = bytes[:first]
+            self.mm[base:base+len(bytes)-first] = bytes[first:]
+
+    def reserve_region(self, nbytes):
+        if nbytes <= self.region_size:
+            return
+        self.region_size = max(2 * self.region_size, nbytes)
+        os.ftruncate(self.fd, self.region_offset + self.region_size)
+        self.map()
+        self.set_field(self.region_size_offset, self.region_size)
+
+    def read_reply(self):
+        #master grows the region for large replies
+        region_size = self.get_field(self.region_size_offset)
+        if region_size > self.region_size:
+            self.region_size = region_size
+            self.map()
+        n = self.get_field(self.reply_length_offset)
+        return self.mm[self.region_offset:self.region_offset+n]
 
 
 # # # # # # # # # # #
@@ -270,6 +481,14 @@ def make_tmp_directory():
     path.reqdir()
     return path
 
+def shared_memory_path(basedir):
+    '''shared memory file named after basedir, placed in /dev/shm when
+       available s.t. it is never written back to disk
+    '''
+    if os.path.isdir('/dev/shm'):
+        return os.path.join('/dev/shm', os.path.basename(str(basedir).rstrip('/')))
+    return basedir.child('shared-ring')
+
 def remove_directory(path):
     try:
         path.rmdir(recursive=True)
@@ -0,0 +1,58 @@
+##-*- Mode: python -*-
+## driver.py - Files of the standalone driver
+## --------------------------------------------------------------------------
+## Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+## All rights reserved.
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY# without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+'''Input and output files of cexdrv, which runs a simulation under
+   mpirun without a control process
+
+     mpirun -np N cexdrv SYSTEM CONFIGURATION CYCLES OUTPUT [INTERVAL [SEED]]
+'''
+
+from __future__ import absolute_import
+from __future__ import division
+
+from numpy import *
+
+from .msg import WritingMessage
+from .sim import system_items
+
+
+def write_input(system_path, configuration_path, parameters, configuration):
+    '''write the parameters (including force tables) and the initial
+       positions of a simulation as read by cexdrv
+    '''
+    write_msg_file(system_path,
+                   WritingMessage().write_frmt('o', system_items(parameters)))
+    write_msg_file(configuration_path,
+                   WritingMessage().write_frmt('W', configuration.positions))
+
+def write_msg_file(path, msg):
+    fp = open(path, 'wb')
+    try:
+        fp.write(msg.prepare())
+    finally:
+        fp.close()
+
+def frame_dtype(n_particles):
+    return dtype([('cycle', intc), ('positions', float64, (n_particles, 3))])
+
+def read_output(path, n_particles):
+    '''read the frames written by cexdrv, as an array of records with
+       fields cycle and positions (ordered as in the initial configuration)
+    '''
+    return fromfile(path, dtype=frame_dtype(n_particles))
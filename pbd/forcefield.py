@@ -19,6 +19,9 @@
 
 from __future__ import division
 
+import os
+import hashlib
+
 import sympy as S
 import numpy as N
 from scipy_optimize import fminbound
@@ -44,6 +47,7 @@ else:
     have_gnuplot = True
 
 from constants import R_particle, nm, kB
+from debug import warn
 
 r = S.Symbol('r')
 h = r - 2*R_particle
@@ -66,10 +70,32 @@ class PotentialBase(PickelingBase, AlgebraBase):
         return '<%s %s>' % (self.__class__.__name__, self.name)
 
     def make_potential_table(self, r_min, r_max, n_points):
-        return HomogenousTable.fromfunc(self.potential_eval, r_min, r_max, n_points)
+        return self.make_table('potential', self.evaluate_potential, r_min, r_max, n_points)
 
     def make_force_table(self, r_min, r_max, n_points):
-        return HomogenousTable.fromfunc(self.force_eval, r_min, r_max, n_points)
+        return self.make_table('force', self.evaluate_force, r_min, r_max, n_points)
+
+    def make_table(self, kind, evaluate, r_min, r_max, n_points):
+        rs = N.linspace(r_min, r_max, n_points)
+        path = table_cache_path(kind, self.definition_key(), r_min, r_max, n_points)
+        y = load_cached_table(path, n_points)
+        if y is None:
+            y = N.asarray(evaluate(rs), dtype=float) + N.zeros_like(rs)
+            store_cached_table(path, y)
+        return HomogenousTable(y, r_min, rs[1] - rs[0])
+
+    def definition_key(self):
+        '''string identifying the definition of this potential for
+           the table cache, or None when its tables aren't cached
+        '''
+        return None
+
+    # evaluation over an array of separations, by default point by point
+    def evaluate_potential(self, rs):
+        return N.array([self.potential_eval(x) for x in rs])
+
+    def evaluate_force(self, rs):
+        return N.array([self.force_eval(x) for x in rs])
 
     if have_gnuplot:
         def make_potential_plot(self, **kwds):
@@ -135,6 +161,23 @@ class AnalyticPotential(PotentialBase):
     def force_eval(self):
         return make_r_evaluator(self.force_expr)
 
+    @calculated
+    def potential_array_eval(self):
+        return S.lambdify(r, self.potential_expr, 'numpy')
+
+    @calculated
+    def force_array_eval(self):
+        return S.lambdify(r, self.force_expr, 'numpy')
+
+    def definition_key(self):
+        return 'analytic:' + str(self.potential_expr)
+
+    def evaluate_potential(self, rs):
+        return self.potential_array_eval(rs)
+
+    def evaluate_force(self, rs):
+        return self.force_array_eval(rs)
+
 @defboth_mm_add([AnalyticPotential, AnalyticPotential])
 def meth(a,b):
     return AnalyticPotential('%s+%s' (a.name,b.name),
@@ -177,6 +220,46 @@ class InterpolatedPotential(PotentialBase):
     def force_eval(self):
         return self.force_linterp.interpolate
 
+    def definition_key(self):
+        table = self.potential_linterp
+        y = N.ascontiguousarray(table.y, dtype=float)
+        return 'interpolated:%r:%r:%s' % (table.x_min, table.x_prec,
+                                          hashlib.sha1(y.tobytes()).hexdigest())
+
+    def evaluate_potential(self, rs):
+        return interpolate_table(self.potential_linterp, rs)
+
+    def evaluate_force(self, rs):
+        return interpolate_table(self.force_linterp, rs)
+
+def interpolate_table(table, rs):
+    '''linear interpolation of a HomogenousTable over an array,
+       holding the end values beyond the table
+    '''
+    return N.interp(rs, table.x_min + table.x_prec * N.arange(len(table.y)), table.y)
+
+
+def boundary_mask(boundary, rs, inclusive_op, exclusive_op):
+    '''which rs are on the inside of one boundary of a domain
+    '''
+    value = getattr(boundary, 'value', boundary)
+    if value == oo or value == -oo:
+        return N.ones(rs.shape, dtype=bool)
+    if getattr(boundary, 'inclusive', True):
+        return inclusive_op(rs, value)
+    return exclusive_op(rs, value)
+
+def domain_mask(domain, rs):
+    '''which rs are in an interval domain, compared against its lower
+       and upper bounds over the whole array
+    '''
+    try:
+        lower, upper = domain.lower, domain.upper
+    except AttributeError:
+        #not a single interval
+        return N.fromiter((x in domain for x in rs), dtype=bool, count=len(rs))
+    return (boundary_mask(lower, rs, N.greater_equal, N.greater) &
+            boundary_mask(upper, rs, N.less_equal, N.less))
 
 class PieceWisePotential(PotentialBase):
     '''defined as a collection of other potentials
@@ -185,9 +268,11 @@ class PieceWisePotential(PotentialBase):
     def __init__(self, name, pieces=None):
         self.name = name
         self.pieces = PieceWiseCollection(pieces)
+        self.piece_list = list(pieces or [])
 
     def add_piece(self, domain, piece):
         self.pieces.add(domain, piece)
+        self.piece_list.append([domain, piece])
 
     @calculated
     def potential_eval(self):
@@ -197,6 +282,82 @@ class PieceWisePotential(PotentialBase):
     def force_eval(self):
         return PieceWiseFunction(self.pieces.map(lambda piece: piece.force_eval))
 
+    def definition_key(self):
+        if not hasattr(self, 'piece_list'):
+            return None
+        keys = []
+        for domain, piece in self.piece_list:
+            key = piece.definition_key()
+            if key is None:
+                return None
+            keys.append('%s=%s' % (domain, key))
+        return 'piecewise:' + ';'.join(keys)
+
+    def evaluate_potential(self, rs):
+        return self.evaluate_pieces(rs, 'evaluate_potential')
+
+    def evaluate_force(self, rs):
+        return self.evaluate_pieces(rs, 'evaluate_force')
+
+    def evaluate_pieces(self, rs, method):
+        '''evaluate each piece over the separations in its domain
+        '''
+        if not hasattr(self, 'piece_list'):
+            #pickled before pieces were also kept in order
+            return getattr(PotentialBase, method)(self, rs)
+        ys = N.zeros_like(rs)
+        for domain, piece in self.piece_list:
+            inside = domain_mask(domain, rs)
+            if inside.any():
+                ys[inside] = getattr(piece, method)(rs[inside])
+        return ys
+
+
+#finished tables are cached as .npy files, which are memory mapped
+#when reused.  potentials are identified by their definition (expression,
+#table or pieces) rather than their name, s.t. changes to a potential or
+#to the constants it's built from aren't masked by a stale table
+
+#directory of cached tables; caching is disabled when empty
+table_cache_directory = os.environ.get('PBD_TABLE_CACHE',
+                                       os.path.join(os.path.expanduser('~'), '.pbd', 'tables'))
+
+def table_cache_path(kind, definition, r_min, r_max, n_points):
+    if not table_cache_directory or definition is None:
+        return None
+    key = repr((kind, definition, float(r_min), float(r_max), int(n_points)))
+    return os.path.join(table_cache_directory,
+                        '%s-%s.npy' % (kind, hashlib.sha1(key).hexdigest()))
+
+def load_cached_table(path, n_points):
+    if path is None or not os.path.exists(path):
+        return None
+    try:
+        #copy on write, as force tables are scaled in place
+        y = N.load(path, mmap_mode='c')
+    except (IOError, ValueError), e:
+        warn('ignoring bad table cache %s; %s', path, e)
+        return None
+    if y.shape != (n_points,):
+        return None
+    return y
+
+def store_cached_table(path, y):
+    if path is None:
+        return
+    tmp_path = '%s.%d' % (path, os.getpid())
+    try:
+        if not os.path.isdir(os.path.dirname(path)):
+            os.makedirs(os.path.dirname(path))
+        fp = open(tmp_path, 'wb')
+        try:
+            N.save(fp, y)
+        finally:
+            fp.close()
+        os.rename(tmp_path, path)
+    except (IOError, OSError), e:
+        warn('failed to cache table %s; %s', path, e)
+
 
 force_field_cache = {}
 
@@ -21,7 +21,7 @@ from __future__ import absolute_import
 
 import sys
 
-from numpy import array
+from numpy import array, asarray, frombuffer, dtype, prod
 
 from jamenson.runtime.multimethod import MultiMethod, defmethod
 from jamenson.runtime.atypes import anytype, typep
@@ -107,8 +107,40 @@ class WritingMessage(object):
     def write_vec_array(self, arr):
         return self.write_array(arr, self.__class__.write_vec)
 
+    # raw blocks of 32-bit integers and IEEE doubles in little-endian
+    # byte order, written and read without per element encoding.
+    # particle tags are 64-bit integers
+    raw_int_dtype = dtype('<i4')
+    raw_int64_dtype = dtype('<i8')
+    raw_double_dtype = dtype('<f8')
+
+    def write_raw_array(self, arr, raw_dtype, el_shape=()):
+        arr = asarray(arr, dtype=raw_dtype).reshape((-1,) + el_shape)
+        self.write_uint(len(arr))
+        self.buffer.append(arr.tobytes())
+        return self
+
+    def write_raw_int_array(self, arr):
+        return self.write_raw_array(arr, self.raw_int_dtype)
+
+    def write_raw_int64_array(self, arr):
+        return self.write_raw_array(arr, self.raw_int64_dtype)
+
+    def write_raw_double_array(self, arr):
+        return self.write_raw_array(arr, self.raw_double_dtype)
+
+    def write_raw_vec_array(self, arr):
+        return self.write_raw_array(arr, self.raw_double_dtype, (3,))
+
+    def write_raw_int64(self, i):
+        self.buffer.append(asarray([i], dtype=self.raw_int64_dtype).tobytes())
+        return self
+
     def write_submsg(self, msg):
-        return self.write_char_array(''.join(msg.buffer))
+        bytes = msg.prepare()
+        self.write_uint(len(bytes))
+        self.buffer.append(bytes)
+        return self
 
     def write_frmt(self, frmt, *args):
         assert isinstance(frmt, str)
@@ -160,6 +192,26 @@ def meth(writer, frmt, seq):
 def meth(writer, frmt, seq):
     writer.write_vec_array(seq)
 
+@defmethod(write_frmt, [anytype, "J", seq_type])
+def meth(writer, frmt, seq):
+    writer.write_raw_int_array(seq)
+
+@defmethod(write_frmt, [anytype, "l", integer_type])
+def meth(writer, frmt, i):
+    writer.write_raw_int64(i)
+
+@defmethod(write_frmt, [anytype, "L", seq_type])
+def meth(writer, frmt, seq):
+    writer.write_raw_int64_array(seq)
+
+@defmethod(write_frmt, [anytype, "D", seq_type])
+def meth(writer, frmt, seq):
+    writer.write_raw_double_array(seq)
+
+@defmethod(write_frmt, [anytype, "W", seq_type])
+def meth(writer, frmt, seq):
+    writer.write_raw_vec_array(seq)
+
 @defmethod(write_frmt, [anytype, "m", WritingMessage])
 def meth(writer, frmt, msg):
     writer.write_submsg(msg)
@@ -203,11 +255,15 @@ class ReadingMessage(object):
     '''
 
     def __init__(self, bytes):
-        self.buffer = list(bytes)
-        self.buffer.reverse()
+        self.bytes = bytes
+        self.offset = 0
 
     def read_char(self):
-        return self.buffer.pop()
+        if self.offset >= len(self.bytes):
+            raise RuntimeError("underflow in message reading")
+        c = self.bytes[self.offset]
+        self.offset += 1
+        return c
 
     def read_uint(self):
         return str2uint(''.join(self.read_char() for _ in '1234'))
@@ -239,11 +295,48 @@ class ReadingMessage(object):
     def read_vec_array(self):
         return array(self.read_array(self.__class__.read_vec))
 
+    def read_raw_array(self, raw_dtype, el_shape=()):
+        length = self.read_uint()
+        count = length * int(prod(el_shape))
+        if self.offset + count * raw_dtype.itemsize > len(self.bytes):
+            raise RuntimeError("underflow in message reading")
+        arr = frombuffer(self.bytes, raw_dtype, count, self.offset)
+        self.offset += count * raw_dtype.itemsize
+        return arr.astype(raw_dtype.newbyteorder('=')).reshape((length,) + el_shape)
+
+    def read_raw_int_array(self):
+        return self.read_raw_array(WritingMessage.raw_int_dtype)
+
+    def read_raw_int64_array(self):
+        return self.read_raw_array(WritingMessage.raw_int64_dtype)
+
+    def read_raw_double_array(self):
+        return self.read_raw_array(WritingMessage.raw_double_dtype)
+
+    def read_raw_vec_array(self):
+        return self.read_raw_array(WritingMessage.raw_double_dtype, (3,))
+
+    def read_raw_int64(self):
+        raw_dtype = WritingMessage.raw_int64_dtype
+        if self.offset + raw_dtype.itemsize > len(self.bytes):
+            raise RuntimeError("underflow in message reading")
+        i = frombuffer(self.bytes, raw_dtype, 1, self.offset)[0]
+        self.offset += raw_dtype.itemsize
+        return int(i)
+
+    def read_submsg(self):
+        length = self.read_uint()
+        if self.offset + length > len(self.bytes):
+            raise RuntimeError("underflow in message reading")
+        msg = ReadingMessage(self.bytes[self.offset:self.offset+length])
+        self.offset += length
+        return msg
+
     null = object()
     def req_eofp(self):
-        if self.buffer:
+        if self.offset != len(self.bytes):
             raise RuntimeError("expected end of message with %d character remaining" %
-                               (len(self.buffer),))
+                               (len(self.bytes) - self.offset,))
         return self.null
 
     def read_frmt(self, frmt):
@@ -283,6 +376,30 @@ def meth(reader, frmt):
 def meth(reader, frmt):
     return reader.read_vec_array()
 
+@defmethod(read_frmt, [anytype, "J"])
+def meth(reader, frmt):
+    return reader.read_raw_int_array()
+
+@defmethod(read_frmt, [anytype, "l"])
+def meth(reader, frmt):
+    return reader.read_raw_int64()
+
+@defmethod(read_frmt, [anytype, "L"])
+def meth(reader, frmt):
+    return reader.read_raw_int64_array()
+
+@defmethod(read_frmt, [anytype, "D"])
+def meth(reader, frmt):
+    return reader.read_raw_double_array()
+
+@defmethod(read_frmt, [anytype, "W"])
+def meth(reader, frmt):
+    return reader.read_raw_vec_array()
+
+@defmethod(read_frmt, [anytype, "m"])
+def meth(reader, frmt):
+    return reader.read_submsg()
+
 @defmethod(read_frmt, [anytype, "x"])
 def meth(reader, frmt):
     return reader.req_eofp()
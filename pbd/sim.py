@@ -48,8 +48,9 @@ class Simulator(object):
 
     @classmethod
     def create(cls, cexinf, parameters=None, configuration=None,
-               divisions=None, random_seed=None):
-        '''create a Simulator from an uninitialized CexInterface
+               divisions=None, random_seed=None, threads=None):
+        '''create a Simulator from an uninitialized CexInterface.
+           threads sets the number of OpenMP threads used by each process
         '''
         if parameters is None:
             parameters = state.Parameters()
@@ -57,18 +58,44 @@ class Simulator(object):
             configuration = state.Configuration(positions=array([]).reshape(0,3))
         assert isinstance(parameters, state.Parameters)
         assert isinstance(configuration, state.Configuration)
-        initialize(cexinf, parameters, configuration, divisions, random_seed)
+        initialize(cexinf, parameters, configuration, divisions, random_seed, threads)
         return cls(cexinf, parameters.time_step, configuration.time, parameters)
 
-    def simulate(self, n_cycles, max_c_cycles=2500):
+    @classmethod
+    def restore(cls, cexinf, parameters, prefix, start_time=0, threads=None):
+        '''create a Simulator from an uninitialized CexInterface, restoring
+           the state of every thread from a checkpoint written by
+           write_checkpoint.  requires the same parameters and number of
+           processes as the checkpointed simulation, which then continues
+           exactly as it would have.  start_time is that of the configuration
+           the checkpointed simulation was created with
+        '''
+        assert isinstance(parameters, state.Parameters)
+        initialize_thread_names(cexinf)
+        if threads is not None:
+            initialize_threads(cexinf, threads)
+        initialize_system(cexinf, parameters)
+        cycles = set(cycle for [cycle] in
+                     cexinf.on_each_async(make_writing_message('read_checkpoint', 's',
+                                                               prefix)).read_frmt('lx'))
+        if len(cycles) != 1:
+            raise RuntimeError('inconsistent checkpoint cycles %s' % sorted(cycles))
+        self = cls(cexinf, parameters.time_step, start_time, parameters)
+        [self.simulated_cycles] = cycles
+        return self
+
+    def simulate(self, n_cycles, max_c_cycles=2500, background=None):
         '''simulate n_cycles integration cycles. max_c_cycles specifies the number
            of steps to perform in a single command invocation the childr process.
+           background, when given, is called while the first invocation runs
+           and mustn't itself use the simulation
         '''
         n_max,extra = divmod(n_cycles, max_c_cycles)
         for i in xrange(n_max):
-            self.simulate_cycles(max_c_cycles)
+            self.simulate_cycles(max_c_cycles, background)
+            background = None
         if extra:
-            self.simulate_cycles(extra)
+            self.simulate_cycles(extra, background)
 
     def get_configuration(self):
         wall_time = time.time()
@@ -93,7 +120,7 @@ class Simulator(object):
                               zip(*list((fix_array(positions, 3),fix_array(tags, 0))
                                         for positions,tags in
                                         self.cexinf.on_each_async(
-                           make_writing_message('collect_thread_positions_and_tags')).read_frmt('VIx'))))
+                           make_writing_message('collect_thread_positions_and_tags')).read_frmt('WLx'))))
         assert len(set(tags)) == len(tags)
         tags,positions = zip(*sorted(zip(tags, positions)))
         positions = array(positions)
@@ -105,11 +132,159 @@ class Simulator(object):
                     '%s (%d) ' % (positions[i], i) for i in where(positions >= box_size)[0]))
         return positions
 
+    def take_snapshot(self):
+        '''copy the positions of all particles on each thread, to be
+           retrieved by fetch_snapshot.  the copies are sent to the master
+           while simulation continues, s.t. collecting them doesn't stall
+           integration.  replaces any earlier snapshot
+        '''
+        self.cexinf.on_each_async(make_writing_message('take_snapshot')).read_frmt('x')
+        self.snapshot_time = self.get_time(), time.time()
+
+    def fetch_snapshot(self):
+        '''retrieve the last snapshot from the master.  doesn't involve
+           any other thread
+        '''
+        positions, tags = self.cexinf.perform_command(0, make_writing_message('fetch_snapshot')
+                                                      ).read_frmt('WLx')
+        sim_time, wall_time = self.snapshot_time
+        return Snapshot(sim_time, wall_time, positions, tags)
+
+    def get_unwrapped_positions(self):
+        '''as get_positions, but adding the periodic images each particle
+           has crossed since the simulation was initialized
+        '''
+        tags, images = map(concatenate, zip(*[
+            (tags, images.reshape(len(tags), 3)) for tags,images in
+            self.cexinf.on_each_async(make_writing_message('collect_thread_images')).read_frmt('LJx')]))
+        ordered_images = zeros((len(tags), 3), int)
+        ordered_images[tags] = images
+        return self.get_positions() + ordered_images * array(self.parameters.box_size)
+
     def update_neighbors(self):
         '''update neighbor information across all threads
         '''
         self.cexinf.on_each_async(make_writing_message('thread_update_neighbors')).read_frmt('x')
 
+    def configure_balancing(self, rebuild_interval, damping=0.5):
+        '''periodically shift the extents of cells to even out the work
+           between threads, every rebuild_interval neighbor list rebuilds.
+           a rebuild_interval of 0 disables balancing
+        '''
+        self.cexinf.on_each_async(make_writing_message('configure_balancing', 'if',
+                                                       rebuild_interval, damping)).read_frmt('x')
+
+    def open_trajectory(self, path, interval=0):
+        '''have every thread write its particles directly into the trajectory
+           file path (read with pbd.trajectory) through MPI-IO, a frame every
+           interval cycles during simulation.  an interval of 0 only writes
+           frames through write_trajectory_frame
+        '''
+        self.cexinf.on_each_async(make_writing_message('open_trajectory', 'sil',
+                                                       path, interval,
+                                                       self.simulated_cycles)).read_frmt('x')
+
+    def open_compressed_trajectory(self, path, interval=0, precision=1e-6,
+                                   keyframe_interval=100):
+        '''as open_trajectory, but positions are gathered on the master and
+           written to a compressed trajectory (read with pbd.trajectory),
+           quantized to precision times the box size along each axis.
+           frames are stored as changes since the previous frame, but for
+           a keyframe every keyframe_interval frames
+        '''
+        self.cexinf.on_each_async(make_writing_message('open_compressed_trajectory', 'silfi',
+                                                       path, interval, self.simulated_cycles,
+                                                       precision, keyframe_interval)).read_frmt('x')
+
+    def write_trajectory_frame(self):
+        '''write the current positions as a frame of the open trajectory
+        '''
+        self.cexinf.on_each_async(make_writing_message('write_trajectory_frame')).read_frmt('x')
+
+    def close_trajectory(self):
+        self.cexinf.on_each_async(make_writing_message('close_trajectory')).read_frmt('x')
+
+    def write_checkpoint(self, prefix):
+        '''have every thread write its complete state to the file
+           prefix.RANK, from which the simulation can be continued with
+           Simulator.restore
+        '''
+        self.cexinf.on_each_async(make_writing_message('write_checkpoint', 'sl',
+                                                       prefix, self.simulated_cycles)).read_frmt('x')
+
+    def setup_rdf(self, n_bins, r_max, interval=1):
+        '''accumulate the radial distribution function to r_max (at most
+           the pair cutoff) in n_bins bins from the neighbor lists of every
+           thread, sampled every interval force evaluations.  discards any
+           previously accumulated samples
+        '''
+        self.cexinf.on_each_async(make_writing_message('setup_rdf', 'ifi',
+                                                       n_bins, r_max, interval)).read_frmt('x')
+        self.rdf_r_max = r_max
+
+    def collect_rdf(self, reset=False):
+        '''retrieve the radial distribution function accumulated since
+           setup_rdf (or the last reset), as arrays of the bin centers and
+           g(r) along with the number of samples
+        '''
+        replies = self.cexinf.on_each_async(make_writing_message('collect_rdf', 'i',
+                                                                 int(bool(reset)))).msgs
+        histogram, n_samples, n_particles = replies[0].read_frmt('Diix')
+        for reply in replies[1:]:
+            reply.read_frmt('x')
+        edges = linspace(0, self.rdf_r_max, len(histogram)+1)
+        shell_volumes = 4/3 * pi * (edges[1:]**3 - edges[:-1]**3)
+        ideal_pairs = (0.5 * n_particles * (n_particles-1) *
+                       shell_volumes / prod(self.parameters.box_size))
+        g = histogram / ((n_samples or 1) * ideal_pairs)
+        return 0.5 * (edges[1:] + edges[:-1]), g, n_samples
+
+    def setup_msd(self, interval, max_lag=1000):
+        '''accumulate the mean squared displacement of all particles,
+           sampling unwrapped positions every interval integration cycles,
+           at logarithmically spaced lags of up to max_lag samples.  long
+           lags are measured between block averages of the samples, s.t.
+           memory grows only with the logarithm of max_lag.  discards any
+           previous samples.
+           requires the particles of the initial configuration
+        '''
+        self.cexinf.on_each_async(make_writing_message('setup_msd', 'ii',
+                                                       interval, max_lag)).read_frmt('x')
+
+    def collect_msd(self, reset=False):
+        '''retrieve the mean squared displacement accumulated since setup_msd
+           (or the last reset), as arrays of the lag times and the mean
+           squared displacement at each.  lags not yet sampled are omitted
+        '''
+        replies = self.cexinf.on_each_async(make_writing_message('collect_msd', 'i',
+                                                                 int(bool(reset)))).msgs
+        lags, msd = replies[0].read_frmt('JDx')
+        for reply in replies[1:]:
+            reply.read_frmt('x')
+        sampled = msd > 0
+        return lags[sampled] * self.time_step, msd[sampled]
+
+    def find_clusters(self, bond_distance, labels=False):
+        '''find the clusters of particles bonded within bond_distance (at
+           most the pair cutoff), returning an array whose n-th element is
+           the number of clusters of n particles.  with labels, also
+           returns an array of the cluster of each particle (ordered as
+           in get_positions), identified by its first particle
+        '''
+        replies = self.cexinf.on_each_async(make_writing_message('find_clusters', 'fi',
+                                                                 bond_distance,
+                                                                 int(bool(labels)))).msgs
+        [distribution] = replies[0].read_frmt('J')
+        if not labels:
+            for reply in replies:
+                reply.read_frmt('x')
+            return distribution
+        tags, cluster_labels = map(concatenate, zip(*[reply.read_frmt('LLx')
+                                                      for reply in replies]))
+        particle_labels = zeros(len(tags), int)
+        particle_labels[tags] = cluster_labels
+        return distribution, particle_labels
+
     def get_state(self):
         '''retrieve the internal state of each thread.  largely only useful for
            debugging
@@ -126,7 +301,7 @@ class Simulator(object):
                          internal_neighbors=read_neighbors(internal_neighbors),
                          external_neighbors=read_neighbors(external_neighbors))
                      for positions,tags,internal_neighbors,external_neighbors in
-                     self.cexinf.on_each_async(make_writing_message('collect_thread_state')).read_frmt('VIIIx')])
+                     self.cexinf.on_each_async(make_writing_message('collect_thread_state')).read_frmt('WLJJx')])
 
     # # # # # # #
     # Internals #
@@ -138,27 +313,56 @@ class Simulator(object):
         self.start_time = start_time
         self.simulated_cycles = 0
         self.parameters = parameters
-
-    def simulate_cycles(self, steps):
-        self.cexinf.map_slave_async_send([make_writing_message("slave_simulation_loop")]*(self.cexinf.get_size()-1))
-        self.cexinf.perform_command(0, make_writing_message('master_simulate_cycles', 'i', steps))
+        self.rdf_r_max = None
+        self.snapshot_time = None
+
+    def simulate_cycles(self, steps, background=None):
+        self.cexinf.map_all_async_send([make_writing_message('master_simulate_cycles', 'i', steps)] +
+                                       [make_writing_message("slave_simulation_loop")]*(self.cexinf.get_size()-1))
+        if background is not None:
+            background()
+        self.cexinf.map_all_async_recv()
         self.simulated_cycles += steps
-        self.cexinf.map_slave_async_recv()
+
+
+class Snapshot(object):
+    '''positions fetched by Simulator.fetch_snapshot, in order of thread
+    '''
+
+    def __init__(self, time, wall_time, positions, tags):
+        self.time = time
+        self.wall_time = wall_time
+        self.positions = positions
+        self.tags = tags
+
+    def get_configuration(self):
+        '''as Simulator.get_configuration at the time of the snapshot
+        '''
+        assert len(set(self.tags)) == len(self.tags)
+        return state.Configuration(time=self.time,
+                                   wall_time=self.wall_time,
+                                   positions=self.positions[argsort(self.tags)])
 
 
 # # # # # # # # # # # # # #
 # Initialization Routines #
 # # # # # # # # # # # # # #
 
-def initialize(cexinf, parameters, configuration, divisions, random_seed):
+def initialize(cexinf, parameters, configuration, divisions, random_seed, threads=None):
     '''initialize a cex process (through cexinf) for the
        simulation of the specified system
     '''
     initialize_thread_names(cexinf)
+    if threads is not None:
+        initialize_threads(cexinf, threads)
     initialize_system(cexinf, parameters)
     initialize_random(cexinf, random_seed)
+    if divisions is None:
+        initialize_grid_cells(cexinf, positions=configuration.positions)
+        return
     thread_cells = create_cells(array(parameters.box_size),
-                                configuration.positions, divisions, cexinf.get_size())
+                                configuration.positions, divisions, cexinf.get_size(),
+                                parameters.r_neighbor)
     setup_comm_rules(thread_cells)
     initialize_thread_cells(cexinf, thread_cells)
 
@@ -168,12 +372,24 @@ def initialize_thread_names(cexinf):
                          for i in xrange(cexinf.get_size()))
 
 
+def initialize_threads(cexinf, threads):
+    cexinf.on_each_async(make_writing_message('set_num_threads', 'i', threads)).read_frmt('x')
+
 def initialize_system(cexinf, parameters):
-    '''setup-thread independent state
+    '''setup-thread independent state.  only the master is sent the
+       fields, which it broadcasts to the slaves
+    '''
+    cexinf.map_all_async([make_writing_message("initialize_system_broadcast", "o",
+                                               system_items(parameters))] +
+                         [make_writing_message("initialize_system_broadcast")] *
+                         (cexinf.get_size()-1)).read_frmt("x")
+
+def system_items(parameters):
+    '''fields of the initialize_system command, as also read by
+       the standalone driver
     '''
     kT = constants.kB * parameters.temperature
-    cexinf.on_each_async(make_writing_message("initialize_system", "o",
-                           NamedItems([
+    return NamedItems([
          #Size of Full Ensemble Cartesian Space
          ["box_size", "v", parameters.box_size],
          #Integration Constants
@@ -197,8 +413,7 @@ def initialize_system(cexinf, parameters):
                                      parameters.r_potential_cutoff * 1.05,
                                      parameters.linterp_size)))],
          #Neighbor Lists
-         ["r_neighbor", "f", parameters.r_neighbor]]))
-      ).read_frmt("x")
+         ["r_neighbor", "f", parameters.r_neighbor]])
 
 
 class LinterpWriter(object):
@@ -210,7 +425,7 @@ class LinterpWriter(object):
         msg.write_frmt("o", NamedItems([
             ["x_min", "f", self.linterp.x_min],
             ["x_prec", "f", self.linterp.x_prec],
-            ["table", "F", self.linterp.y]]))
+            ["table", "D", self.linterp.y]]))
 
 def scale_force_table(table):
     '''evaluate_forces relies on force linterp being normalized
@@ -238,23 +453,30 @@ def generate_seed():
     number, = struct.unpack(frmt, os.urandom(struct.calcsize(frmt)))
     return int(number & sys.maxint)
 
-def create_cells(box_size, positions, divisions, world_size):
+def create_cells(box_size, positions, divisions, world_size, r_neighbor):
     '''partition simulation space into cells using divisions
        divide positions among these cells, and tag them with
-       their index in the orignal positions array
+       their index in the orignal positions array.
+       divisions of 'bisect' divides space by recursive bisection
+       of the positions, otherwise divisions gives a regular grid
     '''
-    if divisions is None:
-        divisions = world_size
-    div_dimensions = cells.get_divs(divisions)
-    n_threads = multiply.reduce(list(div_dimensions))
-    if n_threads != world_size:
-        error("bad number of threads %d with divisions %s for %d theads",
-              n_threads, div_dimensions, world_size)
-    msg('initializing cells for n=%d with dimensions %s',
-        n_threads, div_dimensions)
-    thread_cells = cells.partition_positions(box_size, positions, div_dimensions)
+    if isinstance(divisions, str) and divisions == 'bisect':
+        msg('initializing cells for n=%d by recursive bisection', world_size)
+        thread_cells = cells.bisect_positions(box_size, positions, world_size)
+    else:
+        if divisions is None:
+            divisions = world_size
+        div_dimensions = cells.get_divs(divisions)
+        n_threads = multiply.reduce(list(div_dimensions))
+        if n_threads != world_size:
+            error("bad number of threads %d with divisions %s for %d theads",
+                  n_threads, div_dimensions, world_size)
+        msg('initializing cells for n=%d with dimensions %s',
+            n_threads, div_dimensions)
+        thread_cells = cells.partition_positions(box_size, positions, div_dimensions)
+    cells.find_junctions(thread_cells, box_size, r_neighbor)
     for cell in thread_cells:
-        cell.junctioned_cells = list(set(junction.cell for junction in cell.junctions))
+        cell.junctioned_cells = [jcell for jcell,n_overlap in cell.junctions]
         cell.jcell_indices = dict((jcell,i) for i,jcell in enumerate(cell.junctioned_cells))
     N_particles = array(list(len(cell.positions) for cell in thread_cells))
     msg('particle distribution min=%d, max=%d, mean=%.1f, std=%.1f',
@@ -299,10 +521,10 @@ def initialize_thread_cells(cexinf, thread_cells):
     '''
     cexinf.map_all_async(make_writing_message('initialize_cell_state', 'o',
                            NamedItems([
-                               ['min_extent', 'v', cell.extent.min_extent],
-                               ['max_extent', 'v', cell.extent.max_extent],
-                               ['positions', 'V', cell.positions],
-                               ['tags', 'I', cell.tags]]))
+                               ['min_extent', 'W', [cell.extent.min_extent]],
+                               ['max_extent', 'W', [cell.extent.max_extent]],
+                               ['positions', 'W', cell.positions],
+                               ['tags', 'L', cell.tags]]))
                       for cell in thread_cells).read_frmt('x')
     inst_map = dict(send=1, recv=2)
     cexinf.map_all_async(make_writing_message('initialize_cell_comm', 'o',
@@ -320,43 +542,27 @@ def initialize_thread_cells(cexinf, thread_cells):
                                       create_cell_junction_msg(cell))
                                for cell in thread_cells).read_frmt('x')
 
+def initialize_grid_cells(cexinf, positions=None, path=None):
+    '''in place of create_cells with the default grid, have the
+       simulation process partition the particles itself.  only the
+       master is sent the positions, or the path of a file it maps
+       holding them as native doubles (as written by positions.tofile),
+       and it scatters them over the cells.  particles are tagged by
+       their index
+    '''
+    assert (positions is None) != (path is None)
+    if positions is not None:
+        name, frmt, arg = ('initialize_grid_cells', 'W',
+                           asarray(positions, dtype=float64).reshape(-1, 3))
+    else:
+        name, frmt, arg = 'initialize_grid_cells_from_file', 's', path
+    cexinf.map_all_async([make_writing_message(name, frmt, arg)] +
+                         [make_writing_message(name)] * (cexinf.get_size()-1)).read_frmt('x')
+
 def create_cell_junction_msg(cell):
-    surface_junctions = []
-    line_junctions = []
-    point_junctions = []
-    index_axis = 'xyz'.index
-    direction_map = {'+':1, '-':-1}
-    for junction in cell.junctions:
-        jcell_item = ['cell_index','i', cell.jcell_indices[junction.cell]]
-        name = junction.df[0]
-        if name=='surface':
-            axis,direct = junction.df[1:]
-            surface_junctions.append(NamedItems([
-                         jcell_item,
-                         ['axis', 'i', index_axis(axis)],
-                         ['dir', 'i', direction_map[direct]]]))
-        elif name=='line':
-            axis,off1,off2 = junction.df[1:]
-            line_junctions.append(NamedItems([
-                         jcell_item,
-                         ['axis', 'i', index_axis(axis)],
-                         ['offset1', 'f', off1],
-                         ['offset2', 'f', off2]]))
-        elif name=='point':
-            point_junctions.append(NamedItems([
-                         jcell_item,
-                         ['offset', 'v', junction.df[1:]]]))
-
-        else:
-            raise RuntimeError('bad name %r' % (name,))
     return NamedItems([
              ['jcells', 'o', StructArray(
                    [['comm_index', 'i', cell.jcell_indices[jcell]],
-                    ['min_extent', 'v', jcell.extent.min_extent],
-                    ['max_extent', 'v', jcell.extent.max_extent]]
-                for jcell in cell.junctioned_cells)],
-             ['surface_junctions', 'o', StructArray(surface_junctions)],
-             ['line_junctions', 'o', StructArray(line_junctions)],
-             ['point_junctions', 'o', StructArray(point_junctions)]])
-
-
+                    ['min_extent', 'W', [jcell.extent.min_extent]],
+                    ['max_extent', 'W', [jcell.extent.max_extent]]]
+                for jcell in cell.junctioned_cells)]])
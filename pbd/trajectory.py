@@ -0,0 +1,202 @@
+##-*- Mode: python -*-
+## trajectory.py - Trajectories written directly by the simulation
+## --------------------------------------------------------------------------
+## Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+## All rights reserved.
+##
+## This program is free software: you can redistribute it and/or modify
+## it under the terms of the GNU General Public License as published by
+## the Free Software Foundation, either version 3 of the License, or
+## (at your option) any later version.
+##
+## This program is distributed in the hope that it will be useful,
+## but WITHOUT ANY WARRANTY# without even the implied warranty of
+## MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+## GNU General Public License for more details.
+##
+## You should have received a copy of the GNU General Public License
+## along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+'''Reading trajectories written by the simulation process itself
+
+   TrajectoryReader reads those of Simulator.open_trajectory (layout as
+   in src/traj.h).  Each frame is a header followed by a (tag, position)
+   record for every particle in the order written by the threads, and
+   the index file (path + '.index') locates every frame s.t. frames are
+   read in any order without scanning the file
+
+   CompressedTrajectoryReader reads those of
+   Simulator.open_compressed_trajectory (layout and coding as in
+   src/ctraj.h and src/ctraj.c)
+'''
+
+from __future__ import absolute_import
+from __future__ import division
+
+from numpy import *
+
+frame_header_dtype = dtype([('cycle', int64), ('n_particles', int64)])
+record_dtype = dtype([('tag', int64), ('position', float64, 3)])
+index_dtype = dtype([('cycle', int64), ('offset', int64), ('n_particles', int64)])
+
+
+def read_index(path):
+    return fromfile(path + '.index', dtype=index_dtype)
+
+class TrajectoryReader(object):
+    '''random access to the frames of a trajectory
+    '''
+
+    def __init__(self, path):
+        self.path = path
+        self.index = read_index(path)
+        self.data = memmap(path, dtype=uint8, mode='r')
+
+    def __len__(self):
+        return len(self.index)
+
+    @property
+    def cycles(self):
+        return self.index['cycle']
+
+    def read_records(self, i):
+        entry = self.index[i]
+        header = frombuffer(self.data, frame_header_dtype, 1, entry['offset'])[0]
+        if header['cycle'] != entry['cycle'] or header['n_particles'] != entry['n_particles']:
+            raise ValueError('frame %d of %s disagrees with index' % (i, self.path))
+        return frombuffer(self.data, record_dtype, entry['n_particles'],
+                          entry['offset'] + frame_header_dtype.itemsize)
+
+    def read_positions(self, i):
+        '''positions of frame i ordered by tag, as in Simulator.get_positions
+        '''
+        records = self.read_records(i)
+        return records['position'][argsort(records['tag'], kind='mergesort')]
+
+    def __getitem__(self, i):
+        return self.read_positions(i)
+
+    def __iter__(self):
+        for i in xrange(len(self)):
+            yield self.read_positions(i)
+
+
+ctraj_magic = 0x43444250
+ctraj_frame_magic = 0x46444250
+ctraj_version = 1
+ctraj_block_values = 64
+
+ctraj_header_dtype = dtype([('magic', uint32), ('version', uint32),
+                            ('n_particles', uint32), ('keyframe_interval', uint32),
+                            ('levels', uint32, 3), ('pad', uint32),
+                            ('box_size', float64, 3)])
+ctraj_frame_dtype = dtype([('magic', uint32), ('keyframe', uint32),
+                           ('cycle', int64), ('payload_bytes', uint64)])
+
+class CompressedTrajectoryReader(object):
+    '''random access to the frames of a compressed trajectory.  frames
+       after the last keyframe are decoded forward from it, s.t. reading
+       frames in order is cheapest.  frames appended after opening are
+       found by calling scan
+    '''
+
+    def __init__(self, path):
+        self.path = path
+        self.previous = None
+        self.previous_frame = -1
+        self.scan()
+        self.header = frombuffer(self.data, ctraj_header_dtype, 1)[0]
+        if (self.header['magic'] != ctraj_magic or
+            self.header['version'] != ctraj_version):
+            raise ValueError("%s isn't a version %d compressed trajectory" %
+                             (path, ctraj_version))
+        self.n_particles = int(self.header['n_particles'])
+        self.levels = self.header['levels'].astype(int64)
+        self.box_size = self.header['box_size'].copy()
+
+    def scan(self):
+        '''locate every complete frame; a trailing partial frame is
+           still being written
+        '''
+        self.data = memmap(self.path, dtype=uint8, mode='r')
+        offsets, cycles, keyframes = [], [], []
+        offset = ctraj_header_dtype.itemsize
+        while offset + ctraj_frame_dtype.itemsize <= len(self.data):
+            frame = frombuffer(self.data, ctraj_frame_dtype, 1, offset)[0]
+            if frame['magic'] != ctraj_frame_magic:
+                raise ValueError('corrupt frame %d in %s' % (len(offsets), self.path))
+            end = offset + ctraj_frame_dtype.itemsize + int(frame['payload_bytes'])
+            if end > len(self.data):
+                break
+            offsets.append(offset)
+            cycles.append(frame['cycle'])
+            keyframes.append(bool(frame['keyframe']))
+            offset = end
+        self.offsets = array(offsets, int64)
+        self.frame_cycles = array(cycles, int64)
+        self.keyframes = array(keyframes, bool)
+
+    def __len__(self):
+        return len(self.offsets)
+
+    @property
+    def cycles(self):
+        return self.frame_cycles
+
+    def read_positions(self, i):
+        '''positions of frame i ordered by tag, as in Simulator.get_positions
+        '''
+        if not 0 <= i < len(self):
+            raise IndexError('bad frame %d of %d' % (i, len(self)))
+        start = i
+        if self.previous_frame == i:
+            start = i + 1
+        while (0 < start <= i and not self.keyframes[start] and
+               start-1 != self.previous_frame):
+            start -= 1
+        for frame in xrange(start, i+1):
+            self.decode_frame(frame)
+        scale = self.box_size / self.levels
+        return ((self.previous + 0.5) * scale[:, newaxis]).T
+
+    def __getitem__(self, i):
+        return self.read_positions(i)
+
+    def __iter__(self):
+        for i in xrange(len(self)):
+            yield self.read_positions(i)
+
+    def decode_frame(self, i):
+        offset = self.offsets[i]
+        frame = frombuffer(self.data, ctraj_frame_dtype, 1, offset)[0]
+        start = offset + ctraj_frame_dtype.itemsize
+        payload = asarray(self.data[start:start + int(frame['payload_bytes'])])
+        n = self.n_particles
+        values = unpack_values(payload, 3*n)
+        deltas = (values >> 1) ^ -(values & 1)
+        if frame['keyframe']:
+            previous = zeros((3, n), int64)
+        else:
+            assert self.previous_frame == i-1
+            previous = self.previous
+        self.previous = (previous + deltas.reshape(3, n)) % self.levels[:, newaxis]
+        self.previous_frame = i
+
+def unpack_values(payload, n):
+    '''inverse of pack_values in src/ctraj.c
+    '''
+    values = empty(n, int64)
+    position = 0
+    for start in xrange(0, n, ctraj_block_values):
+        count = n - start if n - start < ctraj_block_values else ctraj_block_values
+        width = int(payload[position])
+        position += 1
+        nbytes = (count * width + 7) // 8
+        if width > 32 or position + nbytes > len(payload):
+            raise ValueError('corrupt compressed frame')
+        block = payload[position:position + nbytes].astype(int64)
+        bits = ((block[:, newaxis] >> arange(8)) & 1).ravel()[:count*width]
+        values[start:start+count] = dot(bits.reshape(count, width),
+                                        int64(1) << arange(width, dtype=int64))
+        position += nbytes
+    return values
@@ -0,0 +1,269 @@
+/* -*- Mode: c -*-
+ * balance.c - Dynamic load balancing of cell extents
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Load Balancing
+ * -------------------------------------------------------------------
+ * When the cells form a regular grid (as created by pbd.cells) the
+ * planes dividing the grid along each axis can be moved without
+ * changing which cells are junctioned, and thereby without changing
+ * any communicators or communication rules.  Each thread accumulates
+ * the time spent evaluating forces and building neighbor lists, and
+ * every few neighbor list rebuilds the planes are shifted toward the
+ * locations that divide this work evenly between the slabs of cells
+ * along each axis, treating work as uniform within each slab.
+ *
+ * A plane moves at most a quarter of the neighbor distance at a time
+ * and no slab becomes thinner than the neighbor distance, s.t. every
+ * particle remains within either its own cell or a junctioned cell.
+ * The following update of particle membership then migrates particles
+ * to their new cells.
+ */
+
+#include <mpi.h>
+#include <stdlib.h>
+
+#include "opt.h"
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "periodic.h"
+#include "cells.h"
+#include "bd.h"
+#include "init.h"
+#include "balance.h"
+
+double CEX_balance_work=0;
+
+static int balance_interval=0;
+static double balance_damping=-1;
+static int rebuilds_since_balance=0;
+
+/* grid_planes[axis] holds the grid_divs[axis]+1 planes along each axis,
+ * the first at 0 and the last at the box size */
+static int grid_divs[3];
+static double *grid_planes[3] = {NULL, NULL, NULL};
+/* index of the slab along each axis containing each thread's cell */
+static int *rank_slabs=NULL;
+#define RANK_SLAB(rank, axis) rank_slabs[3*(rank) + (axis)]
+
+static int find_grid(void);
+
+void
+CEX_configure_balancing(int rebuild_interval, double damping)
+{
+        REQ_INIT();
+        if (rebuild_interval < 0) {
+                Fatal("bad rebuild interval %d", rebuild_interval);
+        }
+        if (!(damping > 0 && damping <= 1)) {
+                Fatal("bad damping %.3g; must be in range (0:1]", damping);
+        }
+        balance_interval = 0;
+        rebuilds_since_balance = 0;
+        CEX_balance_work = 0;
+        if (rebuild_interval==0 || !HAVE_JUNCTIONS()) {
+                return;
+        }
+        if (!find_grid()) {
+                if (IS_MASTER()) {
+                        xprintf("cells don't form a regular grid; not balancing");
+                }
+                return;
+        }
+        balance_interval = rebuild_interval;
+        balance_damping = damping;
+        if (IS_MASTER()) {
+                xprintf("balancing %dx%dx%d cells every %d rebuilds with damping %.2f",
+                        grid_divs[AXIS_X], grid_divs[AXIS_Y], grid_divs[AXIS_Z],
+                        balance_interval, balance_damping);
+        }
+}
+
+static int
+cmp_doubles(const double *a, const double *b)
+{
+        return (*a > *b) - (*a < *b);
+}
+
+/* gather the extents of all cells and determine the planes that divide
+ * them along each axis.  returns 0 if the cells aren't a regular grid */
+static int
+find_grid(void)
+{
+        double extents[6];
+        double *all_extents = XNEW(double, 6*CEX_size);
+        int is_grid = 1, n_cells = 1;
+
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                extents[axis] = INDEX_AXIS(&CEX_this_cell->min_extent, axis);
+                extents[3+axis] = INDEX_AXIS(&CEX_this_cell->max_extent, axis);
+        }
+        MPI_Allgather(extents, 6, MPI_DOUBLE, all_extents, 6, MPI_DOUBLE,
+                      MPI_COMM_WORLD);
+        if (rank_slabs==NULL) {
+                rank_slabs = XNEW(int, 3*CEX_size);
+        }
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                if (grid_planes[axis]!=NULL) {
+                        CEX_free(grid_planes[axis]);
+                }
+                double *planes = grid_planes[axis] = XNEW(double, CEX_size+1);
+                for (int rank=0; rank<CEX_size; rank++) {
+                        planes[rank] = all_extents[6*rank + axis];
+                }
+                qsort(planes, CEX_size, sizeof(double),
+                      (int (*)(const void *, const void *))cmp_doubles);
+                int n = 0;
+                for (int i=0; i<CEX_size; i++) {
+                        if (n==0 || planes[i]!=planes[n-1]) {
+                                planes[n++] = planes[i];
+                        }
+                }
+                planes[n] = INDEX_AXIS(&CEX_box_size, axis);
+                grid_divs[axis] = n;
+                n_cells *= n;
+                is_grid &= planes[0]==0;
+                for (int rank=0; rank<CEX_size; rank++) {
+                        double min = all_extents[6*rank + axis];
+                        double max = all_extents[6*rank + 3 + axis];
+                        int slab = 0;
+                        while (planes[slab]!=min) {
+                                slab++;
+                        }
+                        RANK_SLAB(rank, axis) = slab;
+                        is_grid &= planes[slab+1]==max;
+                }
+        }
+        CEX_free(all_extents);
+        return is_grid && n_cells==CEX_size;
+}
+
+static void balance_axis(int axis, const double *work);
+static void update_cell_extents(void);
+
+void
+CEX_balance_cells(void)
+{
+        if (likely(balance_interval==0 ||
+                   ++rebuilds_since_balance < balance_interval)) {
+                return;
+        }
+        rebuilds_since_balance = 0;
+        double *work = XNEW(double, CEX_size);
+        MPI_Allgather(&CEX_balance_work, 1, MPI_DOUBLE, work, 1, MPI_DOUBLE,
+                      MPI_COMM_WORLD);
+        CEX_balance_work = 0;
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                balance_axis(axis, work);
+        }
+        update_cell_extents();
+        if (IS_MASTER()) {
+                double total=0, max=0;
+                for (int rank=0; rank<CEX_size; rank++) {
+                        total += work[rank];
+                        max = work[rank] > max ? work[rank] : max;
+                }
+                xprintf("balanced cells; work max/mean %.3f",
+                        total > 0 ? max * CEX_size / total : 1.0);
+        }
+        CEX_free(work);
+}
+
+/* move the interior planes along an axis toward equal work per slab */
+static void
+balance_axis(int axis, const double *work)
+{
+        int n = grid_divs[axis];
+        double *planes = grid_planes[axis];
+        double min_width = CEX_r_neighbor;
+        double max_shift = 0.25 * CEX_r_neighbor;
+
+        if (n < 2 || planes[n] < n * min_width) {
+                return;
+        }
+        double slab_work[n];
+        double total = 0;
+        for (int slab=0; slab<n; slab++) {
+                slab_work[slab] = 0;
+        }
+        for (int rank=0; rank<CEX_size; rank++) {
+                slab_work[RANK_SLAB(rank, axis)] += work[rank];
+                total += work[rank];
+        }
+        if (total <= 0) {
+                return;
+        }
+        /* locate each plane where the cumulative work reaches its share,
+         * then move toward it by the damping, limited by max_shift */
+        double new_planes[n+1];
+        double cumulative = 0;
+        int slab = 0;
+        new_planes[0] = planes[0];
+        new_planes[n] = planes[n];
+        for (int k=1; k<n; k++) {
+                double goal = total * k / n;
+                while (slab < n-1 && cumulative + slab_work[slab] < goal) {
+                        cumulative += slab_work[slab++];
+                }
+                double frac = slab_work[slab] > 0 ?
+                        (goal - cumulative) / slab_work[slab] : 0;
+                double target = planes[slab] + frac * (planes[slab+1] - planes[slab]);
+                double shift = balance_damping * (target - planes[k]);
+                shift = shift > max_shift ? max_shift : shift;
+                shift = shift < -max_shift ? -max_shift : shift;
+                new_planes[k] = planes[k] + shift;
+        }
+        /* maintain minimum slab width */
+        for (int k=1; k<n; k++) {
+                if (new_planes[k] < new_planes[k-1] + min_width) {
+                        new_planes[k] = new_planes[k-1] + min_width;
+                }
+        }
+        for (int k=n-1; k>0; k--) {
+                if (new_planes[k] > new_planes[k+1] - min_width) {
+                        new_planes[k] = new_planes[k+1] - min_width;
+                }
+        }
+        for (int k=1; k<n; k++) {
+                planes[k] = new_planes[k];
+        }
+}
+
+static void
+set_cell_extent(cell_t *cell, int rank)
+{
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                int slab = RANK_SLAB(rank, axis);
+                INDEX_AXIS(&cell->min_extent, axis) = grid_planes[axis][slab];
+                INDEX_AXIS(&cell->max_extent, axis) = grid_planes[axis][slab+1];
+        }
+}
+
+static void
+update_cell_extents(void)
+{
+        set_cell_extent(CEX_this_cell, CEX_rank);
+
+        cell_t *jcellp; int counter;
+        JCELL_FOREACH(jcellp, counter) {
+                set_cell_extent(jcellp, jcellp->comm->comm_rank);
+        }
+}
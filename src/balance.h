@@ -0,0 +1,37 @@
+/* -*- Mode: c -*-
+ * balance.h - Dynamic load balancing of cell extents
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BALANCE_H
+#define _BALANCE_H
+
+/* wall time this thread has spent evaluating forces and building
+ * neighbor lists since the cells were last balanced (seconds) */
+extern double CEX_balance_work;
+
+/* rebalance every `rebuild_interval neighbor list rebuilds (0 disables),
+ * moving each plane dividing the cells by `damping of the distance to
+ * its target.  collective; must be called on every thread */
+void CEX_configure_balancing(int rebuild_interval, double damping);
+
+/* called on every thread at the start of each neighbor list rebuild,
+ * before particle membership is updated */
+void CEX_balance_cells(void);
+
+#endif /* _BALANCE_H */
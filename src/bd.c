@@ -43,6 +43,7 @@
 #include <math.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <limits.h>
 #include <omp.h>
 
 #include "opt.h"
@@ -57,6 +58,10 @@
 #include "constants.h"
 #include "bd.h"
 #include "init.h"
+#include "balance.h"
+#include "traj.h"
+#include "rdf.h"
+#include "msd.h"
 
 /* Data from bd.h
  *---------------*/
@@ -81,6 +86,7 @@ array_t *CEX_tags=NULL;
 array_t *CEX_forces=NULL;
 array_t *CEX_random_vectors=NULL;
 array_t *CEX_nl_displace=NULL;
+array_t *CEX_images=NULL;
 
 array_t *CEX_internal_neighbors=NULL;
 array_t *CEX_external_neighbors=NULL;
@@ -92,6 +98,10 @@ array_t *CEX_external_neighbors=NULL;
  * requires communication between threads.  This process can be 
  * described as follows:
  *
+ *  o Balance Cells
+ *     When enabled, every few rebuilds the extents of all cells are
+ *     shifted to even out the work between threads (see balance.c).
+ *
  *  o Update Particle Membership
  *     Particles may have moved outside of this threads's cell 
  *     since the last time neighbor lists where built. We find 
@@ -100,47 +110,58 @@ array_t *CEX_external_neighbors=NULL;
  *     cells.
  *
  *  o Determine Particles Close to Junctioned Cells
- *     For each junctioning cell mode, determine which particles in
- *     this cell have to be considered by the junctioned cell. 
- *     This information is then sent to the corresponding thread.  
+ *     For each junctioned cell, determine which particles in this
+ *     cell are within the neighbor distance of any point in the extent
+ *     of the junctioned cell.  Only these particles can be neighbors
+ *     of the particles internal to that cell, and their positions
+ *     are sent to the corresponding thread.
  * 
  *  o Build Neighbor Lists
  *     Use the location of internal particles and particles of junctioned cells
  *     to build neighbor lists for the particles internal to this cell.
- *
- *  o Remove Un-needed External Particles
- *     Find out which external particles are not used in any force
- *     evaluations, as they are not included in the neighbor lists.
- *     We requests these particles be removed from the send indices
- *     table to minimize communication overhead.
  */
 
 static void update_particle_membership(void);
 static void determine_possible_neighbors(void);
 static void rebuild_neighborlists(void);
-static void remove_unneeded_external_particles(void);
 static void allocate_external_exchange_buffers(void);
 static void sort_neighbor_list(array_t *);
 static void sort_send_indices(void);
 static void setup_force_aux(void);
 
+/* set once neighbor lists have been built */
+static int neighbor_lists_built=0;
+/* set while the neighbor lists hold for the current positions, s.t.
+ * simulation can continue with them from one call to the next */
+static int neighbor_lists_current=0;
+
+void
+CEX_invalidate_neighbor_lists(void)
+{
+        neighbor_lists_current = 0;
+}
+
 void
 CEX_thread_update_neighbors(void)
 {
         REQ_INIT();
         if (HAVE_JUNCTIONS()) {
+                CEX_balance_cells();
                 update_particle_membership();
                 determine_possible_neighbors();
         }
+        double start = MPI_Wtime();
         rebuild_neighborlists();
         sort_neighbor_list(CEX_internal_neighbors);
         if (HAVE_JUNCTIONS()) {
-                remove_unneeded_external_particles();
                 allocate_external_exchange_buffers();
                 sort_neighbor_list(CEX_external_neighbors);
                 sort_send_indices();
         }
+        CEX_balance_work += MPI_Wtime() - start;
         setup_force_aux();
+        neighbor_lists_built = 1;
+        neighbor_lists_current = 1;
         /* don't clear CEX_send_indices, as we'll uses these 
          * indices durring simulation to communicate new positions
          * of external particles durring simulation */
@@ -159,21 +180,21 @@ array_t *CEX_recv_lengths=NULL;
 #define SET_RECV_LENGTH(comm,len) (GET_RECV_LENGTH(comm) = (len))
 
 static void clear_send_indices(void);
-static void exchange_send_lengths(void);
 
 
 /* Updating Particle Membership
  *-------------------------------------------------------------
  * Redistribute exited particles to adjacent cells, s.t. that 
- * each particle is within the extent of its new cell.
+ * each particle is within the extent of its new cell.  The full
+ * state of each exiting particle is packed into a migrant_t and
+ * sent to each adjacent thread as a single message, whose length
+ * the reciever determines by probing.
  */
 
 /* add indices of particle to send to each comm's send_indices */
 static int annote_exited_particles(void);
-/* temporary arrays to recieve positions and tags */
-static int setup_exchange_exit_temps(void);
-/* send/recieve particles from pair communicators */
-static void exchange_exited_particles(void);
+/* send/recieve particles from pair communicators; returns number recieved */
+static int exchange_exited_particles(void);
 /* update internal data structures */
 static void remove_exited_particles(int n_sent);
 static void insert_entered_particles(void);
@@ -185,9 +206,7 @@ update_particle_membership(void)
         truncate_array(CEX_positions, CEX_N_internal_particles);
         clear_send_indices();
         int n_sent = annote_exited_particles();
-        exchange_send_lengths();
-        int n_recv = setup_exchange_exit_temps();
-        exchange_exited_particles();
+        int n_recv = exchange_exited_particles();
         remove_exited_particles(n_sent);
         insert_entered_particles();
         clear_send_indices();
@@ -228,46 +247,96 @@ annote_exited_particles(void)
 }
 
 /* temporary arrays for each communicator to recieve particles */
-array_t *CEX_tmp_recv_positions=NULL;
-array_t *CEX_tmp_recv_tags=NULL;
+array_t *CEX_tmp_recv_migrants=NULL;
 
-#define GET_TMP_RECV_POSITIONS(comm) \
-        GET_COMM_DATA(array_t *,  CEX_tmp_recv_positions,  comm)
-#define GET_TMP_RECV_TAGS(comm) \
-        GET_COMM_DATA(array_t *,  CEX_tmp_recv_tags,  comm)
+#define GET_TMP_RECV_MIGRANTS(comm) \
+        GET_COMM_DATA(array_t *,  CEX_tmp_recv_migrants,  comm)
 
-static inline void
-setup_temp_array(int size, array_t *arr)
+/* reused buffer for packing particles sent to a single communicator */
+static array_t *send_migrants_buffer=NULL;
+
+/* append the particles of send_indices to migrants */
+static void
+pack_migrants(array_t *send_indices, array_t *migrants)
 {
-        clear_array(arr);
-        CEX_prealloc_array(arr, size);
+        int *inxp, counter;
+
+        CEX_prealloc_array(migrants, ARR_LENGTH(migrants) + ARR_LENGTH(send_indices));
+        IARR_FOREACH(send_indices, inxp, counter) {
+                migrant_t migrant;
+                migrant.position = ARR_INDEX_AS(vec_t, CEX_positions, *inxp);
+                migrant.tag = ARR_INDEX_AS(tag_t, CEX_tags, *inxp);
+                migrant.image = ARR_INDEX_AS(image_t, CEX_images, *inxp);
+                ARR_APPEND(migrant_t, migrants, migrant);
+        }
 }
 
+#ifdef MPI_NEIGHBOR_COLLECTIVES
+static comm_layout_t migrants_layout;
+static array_t *recv_migrants_buffer=NULL;
+
+/* exchange the number of bytes and then the particles for every
+ * communicator in two neighborhood collectives */
 static int
-setup_exchange_exit_temps(void)
+exchange_exited_particles(void)
 {
         comm_t *comm;
         int counter, n_recv=0;
-        
+
+        if (send_migrants_buffer==NULL) {
+                send_migrants_buffer = CEX_make_array(sizeof(migrant_t), 0);
+                recv_migrants_buffer = CEX_make_array(sizeof(migrant_t), 0);
+                CEX_init_comm_layout(&migrants_layout);
+        }
+        clear_array(send_migrants_buffer);
+        COMM_FOREACH(comm, counter) {
+                array_t *send_indices = GET_SEND_INDICES(comm);
+                pack_migrants(send_indices, send_migrants_buffer);
+                LAYOUT_SEND_COUNT(&migrants_layout, comm) = 
+                        ARR_LENGTH(send_indices) * sizeof(migrant_t);
+        }
+        CEX_layout_send_displs(&migrants_layout);
+        int recv_bytes = CEX_neighbor_exchange_counts(&migrants_layout);
+        CEX_prealloc_array(recv_migrants_buffer, recv_bytes / sizeof(migrant_t));
+        CEX_neighbor_exchange(&migrants_layout, ARR_DATA(send_migrants_buffer),
+                              ARR_DATA(recv_migrants_buffer));
+        /* split recieved particles by communicator */
         COMM_FOREACH(comm, counter) {
-                int size = GET_RECV_LENGTH(comm);
-                n_recv += size;
-                setup_temp_array(size, GET_TMP_RECV_POSITIONS(comm));
-                setup_temp_array(size, GET_TMP_RECV_TAGS(comm));
+                array_t *migrants = GET_TMP_RECV_MIGRANTS(comm);
+                int len = LAYOUT_RECV_COUNT(&migrants_layout, comm) / sizeof(migrant_t);
+                CEX_prealloc_array(migrants, len);
+                XMEMCPY(char, ARR_DATA(migrants), 
+                        ARR_DATA_AS(char, recv_migrants_buffer) + 
+                        LAYOUT_RECV_DISPL(&migrants_layout, comm),
+                        LAYOUT_RECV_COUNT(&migrants_layout, comm));
+                ARR_LENGTH(migrants) = len;
+                n_recv += len;
         }
         return n_recv;
 }
-
-static void 
+#else
+static int
 exchange_exited_particles(void)
 {
-        DO_COMM(comm, /* positions */
-        /* send */ comm_send_vecs_by_index(comm, CEX_positions, GET_SEND_INDICES(comm)),
-        /* recv */ comm_recv_vecs(comm, GET_TMP_RECV_POSITIONS(comm)));
-        DO_COMM(comm, /* tags */
-        /* send */ comm_send_ints_by_index(comm, CEX_tags, GET_SEND_INDICES(comm)),
-        /* recv */ comm_recv_ints(comm, GET_TMP_RECV_TAGS(comm)));
+        comm_t *comm;
+        int counter, n_recv=0;
+
+        if (send_migrants_buffer==NULL) {
+                send_migrants_buffer = CEX_make_array(sizeof(migrant_t), 0);
+        }
+        COMM_FOREACH(comm, counter) {
+                clear_array(GET_TMP_RECV_MIGRANTS(comm));
+        }
+        DO_COMM(comm,
+        /* send */ ({clear_array(send_migrants_buffer);
+                     pack_migrants(GET_SEND_INDICES(comm), send_migrants_buffer);
+                     comm_send_array(comm, send_migrants_buffer);}),
+        /* recv */ ({array_t *migrants = GET_TMP_RECV_MIGRANTS(comm);
+                     comm_recv_array(comm, migrants);
+                     n_recv += ARR_LENGTH(migrants);}));
+        return n_recv;
 }
+#endif /* MPI_NEIGHBOR_COLLECTIVES */
 
 static void 
 remove_exited_particles(int n_sent)
@@ -281,6 +350,7 @@ remove_exited_particles(int n_sent)
         }
         CEX_remove_array_of_indices(CEX_positions, all_sent);
         CEX_remove_array_of_indices(CEX_tags, all_sent);
+        CEX_remove_array_of_indices(CEX_images, all_sent);
         CEX_free_array(all_sent);
 }
 
@@ -291,8 +361,13 @@ insert_entered_particles(void)
         int counter;
         
         COMM_FOREACH(comm, counter) {
-                CEX_extend_array(CEX_positions, GET_TMP_RECV_POSITIONS(comm));
-                CEX_extend_array(CEX_tags, GET_TMP_RECV_TAGS(comm));
+                migrant_t *migp;
+                int mig_counter;
+                XARR_FOREACH(GET_TMP_RECV_MIGRANTS(comm), migp, mig_counter) {
+                        VARR_APPEND(CEX_positions, migp->position);
+                        ARR_APPEND(tag_t, CEX_tags, migp->tag);
+                        ARR_APPEND(image_t, CEX_images, migp->image);
+                }
         }
 }
 
@@ -307,14 +382,6 @@ clear_send_indices(void)
         }
 }
 
-static void
-exchange_send_lengths(void)
-{
-        DO_COMM(comm, 
-        /* send */ comm_send_int(comm, (int)ARR_LENGTH(GET_SEND_INDICES(comm))),
-        /* recv */ SET_RECV_LENGTH(comm, comm_recv_int(comm)));
-}
-
 static void
 sort_send_indices(void)
 {
@@ -329,77 +396,73 @@ sort_send_indices(void)
 /* Determine Particles Close to Junctioned Cells
  *-------------------------------------------------------------*/
 
-/* For every particle, check which junctions the particle is close enough
- * to, to possibly be a neighbor to a particle inside of that adjacent cell.
- * We add the index of these particles to the send indices of the 
- * communicators for the threads corresponding to these adjacent cells. */
-static void record_particles_near_junctions(void);
-
-/* Once we know how many positions we'll be recieving from each of
- * our adjacnet threads, allocte space in CEX_positions to hold 
- * these positions  */
-static void allocate_for_external_neighbors(void);
-
-/* Following allocation, we exchange these positions */
+/* For every particle, check which junctioned cells the particle is close
+ * enough to, to possibly be a neighbor to a particle inside of that cell.
+ * As all particles internal to a cell are within its extent after
+ * updating particle membership, it suffices to compare against the
+ * entire extent of the junctioned cell.  We add the index of these
+ * particles to the send indices of the communicators for the threads
+ * corresponding to these adjacent cells. */
+static void record_particles_near_jcells(void);
+
+/* exchange these positions; recieved positions are appended to
+ * CEX_positions following the internal particles */
 static void exchange_external_positions(void);
 
 static void 
 determine_possible_neighbors(void)
 {
         clear_send_indices();
-        record_particles_near_junctions();
-        exchange_send_lengths();
-        allocate_for_external_neighbors();
+        record_particles_near_jcells();
         exchange_external_positions();
 }
 
-/* record all cells that this position is close enough to, to be a neighbor */
-static inline void check_position_junctions(vec_t position, array_t *cells_near)
+/* square of the minimum periodic distance from a position to any
+ * point within the extent of a cell */
+static inline double cell_distance_sqr(cell_t *cell, vec_t position)
         GCC_ATTRIBUTE((always_inline));
 
 static void
-record_particles_near_junctions(void)
+record_particles_near_jcells(void)
 {
         /* all particles should be internal at this point */
         assert(ARR_LENGTH(CEX_positions)==CEX_N_internal_particles);
         vec_t *posp;
         int pos_counter;
-        array_t *cells_near = CEX_make_array(sizeof(void *), ARR_LENGTH(CEX_jcells));
         VARR_FOREACH(CEX_positions, posp, pos_counter) {
-                clear_array(cells_near);
-                check_position_junctions(*posp, cells_near);
-                if (unlikely(ARR_LENGTH(cells_near))) {
-                        int pos_index = (int)(posp - ARR_DATA_AS(vec_t, CEX_positions));
-                        cell_t **cellp; int cell_counter;
-                        XARR_FOREACH(cells_near, cellp, cell_counter) {
-                                #if 0
-                                xprintf(Vec3_FRMT("%.2f") " [%d] near %d", 
-                                        Vec3_ARGS_SCALED(1e9, *posp),
-                                        pos_index, (*cellp)->comm->comm_rank);
-                                #endif
-                                array_t *send_indices = GET_SEND_INDICES((*cellp)->comm);
+                int pos_index = (int)(posp - ARR_DATA_AS(vec_t, CEX_positions));
+                cell_t *jcellp; int cell_counter;
+                JCELL_FOREACH(jcellp, cell_counter) {
+                        if (unlikely(cell_distance_sqr(jcellp, *posp) <= 
+                                     CEX_r_neighbor_sqr)) {
+                                array_t *send_indices = GET_SEND_INDICES(jcellp->comm);
                                 IARR_APPEND(send_indices, pos_index);
                         }
                 }
         }
-        CEX_free_array(cells_near);
 }
 
-static void 
-allocate_for_external_neighbors(void)
+static inline double
+cell_distance_sqr(cell_t *cell, vec_t position)
 {
-        comm_t *comm;
-        int counter, n_recv = 0;
-        COMM_FOREACH(comm, counter) {
-                n_recv += GET_RECV_LENGTH(comm);
+        double d_sqr = 0;
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                double min = INDEX_AXIS(&cell->min_extent, axis);
+                double half_width = (INDEX_AXIS(&cell->max_extent, axis) - min) / 2;
+                double d = INDEX_AXIS(&position, axis) - (min + half_width);
+                XPERIODIZE_SEPARATION(d, INDEX_AXIS(&CEX_box_size, axis),
+                                      INDEX_AXIS(&CEX_box_half, axis));
+                d = fabs(d) - half_width;
+                if (d > 0) {
+                        d_sqr += d * d;
+                }
         }
-        CEX_prealloc_array(CEX_positions, ARR_LENGTH(CEX_positions) + n_recv);
+        return d_sqr;
 }
 
 /* For every sequence of external positions recieved from a neighboring cell
- * we need to know where these positions are stored in CEX_positions for both
- * re-recieving position for evaluating forces and for removing unneeded 
- * external indices. */
+ * we need to know where these positions are stored in CEX_positions for
+ * re-recieving position for evaluating forces. */
 array_t *CEX_ext_positions_offset=NULL;
 
 #define GET_EXT_POSITIONS_OFFSET(comm) \
@@ -407,168 +470,332 @@ array_t *CEX_ext_positions_offset=NULL;
 #define SET_EXT_POSITIONS_OFFSET(comm,index) \
         (GET_EXT_POSITIONS_OFFSET(comm) = (index))
 
+#ifdef MPI_NEIGHBOR_COLLECTIVES
+/* external positions are recieved following the internal particles
+ * in the order of the sources of CEX_neighbor_comm.  this layout is
+ * retained for updating external positions */
+static comm_layout_t positions_layout;
+static array_t *send_positions_block=NULL;
+
+static void
+exchange_external_positions(void)
+{
+        comm_t *comm;
+        int counter;
+
+        if (send_positions_block==NULL) {
+                send_positions_block = CEX_make_vec_array(0);
+                CEX_init_comm_layout(&positions_layout);
+        }
+        clear_array(send_positions_block);
+        COMM_FOREACH(comm, counter) {
+                array_t *send_indices = GET_SEND_INDICES(comm);
+                int *inxp, inx_counter;
+                CEX_prealloc_array(send_positions_block, 
+                                   ARR_LENGTH(send_positions_block) + 
+                                   ARR_LENGTH(send_indices));
+                IARR_FOREACH(send_indices, inxp, inx_counter) {
+                        VARR_APPEND(send_positions_block,
+                                    ARR_INDEX_AS(vec_t, CEX_positions, *inxp));
+                }
+                LAYOUT_SEND_COUNT(&positions_layout, comm) = 
+                        ARR_LENGTH(send_indices) * sizeof(vec_t);
+        }
+        CEX_layout_send_displs(&positions_layout);
+        int n_recv = CEX_neighbor_exchange_counts(&positions_layout) / sizeof(vec_t);
+        int offset = ARR_LENGTH(CEX_positions);
+        CEX_prealloc_array(CEX_positions, offset + n_recv);
+        CEX_neighbor_exchange(&positions_layout, ARR_DATA(send_positions_block),
+                              ARR_ADDRESS_ELEMENT(CEX_positions, offset));
+        ARR_LENGTH(CEX_positions) += n_recv;
+        COMM_FOREACH(comm, counter) {
+                SET_EXT_POSITIONS_OFFSET(comm, offset + 
+                        LAYOUT_RECV_DISPL(&positions_layout, comm) / sizeof(vec_t));
+                SET_RECV_LENGTH(comm, 
+                        LAYOUT_RECV_COUNT(&positions_layout, comm) / sizeof(vec_t));
+        }
+}
+#else
 static void 
 exchange_external_positions(void)
 {
         DO_COMM(comm, 
         /* send */ comm_send_vecs_by_index(comm, CEX_positions, 
                                            GET_SEND_INDICES(comm)),
-        /* recv */ ({SET_EXT_POSITIONS_OFFSET(comm, ARR_LENGTH(CEX_positions));
-                     comm_recv_extend_vecs(comm,  CEX_positions);}));
+        /* recv */ ({int offset = ARR_LENGTH(CEX_positions);
+                     SET_EXT_POSITIONS_OFFSET(comm, offset);
+                     comm_recv_extend_vecs(comm,  CEX_positions);
+                     SET_RECV_LENGTH(comm, ARR_LENGTH(CEX_positions) - offset);}));
 }
+#endif /* MPI_NEIGHBOR_COLLECTIVES */
 
 
-/* for 1 position, check every junction, and record nearby ones */
-static inline void add_uniq(array_t *cells_near, cell_t* cell) 
-        GCC_ATTRIBUTE((always_inline));
-static inline int check_surface_junction(surface_junction_t *, vec_t)
-        GCC_ATTRIBUTE((always_inline));
-static inline int check_line_junction(line_junction_t *, vec_t)
-        GCC_ATTRIBUTE((always_inline));
-static inline int check_point_junction(point_junction_t *, vec_t)
-        GCC_ATTRIBUTE((always_inline));
+/* Build Neighbor Lists
+ *-------------------------------------------------------------
+ * Internal and external particles are sorted into a grid of bins,
+ * each at least the neighbor distance wide, s.t. the neighbors of
+ * a particle can only be in its own bin or one of the adjacent bins.
+ *
+ * Along each axis, the bins cover the extent of this cell plus the
+ * neighbor distance on either side, where all of the external
+ * particles are found.  When that would cover the entire box, the
+ * bins instead span the box and wrap around the periodic bondary.
+ *
+ * Consecutive bins are grouped into blocks of internal particles,
+ * s.t. dense regions are split into more blocks.  When forces are
+ * evaluated with OpenMP, both neighbor list construction and force
+ * evaluation are scheduled as one task per block, letting idle
+ * threads take up the blocks of dense clusters.
+ */
 
-static inline void
-check_position_junctions(vec_t position, array_t *cells_near)
+/* square maximum absolute distance any single particle can move
+ * before neighbor lists are invalid.  This is tracked by
+ * CEX_nl_displace */
+static double r_delta_2_sqr;
+
+typedef struct {
+        int n; /* number of bins */
+        int periodic; /* bins wrap around the box */
+        double center, half_width; /* of this cell (meters) */
+        double origin, width; /* of the bins (meters) */
+} bin_axis_t;
+
+static bin_axis_t bin_axes[3];
+#define BIN_AXIS(axis) (&bin_axes[axis])
+
+/* linked list of the particles in each bin, terminated by -1 */
+static array_t *bin_heads=NULL;
+static array_t *bin_next=NULL;
+#define BIN_HEAD(bin) ARR_INDEX_AS(int, bin_heads, bin)
+#define BIN_NEXT(inx) ARR_INDEX_AS(int, bin_next, inx)
+
+/* indices of internal particles ordered by block, and the offset of
+ * the first particle of each block (plus a final offset) */
+#define BLOCK_SIZE 64
+static array_t *block_particles=NULL;
+static array_t *block_offsets=NULL;
+#define N_BLOCKS() ((int)ARR_LENGTH(block_offsets) - 1)
+#define BLOCK_START(block) ARR_INDEX_AS(int, block_offsets, block)
+#define BLOCK_END(block) ARR_INDEX_AS(int, block_offsets, (block)+1)
+#define LAST_BLOCK_OFFSET() BLOCK_START(N_BLOCKS())
+
+static void setup_bins(void);
+static void fill_bins(void);
+static void setup_blocks(void);
+static void find_block_neighbors(int block, array_t *internal, array_t *external);
+
+static void 
+rebuild_neighborlists(void)
 {
-        int counter;
-        surface_junction_t *sjp;
-        XARR_FOREACH(CEX_surface_junctions, sjp, counter) {
-                if (unlikely(check_surface_junction(sjp, position))) {
-                        add_uniq(cells_near, sjp->cell);
-                }
+        double r_delta_2 = (CEX_r_neighbor - CEX_r_pair_cutoff) / 2;
+        r_delta_2_sqr = r_delta_2 * r_delta_2;
+        assert(ARR_LENGTH(CEX_nl_displace) == CEX_N_internal_particles);
+        CEX_zero_array_elements(CEX_nl_displace);
+        setup_bins();
+        fill_bins();
+        setup_blocks();
+        clear_array(CEX_internal_neighbors);
+        clear_array(CEX_external_neighbors);
+#ifdef OMP_PARALLELIZE_FORCES
+        static array_t *block_internal=NULL, *block_external=NULL;
+        int n_blocks = N_BLOCKS();
+        if (block_internal==NULL) {
+                block_internal = CEX_make_array(sizeof(array_t *), 0);
+                block_external = CEX_make_array(sizeof(array_t *), 0);
         }
-        line_junction_t *ljp;
-        XARR_FOREACH(CEX_line_junctions, ljp, counter) {
-                if (unlikely(check_line_junction(ljp, position))) {
-                        add_uniq(cells_near, ljp->cell);
-                }
+        while (ARR_LENGTH(block_internal) < n_blocks) {
+                ARR_APPEND(array_t *, block_internal, CEX_make_int_array(0));
+                ARR_APPEND(array_t *, block_external, CEX_make_int_array(0));
         }
-        point_junction_t *pjp;
-        XARR_FOREACH(CEX_point_junctions, pjp, counter) {
-                if (unlikely(check_point_junction(pjp, position))) {
-                        add_uniq(cells_near, pjp->cell);
+#pragma omp parallel
+#pragma omp single
+        for (int block=0; block<n_blocks; block++) {
+#pragma omp task firstprivate(block)
+                {
+                        array_t *internal = ARR_INDEX_AS(array_t *, block_internal, block);
+                        array_t *external = ARR_INDEX_AS(array_t *, block_external, block);
+                        clear_array(internal);
+                        clear_array(external);
+                        find_block_neighbors(block, internal, external);
                 }
         }
+        for (int block=0; block<n_blocks; block++) {
+                CEX_extend_array(CEX_internal_neighbors,
+                                 ARR_INDEX_AS(array_t *, block_internal, block));
+                CEX_extend_array(CEX_external_neighbors,
+                                 ARR_INDEX_AS(array_t *, block_external, block));
+        }
+#else
+        for (int block=0; block<N_BLOCKS(); block++) {
+                find_block_neighbors(block, CEX_internal_neighbors, CEX_external_neighbors);
+        }
+#endif
 }
 
-static inline void
-add_uniq(array_t *cells_near, cell_t* cell)
+static void
+setup_bin_axis(bin_axis_t *ba, double min, double max, double box)
 {
-        cell_t **cellp; int cell_counter;
-        XARR_FOREACH(cells_near, cellp, cell_counter) {
-                if (unlikely(*cellp == cell)) {
-                        return;
-                }
+        ba->half_width = (max - min) / 2;
+        ba->center = min + ba->half_width;
+        double span = max - min + 2 * CEX_r_neighbor;
+        ba->periodic = span >= box;
+        if (ba->periodic) {
+                span = box;
+                ba->origin = 0;
+        } else {
+                ba->origin = min - CEX_r_neighbor;
         }
-        ARR_APPEND(cell_t *, cells_near, cell);
+        ba->n = (int)(span / CEX_r_neighbor);
+        ba->n = ba->n < 1 ? 1 : ba->n;
+        ba->width = span / ba->n;
 }
 
-static inline int 
-check_surface_junction(surface_junction_t *sjp, vec_t pos)
+static void
+setup_bins(void)
 {
-        vec_t extent, r;
-        extent = sjp->dir==-1 ? CEX_this_cell->min_extent : CEX_this_cell->max_extent;
-        PERIODIC_SEPARATION_VECTOR(r, extent, pos);
-        return fabs(INDEX_AXIS(&r, sjp->axis)) <= CEX_r_neighbor;
+        int n_bins = 1;
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                setup_bin_axis(BIN_AXIS(axis),
+                               INDEX_AXIS(&CEX_this_cell->min_extent, axis),
+                               INDEX_AXIS(&CEX_this_cell->max_extent, axis),
+                               INDEX_AXIS(&CEX_box_size, axis));
+                n_bins *= BIN_AXIS(axis)->n;
+        }
+        if (bin_heads==NULL) {
+                bin_heads = CEX_make_int_array(n_bins);
+                bin_next = CEX_make_int_array(0);
+                block_particles = CEX_make_int_array(0);
+                block_offsets = CEX_make_int_array(0);
+        }
+        CEX_prealloc_array(bin_heads, n_bins);
+        ARR_LENGTH(bin_heads) = n_bins;
+        for (int bin=0; bin<n_bins; bin++) {
+                BIN_HEAD(bin) = -1;
+        }
 }
 
-static inline int 
-check_line_junction(line_junction_t *lnp, vec_t pos)
+static inline int
+bin_axis_index(const bin_axis_t *ba, double x, double box)
 {
-        vec_t point, r;
-
-        INDEX_AXIS(&pos, lnp->axis) = 0;
-        switch (lnp->axis) {
-        case AXIS_X: 
-                Vec3_SET(point, 0, lnp->offset1, lnp->offset2);
-                break;
-        case AXIS_Y:
-                Vec3_SET(point, lnp->offset1, 0, lnp->offset2);
-                break;
-        case AXIS_Z:
-                Vec3_SET(point, lnp->offset1, lnp->offset2, 0);
-                break;
-        default:
-                Fatal("bad axis %c", lnp->axis);
+        double u;
+        if (ba->periodic) {
+                u = x;
+        } else {
+                /* offset from the cell's center by the nearest image */
+                double d = x - ba->center;
+                XPERIODIZE_SEPARATION(d, box, box/2);
+                u = d + ba->center - ba->origin;
         }
-        PERIODIC_SEPARATION_VECTOR(r, point, pos);
-        return Vec3_SQR(r) <= CEX_r_neighbor_sqr;
+        int inx = (int)floor(u / ba->width);
+        return inx < 0 ? 0 : (inx >= ba->n ? ba->n - 1 : inx);
 }
 
-static inline int 
-check_point_junction(point_junction_t *pnp, vec_t position)
+static inline int
+bin_index(vec_t position, int *inxs)
 {
-        vec_t r;
-
-        PERIODIC_SEPARATION_VECTOR(r, pnp->offset, position);
-        return Vec3_SQR(r) <= CEX_r_neighbor_sqr;
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                inxs[axis] = bin_axis_index(BIN_AXIS(axis), INDEX_AXIS(&position, axis),
+                                            INDEX_AXIS(&CEX_box_size, axis));
+        }
+        return ((inxs[AXIS_X] * BIN_AXIS(AXIS_Y)->n) + inxs[AXIS_Y]) *
+                BIN_AXIS(AXIS_Z)->n + inxs[AXIS_Z];
 }
 
-
-/* Build Neighbor Lists
- *-------------------------------------------------------------
- * Since each cell should only have one the order of 100s of 
- * particles, we naively iterate through every pair of particles
- * and record those that are within the neighbor distance.
- */
-
-/* square maximum absolute distance any single particle can move
- * before neighbor lists are invalid.  This is tracked by
- * CEX_nl_displace */
-static double r_delta_2_sqr;
-
-static void rebuild_internal_neighborlists(void);
-/* this function is called twice on each neighbor rebuilding cycle.
- * first with all possible external positions, and then
- * again after we've removed the external positions that aren't need  */
-static void rebuild_external_neighborlists(void);
-
-static void 
-rebuild_neighborlists(void)
+static void
+fill_bins(void)
 {
-        double r_delta_2 = (CEX_r_neighbor - CEX_r_pair_cutoff) / 2;
-        r_delta_2_sqr = r_delta_2 * r_delta_2;
-        assert(ARR_LENGTH(CEX_nl_displace) == CEX_N_internal_particles);
-        CEX_zero_array_elements(CEX_nl_displace);
-        rebuild_internal_neighborlists();
-        rebuild_external_neighborlists();
+        int inxs[3];
+        int N_positions = ARR_LENGTH(CEX_positions);
+        CEX_prealloc_array(bin_next, N_positions);
+        ARR_LENGTH(bin_next) = N_positions;
+        /* insert in reverse, s.t. each bin lists particles in order */
+        for (int i=N_positions-1; i>=0; i--) {
+                int bin = bin_index(ARR_INDEX_AS(vec_t, CEX_positions, i), inxs);
+                BIN_NEXT(i) = BIN_HEAD(bin);
+                BIN_HEAD(bin) = i;
+        }
 }
 
 static void
-rebuild_internal_neighborlists(void)
+setup_blocks(void)
 {
-        clear_array(CEX_internal_neighbors);
-        vec_t * CEX_RESTRICT positions = ARR_DATA_AS(vec_t, CEX_positions);
-        for (int i=CEX_N_internal_particles - 1; i>=0; i--) {
-                vec_t pos_i = positions[i];
-                for (int j=i-1; j>=0; j--) {
-                        vec_t r, pos_j = positions[j];
-                        PERIODIC_SEPARATION_VECTOR(r, pos_i, pos_j);
-                        if (Vec3_SQR(r) <= CEX_r_neighbor_sqr) {
-                                IARR_APPEND(CEX_internal_neighbors, i);
-                                IARR_APPEND(CEX_internal_neighbors, j);
+        clear_array(block_particles);
+        clear_array(block_offsets);
+        IARR_APPEND(block_offsets, 0);
+        int n_bins = ARR_LENGTH(bin_heads);
+        for (int bin=0; bin<n_bins; bin++) {
+                for (int i=BIN_HEAD(bin); i!=-1; i=BIN_NEXT(i)) {
+                        if (i < CEX_N_internal_particles) {
+                                IARR_APPEND(block_particles, i);
+                        }
+                }
+                int length = ARR_LENGTH(block_particles);
+                if (length - LAST_BLOCK_OFFSET() >= BLOCK_SIZE) {
+                        IARR_APPEND(block_offsets, length);
+                }
+        }
+        if (ARR_LENGTH(block_particles) != LAST_BLOCK_OFFSET()) {
+                IARR_APPEND(block_offsets, ARR_LENGTH(block_particles));
+        }
+        assert(ARR_LENGTH(block_particles) == CEX_N_internal_particles);
+}
+
+/* indices of the bins adjacent to inx along an axis, without repeats */
+static inline int
+adjacent_bins(const bin_axis_t *ba, int inx, int *adjacent)
+{
+        int n_adjacent = 0;
+        if (ba->periodic && ba->n <= 3) {
+                for (int i=0; i<ba->n; i++) {
+                        adjacent[n_adjacent++] = i;
+                }
+        } else {
+                for (int i=inx-1; i<=inx+1; i++) {
+                        if (ba->periodic) {
+                                adjacent[n_adjacent++] = (i + ba->n) % ba->n;
+                        } else if (i >= 0 && i < ba->n) {
+                                adjacent[n_adjacent++] = i;
                         }
                 }
         }
+        return n_adjacent;
 }
 
+/* record the neighbors of the particles of a block.  internal pairs are
+ * recorded once, by the particle with the larger index */
 static void
-rebuild_external_neighborlists(void)
+find_block_neighbors(int block, array_t *internal, array_t *external)
 {
-        clear_array(CEX_external_neighbors);
         vec_t * CEX_RESTRICT positions = ARR_DATA_AS(vec_t, CEX_positions);
-        /* i: loop over external particles
-         * j: loop over interanl particles */
-        for (int i=ARR_LENGTH(CEX_positions) - 1; i>=CEX_N_internal_particles; i--) {
+        int inxs[3], adjacent[3][3], n_adjacent[3];
+
+        for (int b_inx=BLOCK_START(block); b_inx<BLOCK_END(block); b_inx++) {
+                int i = ARR_INDEX_AS(int, block_particles, b_inx);
                 vec_t pos_i = positions[i];
-                for (int j=CEX_N_internal_particles-1; j>=0; j--) {
-                        vec_t r, pos_j = positions[j];
-                        PERIODIC_SEPARATION_VECTOR(r, pos_i, pos_j);
-                        if (Vec3_SQR(r) <= CEX_r_neighbor_sqr) {
-                                /* add internal first */
-                                IARR_APPEND(CEX_external_neighbors, j);
-                                IARR_APPEND(CEX_external_neighbors, i);
+                bin_index(pos_i, inxs);
+                for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                        n_adjacent[axis] = adjacent_bins(BIN_AXIS(axis), inxs[axis],
+                                                         adjacent[axis]);
+                }
+                for (int ax=0; ax<n_adjacent[AXIS_X]; ax++)
+                for (int ay=0; ay<n_adjacent[AXIS_Y]; ay++)
+                for (int az=0; az<n_adjacent[AXIS_Z]; az++) {
+                        int bin = ((adjacent[AXIS_X][ax] * BIN_AXIS(AXIS_Y)->n) +
+                                   adjacent[AXIS_Y][ay]) * BIN_AXIS(AXIS_Z)->n +
+                                   adjacent[AXIS_Z][az];
+                        for (int j=BIN_HEAD(bin); j!=-1; j=BIN_NEXT(j)) {
+                                if (j < CEX_N_internal_particles && j >= i) {
+                                        continue;
+                                }
+                                vec_t r;
+                                PERIODIC_SEPARATION_VECTOR(r, pos_i, positions[j]);
+                                if (Vec3_SQR(r) <= CEX_r_neighbor_sqr) {
+                                        array_t *nl = j < CEX_N_internal_particles ? 
+                                                internal : external;
+                                        /* larger internal index, or internal first */
+                                        IARR_APPEND(nl, i);
+                                        IARR_APPEND(nl, j);
+                                }
                         }
                 }
         }
@@ -595,109 +822,258 @@ sort_neighbor_list(array_t *nl)
 }
 
 
-/* Remove Un-needed External Particles
- *-------------------------------------------------------------
- * to remove external particles from those that we will recieve; 
- * we record the index in the CEX_send_indices that we no longer
- * wish to recieve */
+/* Updating External Positions
+ *----------------------------------------------------------------
+ * Update external positions for every force evaluation.  Positions 
+ * are gathered into send buffers as halo_position_t, which are 
+ * optionally compressed. */
 
-static inline void clear_remove_indices(void);
-static void find_remove_indices(void);
-static void exchange_removes_indices(void);
+array_t *CEX_send_positions_buffers;
 
-static void 
-remove_unneeded_external_particles(void)
-{
-        clear_remove_indices();
-        find_remove_indices();
-        exchange_removes_indices();
-        /* remove all external particles and repeat end of 
-         * determine_possible_neighbors after the indices
-         * of external particles we don't need are removed
-         * from CEX_send_indices */
-        ARR_LENGTH(CEX_positions) = CEX_N_internal_particles;
-        exchange_send_lengths();
-        /* allocate shouldn't be necessary */
-        exchange_external_positions();
-        /* rebuild external neighbor lists using new indices
-         * of external particles */
-        rebuild_external_neighborlists();
-        clear_remove_indices();
+#define GET_SEND_POSITION_BUFFER(comm)                                  \
+        GET_COMM_DATA(array_t *,  CEX_send_positions_buffers,  comm)
+
+#ifdef COMPRESSED_HALO_POSITIONS
+/* Compressed External Positions
+ * Each position is sent as three 32-bit fixed-point integers, giving 
+ * the periodic separation vector from min_extent of the sending cell
+ * in units of CEX_box_size / 2^32.  The reciever adds this to its own
+ * copy of the min_extent of the sending cell.  This halves the number
+ * of bytes exchanged for every force evaluation, while each decoded
+ * component is within half of a quantum of the true position (e.g.
+ * 2e-6 / 2^32 / 2 = 2.3e-16 m in a 2 um box).
+ * Positions exchanged while rebuilding neighbor lists are always sent
+ * at full precision. 
+ */
+static vec_t halo_quantum, halo_inv_quantum;
+/* min_extent of the cell for each communicator */
+static array_t *halo_origins=NULL;
+
+#define GET_HALO_ORIGIN(comm) GET_COMM_DATA(vec_t, halo_origins, comm)
+
+static void
+setup_halo_compression(void)
+{
+        cell_t *jcellp;
+        int counter;
+
+        if (halo_origins==NULL) {
+                double scale = ldexp(1.0, 32);
+                Vec3_SET(halo_quantum, CEX_box_size.x / scale,
+                         CEX_box_size.y / scale, CEX_box_size.z / scale);
+                Vec3_SET(halo_inv_quantum, 1.0 / halo_quantum.x, 
+                         1.0 / halo_quantum.y, 1.0 / halo_quantum.z);
+                halo_origins = CEX_make_vec_array(ARR_LENGTH(CEX_comms));
+                ARR_LENGTH(halo_origins) = ARR_LENGTH(CEX_comms);
+                xprintf("compressed external positions accurate to "
+                        Vec3_FRMT("%.2e") " (nm) per component",
+                        Vec3_ARGS_SCALED((0.5/CEX_nm), halo_quantum));
+        }
+        /* extents may change between rebuilding neighbor lists */
+        JCELL_FOREACH(jcellp, counter) {
+                GET_HALO_ORIGIN(jcellp->comm) = jcellp->min_extent;
+        }
+}
+
+static inline int
+quantize_component(double x)
+{
+        long q = lrint(x);
+        /* separation of exactly half of box size */
+        return likely(q <= INT_MAX) ? (int)q : INT_MAX;
 }
 
-array_t *CEX_remove_indices=NULL;
-#define GET_REMOVE_INDICES(comm) GET_COMM_DATA(array_t *,  CEX_remove_indices,  comm)
+static inline halo_position_t
+encode_halo_position(vec_t position)
+{
+        halo_position_t hp;
+        vec_t r;
+        PERIODIC_SEPARATION_VECTOR(r, CEX_this_cell->min_extent, position);
+        hp.x = quantize_component(r.x * halo_inv_quantum.x);
+        hp.y = quantize_component(r.y * halo_inv_quantum.y);
+        hp.z = quantize_component(r.z * halo_inv_quantum.z);
+        return hp;
+}
 
-static inline void
-clear_remove_indices(void)
+/* decode positions recieved from comm into CEX_positions */
+static void
+decode_external_positions(comm_t *comm, const halo_position_t *src)
 {
-        comm_t *comm; int counter;
-        
-        COMM_FOREACH(comm, counter) {
-                clear_array(GET_REMOVE_INDICES(comm));
+        vec_t origin = GET_HALO_ORIGIN(comm);
+        vec_t * CEX_RESTRICT dst = &ARR_INDEX_AS(vec_t, CEX_positions, 
+                                                 GET_EXT_POSITIONS_OFFSET(comm));
+        for (int i=GET_RECV_LENGTH(comm)-1; i>=0; i--) {
+                vec_t position;
+                Vec3_SET(position, 
+                         origin.x + src[i].x * halo_quantum.x,
+                         origin.y + src[i].y * halo_quantum.y,
+                         origin.z + src[i].z * halo_quantum.z);
+                PERIODIZE_LOCATION(position);
+                dst[i] = position;
         }
 }
 
+# define ENCODE_HALO_POSITION(position) encode_halo_position(position)
+#else
+# define ENCODE_HALO_POSITION(position) (position)
+#endif /* COMPRESSED_HALO_POSITIONS */
+
+#ifdef MPI_NEIGHBOR_COLLECTIVES
+/* all send buffers are stored contiguously in a single block, s.t.
+ * each update is a single collective */
+static comm_layout_t external_layout;
+static array_t *send_external_block=NULL;
+#ifdef COMPRESSED_HALO_POSITIONS
+static array_t *recv_external_block=NULL;
+#endif
+
 static void 
-find_remove_indices(void)
-{
-        array_t *uses;
-        int n_external;
-        int *enp, counter;
-
-        /* record number of uses of particles by their
-         * index in CEX_positions */
-        n_external = ARR_LENGTH(CEX_positions) - CEX_N_internal_particles;
-        uses = CEX_make_int_array(n_external);
-        ARR_LENGTH(uses) = n_external;
-        CEX_zero_array_elements(uses);
-         /* internal index in CEX_external_neighbors is first, skip it using slice */
-        XARR_FOREACH_SLICE(CEX_external_neighbors, 
-                           1, ARR_LENGTH(CEX_external_neighbors), 2,
-                           enp, counter) {
-                int external_index = *enp - CEX_N_internal_particles;
-                ARR_INDEX_AS(int, uses, external_index) ++;
-        }
-        /* for every external particle we recieve, check its uses.
-         * if its not used, record its send indices in remove_indices */
+allocate_external_exchange_buffers(void)
+{
+        int counter;
         comm_t *comm;
+
+        if (send_external_block==NULL) {
+                CEX_init_comm_layout(&external_layout);
+                send_external_block = CEX_make_array(sizeof(halo_position_t), 0);
+#ifdef COMPRESSED_HALO_POSITIONS
+                recv_external_block = CEX_make_array(sizeof(halo_position_t), 0);
+#endif
+        }
         COMM_FOREACH(comm, counter) {
-                int external_offset = GET_EXT_POSITIONS_OFFSET(comm) - CEX_N_internal_particles;
-                int n_send_indices = GET_RECV_LENGTH(comm);
-                array_t *remove_indices = GET_REMOVE_INDICES(comm);
-                for (int send_index=0; send_index<n_send_indices; send_index++) {
-                        int external_index = external_offset + send_index;
-                        assert(external_index < n_external);
-                        int n_uses = ARR_INDEX_AS(int, uses, external_index);
-                        if (unlikely(n_uses==0)) {
-                                IARR_APPEND(remove_indices, send_index);
-                        }
-                }
+                LAYOUT_SEND_COUNT(&external_layout, comm) = 
+                        ARR_LENGTH(GET_SEND_INDICES(comm)) * sizeof(halo_position_t);
+                LAYOUT_RECV_COUNT(&external_layout, comm) = 
+                        GET_RECV_LENGTH(comm) * sizeof(halo_position_t);
         }
-        CEX_free_array(uses);
+        int n_send = CEX_layout_send_displs(&external_layout) / sizeof(halo_position_t);
+        CEX_prealloc_array(send_external_block, n_send);
+        ARR_LENGTH(send_external_block) = n_send;
+#ifdef COMPRESSED_HALO_POSITIONS
+        int n_recv = CEX_layout_recv_displs(&external_layout) / sizeof(halo_position_t);
+        CEX_prealloc_array(recv_external_block, n_recv);
+        ARR_LENGTH(recv_external_block) = n_recv;
+        setup_halo_compression();
+#else
+        /* recieved directly following the internal positions */
+        CEX_layout_recv_displs(&external_layout);
+#endif
 }
 
-static void 
-exchange_removes_indices(void)
+static void
+update_external_positions(void)
 {
-        array_t *remove_indices = CEX_make_int_array(10);
-        DO_COMM(comm,
-        /* send */  comm_send_ints(comm, GET_REMOVE_INDICES(comm)),
-        /* recv */({clear_array(remove_indices);
-                    comm_recv_ints(comm, remove_indices);
-                    CEX_remove_array_of_indices(GET_SEND_INDICES(comm), remove_indices);}));
-        CEX_free_array(remove_indices);
+        /* copy to contiguous send block */ {
+        int counter;
+        comm_t *comm;
+        vec_t * CEX_RESTRICT _positions = ARR_DATA_AS(vec_t, CEX_positions);
+        char *_block = ARR_DATA_AS(char, send_external_block);
+        COMM_FOREACH(comm, counter) {
+                array_t * send_indices = GET_SEND_INDICES(comm);
+                halo_position_t * CEX_RESTRICT _dst = (halo_position_t *)
+                        (_block + LAYOUT_SEND_DISPL(&external_layout, comm));
+                for (int i=ARR_LENGTH(send_indices)-1; i>=0; i--) {
+                        _dst[i] = ENCODE_HALO_POSITION(
+                                _positions[ARR_INDEX_AS(int, send_indices, i)]);
+                }
+        }}
+#ifdef COMPRESSED_HALO_POSITIONS
+        CEX_neighbor_exchange(&external_layout, ARR_DATA(send_external_block),
+                              ARR_DATA(recv_external_block));
+        /* decode */ {
+        int counter;
+        comm_t *comm;
+        COMM_FOREACH(comm, counter) {
+                decode_external_positions(comm, (halo_position_t *)
+                        (ARR_DATA_AS(char, recv_external_block) + 
+                         LAYOUT_RECV_DISPL(&external_layout, comm)));
+        }}
+#else
+        CEX_neighbor_exchange(&external_layout, ARR_DATA(send_external_block),
+                              ARR_ADDRESS_ELEMENT(CEX_positions, 
+                                                  CEX_N_internal_particles));
+#endif
 }
+#else
+#ifdef COMPRESSED_HALO_POSITIONS
+/* reused to recieve compressed positions from a single communicator */
+static array_t *recv_external_buffer=NULL;
+#endif
 
+#ifdef MPI_SHARED_MEMORY_HALOS
+/* Shared Memory External Positions
+ * Positions sent to communicators on this node are published in the
+ * shared memory segment of this thread, from which the recieving
+ * thread copies them directly into its external positions.  Each 
+ * segment is split into two blocks that are used on alternating
+ * updates, s.t. a single synchronization per update suffices, as a
+ * block is only rewritten after all threads on this node passed the 
+ * following synchronization and have thereby finished reading it.  The
+ * offsets of the positions for each communicator within these blocks
+ * are exchanged on rebuilding neighbor lists.  Positions sent to other
+ * nodes are still exchanged with pair-wise communication.
+ */
+static array_t *shared_send_offsets=NULL;
+static array_t *shared_recv_offsets=NULL;
+static int shared_parity=0;
 
-/* Updating External Positions
- *----------------------------------------------------------------
- * Update external positions for every force evaluation */
+#define GET_SHARED_SEND_OFFSET(comm) GET_COMM_DATA(int, shared_send_offsets, comm)
+#define GET_SHARED_RECV_OFFSET(comm) GET_COMM_DATA(int, shared_recv_offsets, comm)
+#define MESSAGE_EXTERNAL_POSITIONS(comm) (!COMM_IS_LOCAL(comm))
 
-array_t *CEX_send_positions_buffers;
+/* block of the segment of a thread on this node used for this update */
+static vec_t *
+shared_block(int node_rank)
+{
+        size_t bytes;
+        vec_t *segment = CEX_shared_segment(node_rank, &bytes);
+        return segment + shared_parity * (bytes / 2 / sizeof(vec_t));
+}
 
-#define GET_SEND_POSITION_BUFFER(comm)                                  \
-        GET_COMM_DATA(array_t *,  CEX_send_positions_buffers,  comm)
+static void
+setup_shared_external_positions(void)
+{
+        int counter, n_local=0;
+        comm_t *comm;
+
+        if (shared_send_offsets==NULL) {
+                shared_send_offsets = CEX_make_int_array(ARR_LENGTH(CEX_comms));
+                shared_recv_offsets = CEX_make_int_array(ARR_LENGTH(CEX_comms));
+                ARR_LENGTH(shared_send_offsets) = ARR_LENGTH(CEX_comms);
+                ARR_LENGTH(shared_recv_offsets) = ARR_LENGTH(CEX_comms);
+        }
+        COMM_FOREACH(comm, counter) {
+                GET_SHARED_SEND_OFFSET(comm) = n_local;
+                if (COMM_IS_LOCAL(comm)) {
+                        n_local += ARR_LENGTH(GET_SEND_INDICES(comm));
+                }
+        }
+        CEX_reserve_shared_segment(2 * n_local * sizeof(vec_t));
+        DO_COMM(comm, 
+        /* send */ comm_send_int(comm, GET_SHARED_SEND_OFFSET(comm)),
+        /* recv */ GET_SHARED_RECV_OFFSET(comm) = comm_recv_int(comm));
+}
+
+static void
+copy_shared_external_positions(void)
+{
+        int counter;
+        comm_t *comm;
+
+        CEX_sync_shared_segments();
+        COMM_FOREACH(comm, counter) {
+                if (COMM_IS_LOCAL(comm)) {
+                        XMEMCPY(vec_t, ARR_ADDRESS_ELEMENT(CEX_positions,
+                                                           GET_EXT_POSITIONS_OFFSET(comm)),
+                                shared_block(comm->node_rank) + GET_SHARED_RECV_OFFSET(comm),
+                                GET_RECV_LENGTH(comm));
+                }
+        }
+        shared_parity ^= 1;
+}
+#else
+# define MESSAGE_EXTERNAL_POSITIONS(comm) 1
+#endif /* MPI_SHARED_MEMORY_HALOS */
 
 static void 
 allocate_external_exchange_buffers(void)
@@ -710,6 +1086,15 @@ allocate_external_exchange_buffers(void)
                 CEX_prealloc_array(send_buffer, length);
                 ARR_LENGTH(send_buffer) = length;
         }
+#ifdef COMPRESSED_HALO_POSITIONS
+        if (recv_external_buffer==NULL) {
+                recv_external_buffer = CEX_make_array(sizeof(halo_position_t), 0);
+        }
+        setup_halo_compression();
+#endif
+#ifdef MPI_SHARED_MEMORY_HALOS
+        setup_shared_external_positions();
+#endif
 }
 
 /* this function is the main bottleneck in parallel applications
@@ -723,22 +1108,100 @@ update_external_positions(void)
         int counter;
         comm_t *comm;
         vec_t * CEX_RESTRICT _positions = ARR_DATA_AS(vec_t, CEX_positions);
+#ifdef MPI_SHARED_MEMORY_HALOS
+        vec_t * CEX_RESTRICT _block = shared_block(CEX_node_rank);
+#endif
         COMM_FOREACH(comm, counter) {
-                array_t * send_buffer = GET_SEND_POSITION_BUFFER(comm);
                 array_t * send_indices = GET_SEND_INDICES(comm);
+#ifdef MPI_SHARED_MEMORY_HALOS
+                if (COMM_IS_LOCAL(comm)) {
+                        vec_t * CEX_RESTRICT _dst = _block + GET_SHARED_SEND_OFFSET(comm);
+                        for (int i=ARR_LENGTH(send_indices)-1; i>=0; i--) {
+                                _dst[i] = _positions[ARR_INDEX_AS(int, send_indices, i)];
+                        }
+                        continue;
+                }
+#endif
+                array_t * send_buffer = GET_SEND_POSITION_BUFFER(comm);
                 for (int i=ARR_LENGTH(send_indices)-1; i>=0; i--) {
-                        ARR_INDEX_AS(vec_t, send_buffer, i) =
-                                _positions[ARR_INDEX_AS(int, send_indices, i)];
+                        ARR_INDEX_AS(halo_position_t, send_buffer, i) =
+                                ENCODE_HALO_POSITION(
+                                        _positions[ARR_INDEX_AS(int, send_indices, i)]);
                 }
         }}
+#ifdef MPI_SHARED_MEMORY_HALOS
+        copy_shared_external_positions();
+        if (!CEX_have_remote_comms) {
+                return;
+        }
+#endif
         /* exchange */
+#ifdef COMPRESSED_HALO_POSITIONS
         DO_COMM(comm,
                 /* send */
-                comm_send_vecs(comm, GET_SEND_POSITION_BUFFER(comm)),
+                if (MESSAGE_EXTERNAL_POSITIONS(comm)) {
+                        comm_send_array(comm, GET_SEND_POSITION_BUFFER(comm));
+                },
                 /* recv */
-                comm_recv(comm, ARR_ADDRESS_ELEMENT(CEX_positions,
-                                                    GET_EXT_POSITIONS_OFFSET(comm)),
-                          3*GET_RECV_LENGTH(comm), MPI_DOUBLE));
+                if (MESSAGE_EXTERNAL_POSITIONS(comm)) {
+                        int length = GET_RECV_LENGTH(comm);
+                        CEX_prealloc_array(recv_external_buffer, length);
+                        comm_recv(comm, ARR_DATA(recv_external_buffer),
+                                  length * sizeof(halo_position_t), MPI_BYTE);
+                        decode_external_positions(comm, 
+                                ARR_DATA_AS(halo_position_t, recv_external_buffer));
+                });
+#else
+        DO_COMM(comm,
+                /* send */
+                if (MESSAGE_EXTERNAL_POSITIONS(comm)) {
+                        comm_send_vecs(comm, GET_SEND_POSITION_BUFFER(comm));
+                },
+                /* recv */
+                if (MESSAGE_EXTERNAL_POSITIONS(comm)) {
+                        comm_recv(comm, ARR_ADDRESS_ELEMENT(CEX_positions,
+                                                            GET_EXT_POSITIONS_OFFSET(comm)),
+                                  3*GET_RECV_LENGTH(comm), MPI_DOUBLE);
+                });
+#endif
+}
+#endif /* MPI_NEIGHBOR_COLLECTIVES */
+
+void
+CEX_thread_update_external_positions(void)
+{
+        REQ_INIT();
+        if (!neighbor_lists_built) {
+                Fatal("cannot procede; require neighbor lists");
+        }
+        if (HAVE_JUNCTIONS()) {
+                update_external_positions();
+        }
+}
+
+/* sent through pair-wise communication regardless of how positions
+ * are exchanged, as this is only used for occasional analysis */
+static void
+send_tags_by_index(comm_t *comm, array_t *values, array_t *indices)
+{
+        array_t *continuous = CEX_splice_array_of_indices(values, indices);
+        comm_send(comm, ARR_DATA(continuous), ARR_LENGTH(continuous), TAG_MPI_TYPE);
+        CEX_free_array(continuous);
+}
+
+void
+CEX_exchange_external_tags(array_t *values)
+{
+        assert(ARR_EL_SIZE(values) == sizeof(tag_t));
+        assert(ARR_LENGTH(values) == CEX_N_internal_particles);
+        CEX_prealloc_array(values, ARR_LENGTH(CEX_positions));
+        ARR_LENGTH(values) = ARR_LENGTH(CEX_positions);
+        DO_COMM(comm,
+                /* send */
+                send_tags_by_index(comm, values, GET_SEND_INDICES(comm)),
+                /* recv */
+                comm_recv(comm, ARR_ADDRESS_ELEMENT(values, GET_EXT_POSITIONS_OFFSET(comm)),
+                          GET_RECV_LENGTH(comm), TAG_MPI_TYPE));
 }
 
 /* Force Evaluation
@@ -788,7 +1251,12 @@ update_external_positions(void)
 static void evaluate_forces(void) GCC_ATTRIBUTE((noinline));
 
 
-#ifdef OMP_PARALLELIZE_FORCES
+#ifdef OMP_THREAD_DOMAINS
+# if defined(OMP_CONCURRENT_FORCE_EVALUATION) || defined(OMP_PARALLELIZE_FORCES)
+#   error "thread domains are a separate parallelization of force evaluation"
+# endif
+# include "eval-forces-domains.c"
+#elif defined(OMP_PARALLELIZE_FORCES)
 # ifdef OMP_CONCURRENT_FORCE_EVALUATION
 #   error "can't perform concurrent force evaluation and position exchange"
 # endif
@@ -806,7 +1274,10 @@ update_forces(void)
         if (HAVE_JUNCTIONS()) {
                 update_external_positions();
         }
+        double start = MPI_Wtime();
         evaluate_forces();
+        CEX_balance_work += MPI_Wtime() - start;
+        CEX_advance_rdf();
 }
 #else
 /* when we have multiple threads and we also have junctions,
@@ -817,6 +1288,7 @@ update_forces(void)
 static inline void 
 update_forces(void)
 {
+        double start;
 
         if (!HAVE_JUNCTIONS()) {
                 evaluate_forces();
@@ -828,15 +1300,20 @@ update_forces(void)
                                 update_external_positions();
                                 break;
                         case 1:
+                                start = MPI_Wtime();
                                 evaluate_internal_forces();
                                 update_random();
+                                CEX_balance_work += MPI_Wtime() - start;
                                 break;
                         default:
                                 break;
                         }
                 } /* end parallel */
+                start = MPI_Wtime();
                 evaluate_external_forces();
+                CEX_balance_work += MPI_Wtime() - start;
         }
+        CEX_advance_rdf();
 }
 #endif /*OMP_CONCURRENT_FORCE_EVALUATION*/
 
@@ -971,7 +1448,8 @@ integrate_cycle(void)
         vec_t * CEX_RESTRICT _forces = ARR_DATA_AS(vec_t, CEX_forces);
         vec_t * CEX_RESTRICT _nl_displace = ARR_DATA_AS(vec_t, CEX_nl_displace);
         vec_t * CEX_RESTRICT _rnd_force = ARR_DATA_AS(vec_t, CEX_random_vectors);
-        vec_t _box_size = CEX_box_size;
+        image_t * CEX_RESTRICT _images = ARR_DATA_AS(image_t, CEX_images);
+        vec_t _box_size = CEX_box_size, _box_half = CEX_box_half;
         subcycle_parameters sp0 = gen_subcycle_parameters(1);
         int displace_beyond_nl = 0;
         double _dU_max = CEX_dU_max;
@@ -980,7 +1458,7 @@ integrate_cycle(void)
 
 #ifdef USE_OMP_INTEGRATE
 #  pragma omp parallel for schedule(static) firstprivate(_positions, _new_positions, _forces, _nl_displace, _rnd_force, \
-                                                        _box_size, sp0, displace_beyond_nl, _dU_max)
+                                                        _images, _box_size, _box_half, sp0, displace_beyond_nl, _dU_max)
 #endif
         for (int i_particle=CEX_N_internal_particles-1; i_particle>=0; i_particle--) {
                 // dx = dt/gamma * F(x,t) + sqrt(2kT*dt/gamma)*R_gauss
@@ -1014,6 +1492,14 @@ integrate_cycle(void)
                 Vec3_ADDTO(nl_displace, delta);
                 _nl_displace[i_particle] = nl_displace;
                 displace_beyond_nl |= Vec3_SQR(nl_displace) > r_delta_2_sqr;
+                /* a particle crosses at most one boundary along each axis,
+                 * s.t. the wrapped distance is either 0 or a box length */
+                vec_t wrapped;
+                Vec3_ADD(wrapped, _positions[i_particle], delta);
+                Vec3_SUBTO(wrapped, _new_positions[i_particle]);
+                _images[i_particle].x += (wrapped.x > _box_half.x) - (wrapped.x < -_box_half.x);
+                _images[i_particle].y += (wrapped.y > _box_half.y) - (wrapped.y < -_box_half.y);
+                _images[i_particle].z += (wrapped.z > _box_half.z) - (wrapped.z < -_box_half.z);
         }
         XMEMCPY(vec_t, _positions, _new_positions, CEX_N_internal_particles);
         random_numbers_fresh = 0;
@@ -1195,6 +1681,8 @@ do_integrate_subcycle(subcycle_parameters sp, int i_particle,
 #define CMD_UPDATE_NEIGHBORS 1
 #define CMD_UPDATE_FORCES 2
 #define CMD_INTEGRATE_ONE 3
+#define CMD_WRITE_FRAME 4
+#define CMD_POLL_NEIGHBORS 5
 #define CMD_EXIT_LOOP 255
 
 void
@@ -1217,6 +1705,14 @@ CEX_slave_simulation_loop(void)
                         break;
                 case CMD_INTEGRATE_ONE:
                         ret = integrate_cycle();
+                        CEX_advance_msd();
+                        break;
+                case CMD_WRITE_FRAME:
+                        CEX_write_trajectory_frame();
+                        ret = 0;
+                        break;
+                case CMD_POLL_NEIGHBORS:
+                        ret = !neighbor_lists_current;
                         break;
                 case CMD_EXIT_LOOP:
                         exit_loop = 1;
@@ -1257,6 +1753,16 @@ update_neighbors_everywhere(void)
         poll_slaves();
 }
 
+/* whether the neighbor lists of any thread must be rebuilt before
+ * continuing simulation */
+static inline int
+neighbor_lists_stale_anywhere(void)
+{
+        tell_slaves(CMD_POLL_NEIGHBORS);
+        int stale = !neighbor_lists_current;
+        return stale | poll_slaves();
+}
+
 static inline void 
 update_forces_everywhere(void)
 {
@@ -1272,9 +1778,18 @@ integrate_every_where(void)
 
         tell_slaves(CMD_INTEGRATE_ONE);
         displace_beyond_nl = integrate_cycle();
+        CEX_advance_msd();
         return displace_beyond_nl | poll_slaves();
 }
 
+static inline void
+write_frame_everywhere(void)
+{
+        tell_slaves(CMD_WRITE_FRAME);
+        CEX_write_trajectory_frame();
+        poll_slaves();
+}
+
 static inline void
 exit_loop_everywhere(void)
 {
@@ -1293,7 +1808,9 @@ CEX_master_simulate_cycles(int cycles)
         if (cycles<0) {
                 Fatal("bad number of cycles %d", cycles);
         }
-        update_neighbors_everywhere();
+        if (neighbor_lists_stale_anywhere()) {
+                update_neighbors_everywhere();
+        }
         while (likely(cycles)) {
                 update_forces_everywhere();
                 integrate_cycles = CEX_force_update_rate;
@@ -1303,6 +1820,9 @@ CEX_master_simulate_cycles(int cycles)
                         }
                         displace_beyond_nl = integrate_every_where();
                         cycles --;
+                        if (CEX_advance_trajectory()) {
+                                write_frame_everywhere();
+                        }
                         if (displace_beyond_nl) {
                                 integrate_cycles = 0;
                                 update_neighbors_everywhere();
@@ -21,6 +21,8 @@
 #ifndef _BD_H
 #define _BD_H
 
+#include <stdint.h>
+
 #include "array.h"
 #include "msg.h"
 
@@ -78,6 +80,12 @@ extern array_t *CEX_new_positions;
 
 /* intenral (particle-wise data structures) */
 extern int CEX_N_internal_particles;
+/* particles are tagged with 64-bit integers, s.t. the size of a
+ * system isn't limited by the range of int.  counts and indices
+ * local to a single thread remain int */
+typedef int64_t tag_t;
+#define TAG_MPI_TYPE MPI_INT64_T
+#define CEX_MAX_TAG INT64_MAX
 extern array_t *CEX_tags; /* unique tags for tracing particle trajectories */
 extern array_t *CEX_forces;
 extern array_t *CEX_random_vectors;
@@ -87,6 +95,13 @@ extern array_t *CEX_random_vectors;
  * when the neighbor lists could potentially be invalid and 
  * need rebuilt*/
 extern array_t *CEX_nl_displace;
+/* periodic images crossed by each internal particle since the
+ * simulation was initialized, s.t. its unwrapped position is
+ * position + image * box_size */
+typedef struct {
+        int x, y, z;
+} image_t;
+extern array_t *CEX_images;
 /* neighbor list of important neighbor pairs for forces, 
  * stored as pairs of indices in CEX_positions s.t. that the
  * indices of the two particles in this i-th neighbor are
@@ -96,17 +111,44 @@ extern array_t *CEX_internal_neighbors;
  * second is that of the external particle */
 extern array_t *CEX_external_neighbors;
 
+/* complete state of a single particle as it migrates between cells.
+ * any particle-wise data that must follow a particle into its new
+ * cell belongs in here, s.t. migration remains a single message */
+typedef struct {
+        vec_t position;
+        tag_t tag;
+        image_t image;
+} migrant_t;
+
+/* representation of external positions sent for every force evaluation */
+#ifdef COMPRESSED_HALO_POSITIONS
+typedef struct {
+        int x, y, z;
+} halo_position_t;
+#else
+typedef vec_t halo_position_t;
+#endif
+
 /* auxillay data sturctures for each communicator */
 extern array_t *CEX_send_indices,
                *CEX_recv_lengths,
-               *CEX_tmp_recv_positions,
-               *CEX_tmp_recv_tags,
+               *CEX_tmp_recv_migrants,
                *CEX_ext_positions_offset,
-               *CEX_remove_indices,
                *CEX_send_positions_buffers;
 
 void CEX_thread_update_neighbors(void);
+/* force the neighbor lists to be rebuilt when simulation next
+ * continues, as after positions are changed other than by integration.
+ * called on every thread */
+void CEX_invalidate_neighbor_lists(void);
 void CEX_thread_update_forces(void);
+/* bring external positions up to date between simulation chunks, s.t.
+ * the neighbor lists can be used for analysis.  collective */
+void CEX_thread_update_external_positions(void);
+/* extend `values, holding a tag_t for each internal particle, with
+ * those of the external particles as held by their own threads, in the
+ * order of CEX_positions.  collective */
+void CEX_exchange_external_tags(array_t *values);
 void CEX_slave_simulation_loop(void);
 void CEX_master_simulate_cycles(int cycles);
 
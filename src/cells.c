@@ -21,7 +21,4 @@
 #include "cells.h"
 
 array_t *CEX_jcells=NULL;
-array_t *CEX_surface_junctions=NULL;
-array_t *CEX_line_junctions=NULL;
-array_t *CEX_point_junctions=NULL;
 cell_t *CEX_this_cell=NULL;
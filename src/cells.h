@@ -33,6 +33,13 @@ typedef struct {
 
 extern cell_t *CEX_this_cell; /* information explaining this cell */
 
+/* Junctioned Cells
+ * Cells need not form a regular grid.  Any cell within the neighbor
+ * distance of this cell (accounting for periodic bondary conditions)
+ * is junctioned, s.t. halo particles are selected by the distance of
+ * each particle to the extent of each junctioned cell, and particles
+ * leaving this cell are found in the junctioned cell containing them.
+ */
 extern array_t *CEX_jcells; /* array of junctioning cells */
 #define HAVE_JUNCTIONS() likely(ARR_LENGTH(CEX_jcells)!=0)
 
@@ -66,57 +73,6 @@ find_jcell_containing(vec_t position)
         return NULL;
 }
 
-/* Cell Junction Information
- * There are three ways that cells can touch each other
- *
- *    o Surface Junctions (6)
- *    o Line Junctions (12)
- *    o Point Junctions (8)
- *
- * This means each cell can have a max of 26 junctions, although with periodic bondary conditions
- * cells may be junctions along multiple modes
- *
- *                        -----\           
- *                              -----\     
- *                                    ---+ 
- *                               -----/  | 
- *                          ----/        | 
- *----\                ----/             | 
- *     ----\  |  -----/                  | 
- *          --+-/                        |                      /---
- *            |                          |                  /---    \---
- *            |    Point                 |              /---            \----
- *            |    Junction             |          /---                     \---
- *            |                          |      /---                             \---
- *            |                         o|o /---       Reference Cell                \-+--
- *            |                        --+--                                        /--|  \----
- *            |                    ---/ o|o \----                               /---   |       \----
- *            |               ----/      |       \----                      /---      /+            \----
-c *--\         |           ---/           |            \---              /---      /--- |                 \----
- *   ---\     |      ----/               |                \----     /---      /---     |                      \---
- *       ---\ |  ---/                    |                     \----       /--        /+                    /---|
- *           -+-/                        |                       |  \--/---       /--- |                 /--    |
- *                                       |                       | /---  \----/---    /+             /---       |
- *                                       |                       +-        /--\----/-- |          /--           |
- *                                       +--                     |     /---     /--\---+      /---              |
- *                                      ----\---                 | /---     /---     /-+--- +-                  |
- *                                  ---/---\----\----            +-      /--     /---     \-+--                 |
- *                              ---/       \---\---- \----       |    /--     /--           |  \-----           |
- *                          ---/               \--------  \---   | /--    /---              |        \----      |
- *                      ---/     Line Junction      \-------  \--+-    /--                  |             \---- |
- *                   +-/                                 \------ | /---                     |                  X+-
- *                   |\--                                    \---+--         Surface        |                /-
- *                   |   \---                               ---/ |  \---     Junction       |             /--
- *                   |       \--                         --/     |      \---                |           /-
- *                              \--                  ---/        |          \---            |        /--
- *                                 \--            --/                           \---        |      /-
- *                                    \---    ---/                                  \---    |   /--
- *                                        \--/                                          \-- | /-
- *                                          |                                               --
- *                                          |                     
- *                                          |                     
- */
-
 /* Xxx These are used to index elements of vec_t struct
  * have to correspond to write struct elements
  */
@@ -125,26 +81,4 @@ c *--\         |           ---/           |            \---              /---
 #define AXIS_Z 2
 #define INDEX_AXIS(vec_p, axis) (((double *)(vec_p))[axis])
 
-typedef struct {
-        cell_t *cell;
-        int axis; 
-        int dir;
-} surface_junction_t;
-
-typedef struct {
-        cell_t *cell;
-        int axis;
-        double offset1, offset2;
-} line_junction_t;
-
-typedef struct {
-        cell_t *cell;
-        vec_t offset;
-} point_junction_t;
-
-extern array_t *CEX_surface_junctions;
-extern array_t *CEX_line_junctions;
-extern array_t *CEX_point_junctions;
-
-
 #endif /* _CELLS_H */
@@ -0,0 +1,284 @@
+/* -*- Mode: c -*-
+ * checkpoint.c - Binary checkpoints of the state of every thread
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Checkpoints
+ * -------------------------------------------------------------------
+ * Each thread writes a file of its own state, in native byte order,
+ *
+ *   checkpoint_header_t header;
+ *   vec_t positions[n_particles];     internal particles only
+ *   tag_t tags[n_particles];
+ *   vec_t nl_displace[n_particles];
+ *   image_t images[n_particles];
+ *   int comm_ranks[n_comms];
+ *   checkpoint_rule_t rules[n_rules];
+ *   checkpoint_jcell_t jcells[n_jcells];
+ *   char random_state[random_state_size];
+ *
+ * Checkpoints are only written between simulation chunks, when the
+ * forces and random vectors are all regenerated before the next
+ * integration.  Neighbor lists otherwise carry over from one chunk to
+ * the next, so writing a checkpoint invalidates them, s.t. both the
+ * original and the restored simulation rebuild them from the same
+ * state.  Hence this is all the state needed for a restored simulation
+ * to continue exactly as the original would have.
+ * Counters of dynamic load balancing aren't saved; they restart as
+ * after configure_balancing.
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "cells.h"
+#include "bd.h"
+#include "random.h"
+#include "init.h"
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC 0x4b434250U /* PBCK */
+#define CHECKPOINT_VERSION 3U
+
+typedef struct {
+        uint32_t magic, version;
+        int32_t rank, size;
+        int64_t cycle;
+        int32_t n_particles, n_comms, n_rules, n_jcells;
+        uint64_t random_state_size;
+        vec_t min_extent, max_extent;
+} checkpoint_header_t;
+
+typedef struct {
+        int32_t inst, comm_index, tag, pad;
+} checkpoint_rule_t;
+
+typedef struct {
+        int32_t comm_index, pad;
+        vec_t min_extent, max_extent;
+} checkpoint_jcell_t;
+
+#define COMM_INDEX(comm) ((comm_t *)(comm) - ARR_DATA_AS(comm_t, CEX_comms))
+
+static void
+checkpoint_path(char *path, size_t size, const char *prefix, const char *suffix)
+{
+        if (snprintf(path, size, "%s.%d%s", prefix, CEX_rank, suffix) >= (int)size) {
+                Fatal("checkpoint path too long; %.200s", prefix);
+        }
+}
+
+static void
+write_block(FILE *fp, const void *data, size_t el_size, size_t n, const char *path)
+{
+        if (n && fwrite(data, el_size, n, fp) != n) {
+                Fatal("failed to write checkpoint %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+}
+
+static void
+read_block(FILE *fp, void *data, size_t el_size, size_t n, const char *path)
+{
+        if (n && fread(data, el_size, n, fp) != n) {
+                Fatal("truncated checkpoint %.200s", path);
+        }
+}
+
+static comm_t *
+index_comm(array_t *comms, int index, const char *path)
+{
+        if (index < 0 || index >= (int)ARR_LENGTH(comms)) {
+                Fatal("corrupt checkpoint %.200s", path);
+        }
+        return (comm_t *)ARR_ADDRESS_ELEMENT(comms, index);
+}
+
+void
+CEX_write_checkpoint(const char *prefix, int64_t cycle)
+{
+        REQ_INIT();
+        char path[1024], tmp_path[1024];
+        checkpoint_path(path, sizeof(path), prefix, "");
+        checkpoint_path(tmp_path, sizeof(tmp_path), prefix, ".tmp");
+        FILE *fp = fopen(tmp_path, "wb");
+        if (fp==NULL) {
+                Fatal("failed to open %.200s; %.200s (errno=%d)",
+                      tmp_path, strerror(errno), errno);
+        }
+
+        checkpoint_header_t header;
+        XBZERO(checkpoint_header_t, &header, 1);
+        header.magic = CHECKPOINT_MAGIC;
+        header.version = CHECKPOINT_VERSION;
+        header.rank = CEX_rank;
+        header.size = CEX_size;
+        header.cycle = cycle;
+        header.n_particles = CEX_N_internal_particles;
+        header.n_comms = ARR_LENGTH(CEX_comms);
+        header.n_rules = ARR_LENGTH(CEX_comm_rules);
+        header.n_jcells = ARR_LENGTH(CEX_jcells);
+        header.random_state_size = CEX_random_state_size();
+        header.min_extent = CEX_this_cell->min_extent;
+        header.max_extent = CEX_this_cell->max_extent;
+        write_block(fp, &header, sizeof(header), 1, tmp_path);
+
+        write_block(fp, ARR_DATA(CEX_positions), sizeof(vec_t), header.n_particles, tmp_path);
+        write_block(fp, ARR_DATA(CEX_tags), sizeof(tag_t), header.n_particles, tmp_path);
+        write_block(fp, ARR_DATA(CEX_nl_displace), sizeof(vec_t), header.n_particles, tmp_path);
+        write_block(fp, ARR_DATA(CEX_images), sizeof(image_t), header.n_particles, tmp_path);
+
+        int counter;
+        comm_t *comm;
+        COMM_FOREACH(comm, counter) {
+                write_block(fp, &comm->comm_rank, sizeof(int), 1, tmp_path);
+        }
+        comm_rule_t *rule;
+        COMM_RULE_FOREACH(rule, counter) {
+                checkpoint_rule_t record = {rule->inst, COMM_INDEX(rule->comm), rule->tag, 0};
+                write_block(fp, &record, sizeof(record), 1, tmp_path);
+        }
+        cell_t *jcell;
+        JCELL_FOREACH(jcell, counter) {
+                checkpoint_jcell_t record;
+                XBZERO(checkpoint_jcell_t, &record, 1);
+                record.comm_index = COMM_INDEX(jcell->comm);
+                record.min_extent = jcell->min_extent;
+                record.max_extent = jcell->max_extent;
+                write_block(fp, &record, sizeof(record), 1, tmp_path);
+        }
+
+        char random_state[header.random_state_size];
+        CEX_save_random_state(random_state);
+        write_block(fp, random_state, 1, header.random_state_size, tmp_path);
+
+        if (fclose(fp) != 0) {
+                Fatal("failed to write checkpoint %.200s; %.200s (errno=%d)",
+                      tmp_path, strerror(errno), errno);
+        }
+        /* only replace the previous checkpoint once it's complete on
+         * every thread */
+        MPI_Barrier(MPI_COMM_WORLD);
+        if (rename(tmp_path, path) != 0) {
+                Fatal("failed to rename %.200s to %.200s; %.200s (errno=%d)",
+                      tmp_path, path, strerror(errno), errno);
+        }
+        CEX_invalidate_neighbor_lists();
+        xprintf("checkpointed %d particles at cycle %ld to %.200s",
+                CEX_N_internal_particles, (long)cycle, path);
+}
+
+int64_t
+CEX_read_checkpoint(const char *prefix)
+{
+        char path[1024];
+        checkpoint_path(path, sizeof(path), prefix, "");
+        FILE *fp = fopen(path, "rb");
+        if (fp==NULL) {
+                Fatal("failed to open %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+
+        checkpoint_header_t header;
+        read_block(fp, &header, sizeof(header), 1, path);
+        if (header.magic!=CHECKPOINT_MAGIC || header.version!=CHECKPOINT_VERSION) {
+                Fatal("%.200s isn't a version %u checkpoint", path, CHECKPOINT_VERSION);
+        }
+        if (header.rank!=CEX_rank || header.size!=CEX_size) {
+                Fatal("checkpoint %.200s of thread %d of %d restored on thread %d of %d",
+                      path, header.rank, header.size, CEX_rank, CEX_size);
+        }
+        if (header.n_particles < 0 || header.n_comms < 0 ||
+            header.n_rules < 0 || header.n_jcells < 0) {
+                Fatal("corrupt checkpoint %.200s", path);
+        }
+
+        array_t *positions = CEX_make_vec_array(header.n_particles);
+        CEX_align_array(positions, sizeof(double));
+        array_t *tags = CEX_make_array(sizeof(tag_t), header.n_particles);
+        array_t *nl_displace = CEX_make_vec_array(header.n_particles);
+        array_t *images = CEX_make_array(sizeof(image_t), header.n_particles);
+        read_block(fp, ARR_DATA(positions), sizeof(vec_t), header.n_particles, path);
+        read_block(fp, ARR_DATA(tags), sizeof(tag_t), header.n_particles, path);
+        read_block(fp, ARR_DATA(nl_displace), sizeof(vec_t), header.n_particles, path);
+        read_block(fp, ARR_DATA(images), sizeof(image_t), header.n_particles, path);
+        ARR_LENGTH(positions) = ARR_LENGTH(tags) = header.n_particles;
+
+        array_t *comms = CEX_make_array(sizeof(comm_t), header.n_comms);
+        for (int i=0; i<header.n_comms; i++) {
+                comm_t comm;
+                read_block(fp, &comm.comm_rank, sizeof(int), 1, path);
+                if (comm.comm_rank < 0 || comm.comm_rank >= CEX_size) {
+                        Fatal("corrupt checkpoint %.200s", path);
+                }
+                comm.arr_inx = i;
+                comm.current_rule = NULL;
+#ifdef MPI_SHARED_MEMORY_HALOS
+                comm.node_rank = -1;
+#endif
+                ARR_APPEND(comm_t, comms, comm);
+        }
+        array_t *rules = CEX_make_array(sizeof(comm_rule_t), header.n_rules);
+        for (int i=0; i<header.n_rules; i++) {
+                checkpoint_rule_t record;
+                read_block(fp, &record, sizeof(record), 1, path);
+                comm_rule_t rule;
+                rule.inst = record.inst;
+                rule.comm = index_comm(comms, record.comm_index, path);
+                rule.tag = record.tag;
+                ARR_APPEND(comm_rule_t, rules, rule);
+        }
+        array_t *jcells = CEX_make_array(sizeof(cell_t), header.n_jcells);
+        for (int i=0; i<header.n_jcells; i++) {
+                checkpoint_jcell_t record;
+                read_block(fp, &record, sizeof(record), 1, path);
+                cell_t jcell;
+                jcell.comm = index_comm(comms, record.comm_index, path);
+                jcell.min_extent = record.min_extent;
+                jcell.max_extent = record.max_extent;
+                ARR_APPEND(cell_t, jcells, jcell);
+        }
+
+        /* seeding draws a random vector, so the generator is only
+         * restored afterwards */
+        CEX_setup_random(0);
+        if (header.random_state_size != CEX_random_state_size()) {
+                Fatal("checkpoint %.200s written with a different random number generator",
+                      path);
+        }
+        char random_state[header.random_state_size];
+        read_block(fp, random_state, 1, header.random_state_size, path);
+        CEX_restore_random_state(random_state);
+        fclose(fp);
+
+        CEX_setup_cell_state(header.min_extent, header.max_extent, positions, tags);
+        XMEMCPY(vec_t, ARR_DATA(CEX_nl_displace), ARR_DATA(nl_displace), header.n_particles);
+        CEX_free_array(nl_displace);
+        XMEMCPY(image_t, ARR_DATA(CEX_images), ARR_DATA(images), header.n_particles);
+        CEX_free_array(images);
+        CEX_setup_cell_comm(comms, rules);
+        CEX_setup_cell_junctions(jcells);
+        xprintf("restored checkpoint %.200s at cycle %ld", path, (long)header.cycle);
+        return header.cycle;
+}
@@ -0,0 +1,38 @@
+/* -*- Mode: c -*-
+ * checkpoint.h - Binary checkpoints of the state of every thread
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHECKPOINT_H
+#define _CHECKPOINT_H
+
+#include <stdint.h>
+
+/* every thread writes its own state to `prefix.RANK, the next
+ * integration cycle being `cycle.  files replace those of any previous
+ * checkpoint only once all threads have written theirs.  must be called
+ * between simulation chunks.  collective */
+void CEX_write_checkpoint(const char *prefix, int64_t cycle);
+
+/* restore the state of this thread from `prefix.RANK in place of
+ * initializing random, cell state, comm and junctions (see init.h),
+ * returning the cycle of the checkpoint.  requires the same number of
+ * threads as wrote the checkpoint */
+int64_t CEX_read_checkpoint(const char *prefix);
+
+#endif /* _CHECKPOINT_H */
@@ -0,0 +1,248 @@
+/* -*- Mode: c -*-
+ * clusters.c - Cluster analysis by union-find over neighbor lists
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Cluster Analysis
+ * -------------------------------------------------------------------
+ * Particles closer than the bond distance are bonded and clusters are
+ * the connected components of bonded particles.  As the neighbor lists
+ * hold every pair within the pair cutoff, these are the only pairs to
+ * consider.  Each thread first joins the internal particles bonded to
+ * one another with a union-find, giving clusters local to the thread.
+ * Every particle is then labeled by the smallest tag in its local
+ * cluster or bonded to it from a junctioned cell, and the labels of
+ * external particles are exchanged, until no label changes on any
+ * thread.  Thereby a cluster spanning several threads converges to the
+ * smallest tag within it, in as many rounds as threads it spans.
+ */
+
+#include <mpi.h>
+
+#include "opt.h"
+#include "constants.h"
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "periodic.h"
+#include "bd.h"
+#include "init.h"
+#include "clusters.h"
+
+static int
+find_root(int *parents, int i)
+{
+        while (parents[i] != i) {
+                parents[i] = parents[parents[i]];
+                i = parents[i];
+        }
+        return i;
+}
+
+/* pairs of `neighbors within `bond_distance */
+static array_t *
+bonded_pairs(array_t *neighbors, double bond_distance)
+{
+        vec_t _box_size=CEX_box_size, _box_half=CEX_box_half;
+        const vec_t * CEX_RESTRICT _positions=ARR_DATA_AS(vec_t, CEX_positions);
+        double bond_distance_sqr = bond_distance * bond_distance;
+        array_t *bonds = CEX_make_int_array(0);
+        for (int n_counter=ARR_LENGTH(neighbors) >> 1,
+             *n_ptr=ARR_DATA_AS(int, neighbors);
+             n_counter -- > 0; n_ptr+=2) {
+                vec_t r;
+                XPERIODIC_SEPARATION_VECTOR(r, _positions[n_ptr[0]], _positions[n_ptr[1]],
+                                            _box_size, _box_half);
+                if (Vec3_SQR(r) < bond_distance_sqr) {
+                        IARR_APPEND(bonds, n_ptr[0]);
+                        IARR_APPEND(bonds, n_ptr[1]);
+                }
+        }
+        return bonds;
+}
+
+array_t *
+CEX_find_clusters(double bond_distance)
+{
+        REQ_INIT();
+        if (!(bond_distance > 0 && bond_distance <= CEX_r_pair_cutoff)) {
+                Fatal("bad bond distance %.3g (nm); must be in range (0:%.3g]",
+                      bond_distance / CEX_nm, CEX_r_pair_cutoff / CEX_nm);
+        }
+        CEX_thread_update_external_positions();
+        int N = CEX_N_internal_particles;
+
+        /* local clusters */
+        int *roots = XNEW(int, N);
+        for (int i=0; i<N; i++) {
+                roots[i] = i;
+        }
+        array_t *internal_bonds = bonded_pairs(CEX_internal_neighbors, bond_distance);
+        for (int n=0; n<ARR_LENGTH(internal_bonds); n+=2) {
+                int root_i = find_root(roots, ARR_INDEX_AS(int, internal_bonds, n));
+                int root_j = find_root(roots, ARR_INDEX_AS(int, internal_bonds, n+1));
+                if (root_i < root_j) {
+                        roots[root_j] = root_i;
+                } else {
+                        roots[root_i] = root_j;
+                }
+        }
+        CEX_free_array(internal_bonds);
+        for (int i=0; i<N; i++) {
+                roots[i] = find_root(roots, i);
+        }
+
+        /* merge across threads */
+        array_t *external_bonds = bonded_pairs(CEX_external_neighbors, bond_distance);
+        array_t *labels = CEX_copy_array(CEX_tags);
+        tag_t *cluster_labels = XNEW(tag_t, N);
+        int changed;
+        int rounds = 0;
+        do {
+                CEX_exchange_external_tags(labels);
+                tag_t *_labels = ARR_DATA_AS(tag_t, labels);
+                for (int i=0; i<N; i++) {
+                        cluster_labels[i] = CEX_MAX_TAG;
+                }
+                for (int i=0; i<N; i++) {
+                        if (_labels[i] < cluster_labels[roots[i]]) {
+                                cluster_labels[roots[i]] = _labels[i];
+                        }
+                }
+                for (int n=0; n<ARR_LENGTH(external_bonds); n+=2) {
+                        int root = roots[ARR_INDEX_AS(int, external_bonds, n)];
+                        tag_t label = _labels[ARR_INDEX_AS(int, external_bonds, n+1)];
+                        if (label < cluster_labels[root]) {
+                                cluster_labels[root] = label;
+                        }
+                }
+                int local_changed = 0;
+                for (int i=0; i<N; i++) {
+                        local_changed |= _labels[i] != cluster_labels[roots[i]];
+                        _labels[i] = cluster_labels[roots[i]];
+                }
+                ARR_LENGTH(labels) = N;
+                MPI_Allreduce(&local_changed, &changed, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+                rounds ++;
+        } while (changed);
+        CEX_free_array(external_bonds);
+        CEX_free(cluster_labels);
+        CEX_free(roots);
+        if (IS_MASTER()) {
+                xprintf("found clusters within %.2f (nm) in %d rounds",
+                        bond_distance / CEX_nm, rounds);
+        }
+        return labels;
+}
+
+typedef struct {
+        tag_t label;
+        int count, pad;
+} cluster_count_t;
+
+static int
+cmp_labels(const void *a, const void *b)
+{
+        tag_t label_a = *(const tag_t *)a;
+        tag_t label_b = *(const tag_t *)b;
+        return (label_a > label_b) - (label_a < label_b);
+}
+
+static int
+cmp_cluster_counts(const void *a, const void *b)
+{
+        return cmp_labels(&((const cluster_count_t *)a)->label,
+                          &((const cluster_count_t *)b)->label);
+}
+
+/* number of internal particles in each cluster, ordered by label */
+static array_t *
+count_clusters(array_t *labels)
+{
+        array_t *sorted = CEX_copy_array(labels);
+        CEX_sort_array(sorted, &cmp_labels);
+        array_t *counts = CEX_make_array(sizeof(cluster_count_t), 0);
+        tag_t *labelp;
+        int counter;
+        ARR_FOREACH(tag_t, sorted, labelp, counter) {
+                if (ARR_LENGTH(counts) &&
+                    ARR_INDEX_AS(cluster_count_t, counts, ARR_LENGTH(counts)-1).label == *labelp) {
+                        ARR_INDEX_AS(cluster_count_t, counts, ARR_LENGTH(counts)-1).count ++;
+                } else {
+                        cluster_count_t cc = {*labelp, 1, 0};
+                        ARR_APPEND(cluster_count_t, counts, cc);
+                }
+        }
+        CEX_free_array(sorted);
+        return counts;
+}
+
+array_t *
+CEX_cluster_size_distribution(array_t *labels)
+{
+        assert(ARR_EL_SIZE(labels) == sizeof(tag_t));
+        array_t *counts = count_clusters(labels);
+        int n_counts = ARR_LENGTH(counts);
+        MPI_Datatype count_type = CEX_record_datatype(sizeof(cluster_count_t));
+        int *recv_counts=NULL, *displs=NULL;
+        array_t *all_counts=NULL;
+        if (IS_MASTER()) {
+                recv_counts = XNEW(int, CEX_size);
+                displs = XNEW(int, CEX_size);
+        }
+        MPI_Gather(&n_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        if (IS_MASTER()) {
+                int64_t total = 0;
+                for (int rank=0; rank<CEX_size; rank++) {
+                        displs[rank] = CEX_mpi_count(total);
+                        total += recv_counts[rank];
+                }
+                all_counts = CEX_make_array(sizeof(cluster_count_t), total);
+                ARR_LENGTH(all_counts) = total;
+        }
+        MPI_Gatherv(ARR_DATA(counts), n_counts, count_type,
+                    IS_MASTER() ? ARR_DATA(all_counts) : NULL, recv_counts, displs,
+                    count_type, 0, MPI_COMM_WORLD);
+        CEX_free_array(counts);
+        if (!IS_MASTER()) {
+                return NULL;
+        }
+        CEX_free(recv_counts);
+        CEX_free(displs);
+
+        /* sum the counts of clusters spanning threads */
+        CEX_sort_array(all_counts, &cmp_cluster_counts);
+        array_t *distribution = CEX_make_int_array(0);
+        int n=0;
+        while (n < ARR_LENGTH(all_counts)) {
+                tag_t label = ARR_INDEX_AS(cluster_count_t, all_counts, n).label;
+                int size = 0;
+                for (; n < ARR_LENGTH(all_counts) &&
+                       ARR_INDEX_AS(cluster_count_t, all_counts, n).label == label; n++) {
+                        size += ARR_INDEX_AS(cluster_count_t, all_counts, n).count;
+                }
+                while (ARR_LENGTH(distribution) <= size) {
+                        IARR_APPEND(distribution, 0);
+                }
+                ARR_INDEX_AS(int, distribution, size) ++;
+        }
+        CEX_free_array(all_counts);
+        return distribution;
+}
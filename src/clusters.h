@@ -0,0 +1,39 @@
+/* -*- Mode: c -*-
+ * clusters.h - Cluster analysis by union-find over neighbor lists
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _CLUSTERS_H
+#define _CLUSTERS_H
+
+#include "array.h"
+
+/* find the clusters of particles bonded within `bond_distance (at most
+ * the pair cutoff), labeling each internal particle with the smallest
+ * tag in its cluster.  returns a new array of these labels, ordered as
+ * the internal particles.  must be called between simulation chunks.
+ * collective */
+array_t *CEX_find_clusters(double bond_distance);
+
+/* from the labels of each thread, count clusters by size, returning on
+ * the master a new array whose n-th element is the number of clusters
+ * of n particles.  collective */
+array_t *CEX_cluster_size_distribution(array_t *labels);
+
+#endif /* _CLUSTERS_H */
@@ -3,12 +3,14 @@
 #include "debug.h"
 #include "compat.h"
 
-/* communcation routines  */
+/* communcation routines
+ * these exchange data local to a pair of adjacent threads, s.t. int
+ * counts suffice; overflow is still caught rather than truncated */
 static inline void
-comm_send(comm_t *comm, void *data, int len, MPI_Datatype dt)
+comm_send(comm_t *comm, void *data, size_t len, MPI_Datatype dt)
 {
         int res;
-        res = MPI_Send(data, len, dt,
+        res = MPI_Send(data, CEX_mpi_count(len), dt,
                         comm->comm_rank, comm->current_rule->tag,
                         MPI_COMM_WORLD);
         if (unlikely(res!=0)) {
@@ -18,11 +20,11 @@ comm_send(comm_t *comm, void *data, int len, MPI_Datatype dt)
 }
 
 static inline void
-comm_recv(comm_t *comm, void *data, int len, MPI_Datatype dt)
+comm_recv(comm_t *comm, void *data, size_t len, MPI_Datatype dt)
 {
         int res;
         MPI_Status status;
-        res = MPI_Recv(data, len, dt,
+        res = MPI_Recv(data, CEX_mpi_count(len), dt,
                        comm->comm_rank, comm->current_rule->tag,
                        MPI_COMM_WORLD, &status);
         if (unlikely(res!=0)) {
@@ -74,6 +76,14 @@ comm_send_vecs(comm_t *comm, array_t *vecs)
                   3*ARR_LENGTH(vecs), MPI_DOUBLE);
 }
 
+/* send an array of arbitrary elements as raw bytes */
+static inline void 
+comm_send_array(comm_t *comm, array_t *arr) 
+{
+        comm_send(comm, ARR_DATA_AS(void, arr),
+                  ARR_LENGTH(arr) * ARR_EL_SIZE(arr), MPI_BYTE);
+}
+
 static inline void 
 comm_send_ints_by_index(comm_t *comm, array_t *ints, array_t *indices)
 {
@@ -124,6 +134,21 @@ comm_recv_vecs(comm_t *comm, array_t *dst)
         ARR_LENGTH(dst) = len;
 }
 
+/* recieve raw bytes into an array, s.t. the length of the array
+ * is determined by the size of the message */
+static inline void 
+comm_recv_array(comm_t *comm, array_t *dst)
+{
+        int bytes, len;
+
+        bytes = msg_bytes(comm);
+        assert(bytes % ARR_EL_SIZE(dst) == 0);
+        len = bytes / ARR_EL_SIZE(dst);
+        CEX_prealloc_array(dst, len);
+        comm_recv(comm, ARR_DATA_AS(void, dst), bytes, MPI_BYTE);
+        ARR_LENGTH(dst) = len;
+}
+
 static inline void 
 comm_recv_extend_ints(comm_t *comm, array_t *dst)
 {
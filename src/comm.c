@@ -18,9 +18,312 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <limits.h>
+
 #include "comm.h"
+#include "debug.h"
+#include "mem.h"
 
 int CEX_rank=-1;
 int CEX_size=-1;
 array_t * CEX_comms=NULL;
 array_t * CEX_comm_rules=NULL;
+
+#define MAX_RECORD_DATATYPES 16
+static struct {
+        size_t size;
+        MPI_Datatype datatype;
+} record_datatypes[MAX_RECORD_DATATYPES];
+static int n_record_datatypes=0;
+
+MPI_Datatype
+CEX_record_datatype(size_t size)
+{
+        for (int i=0; i<n_record_datatypes; i++) {
+                if (record_datatypes[i].size==size) {
+                        return record_datatypes[i].datatype;
+                }
+        }
+        if (n_record_datatypes==MAX_RECORD_DATATYPES) {
+                Fatal("too many record datatypes");
+        }
+        MPI_Datatype datatype;
+        MPI_Type_contiguous((int)size, MPI_BYTE, &datatype);
+        MPI_Type_commit(&datatype);
+        record_datatypes[n_record_datatypes].size = size;
+        record_datatypes[n_record_datatypes].datatype = datatype;
+        n_record_datatypes++;
+        return datatype;
+}
+
+int
+CEX_mpi_count(int64_t count)
+{
+        if (unlikely(count < 0 || count > INT_MAX)) {
+                Fatal("count %lld exceeds the range of an MPI count",
+                      (long long)count);
+        }
+        return (int)count;
+}
+
+#ifdef MPI_NEIGHBOR_COLLECTIVES
+
+MPI_Comm CEX_neighbor_comm=MPI_COMM_NULL;
+array_t *CEX_neighbor_send_slots=NULL;
+array_t *CEX_neighbor_recv_slots=NULL;
+
+/* record the position of each communicator among the `neighbors
+ * reported by the graph communicator, one per communicator.  each
+ * position is matched to the first unclaimed communicator with that
+ * rank */
+static array_t *
+neighbor_slots(const int *neighbors)
+{
+        int slot, counter;
+        comm_t *comm;
+        array_t *slots = CEX_make_int_array(ARR_LENGTH(CEX_comms));
+        ARR_LENGTH(slots) = ARR_LENGTH(CEX_comms);
+        COMM_FOREACH(comm, counter) {
+                GET_COMM_DATA(int, slots, comm) = -1;
+        }
+        for (slot=0; slot<ARR_LENGTH(CEX_comms); slot++) {
+                comm_t *match=NULL;
+                COMM_FOREACH(comm, counter) {
+                        if (comm->comm_rank==neighbors[slot] &&
+                            GET_COMM_DATA(int, slots, comm) < 0) {
+                                match = comm;
+                                break;
+                        }
+                }
+                if (unlikely(match==NULL)) {
+                        Fatal("no communicator for graph neighbor %d", 
+                              neighbors[slot]);
+                }
+                GET_COMM_DATA(int, slots, match) = slot;
+        }
+        return slots;
+}
+
+void
+CEX_create_neighbor_comm(void)
+{
+        int res, n_comms, counter, i, indegree, outdegree, weighted;
+        int *ranks, *weights, *sources, *destinations;
+        comm_t *comm;
+
+        n_comms = ARR_LENGTH(CEX_comms);
+        /* arrays passed to MPI always have at least one element, even
+         * for a thread without communicators.  edges are given unit
+         * weights, as opposed to MPI_UNWEIGHTED, which some MPI
+         * libraries define as a pointer to no storage */
+        ranks = XNEW(int, n_comms ? n_comms : 1);
+        weights = XNEW(int, n_comms ? n_comms : 1);
+        COMM_FOREACH(comm, counter) {
+                ranks[comm->arr_inx] = comm->comm_rank;
+        }
+        for (i=0; i<(n_comms ? n_comms : 1); i++) {
+                weights[i] = 1;
+        }
+        /* no reordering, as ranks are bound to cells */
+        res = MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD,
+                                             n_comms, ranks, weights,
+                                             n_comms, ranks, weights,
+                                             MPI_INFO_NULL, 0, &CEX_neighbor_comm);
+        if (unlikely(res!=0)) {
+                Fatal("MPI_Dist_graph_create_adjacent returned %d", res);
+        }
+        CEX_free(ranks);
+
+        /* buffers exchanged with each neighbor are laid out in the order
+         * of the sources and destinations of the graph itself */
+        MPI_Dist_graph_neighbors_count(CEX_neighbor_comm, &indegree, 
+                                       &outdegree, &weighted);
+        if (unlikely(indegree!=n_comms || outdegree!=n_comms)) {
+                Fatal("graph has %d sources and %d destinations for %d "
+                      "communicators", indegree, outdegree, n_comms);
+        }
+        sources = XNEW(int, n_comms ? n_comms : 1);
+        destinations = XNEW(int, n_comms ? n_comms : 1);
+        res = MPI_Dist_graph_neighbors(CEX_neighbor_comm, 
+                                       n_comms, sources, weights,
+                                       n_comms, destinations, weights);
+        if (unlikely(res!=0)) {
+                Fatal("MPI_Dist_graph_neighbors returned %d", res);
+        }
+        CEX_neighbor_recv_slots = neighbor_slots(sources);
+        CEX_neighbor_send_slots = neighbor_slots(destinations);
+        CEX_free(weights);
+        CEX_free(sources);
+        CEX_free(destinations);
+}
+
+static array_t *
+make_layout_array(void)
+{
+        array_t *arr = CEX_make_int_array(ARR_LENGTH(CEX_comms));
+        ARR_LENGTH(arr) = ARR_LENGTH(CEX_comms);
+        CEX_zero_array_elements(arr);
+        return arr;
+}
+
+void
+CEX_init_comm_layout(comm_layout_t *layout)
+{
+        layout->send_counts = make_layout_array();
+        layout->send_displs = make_layout_array();
+        layout->recv_counts = make_layout_array();
+        layout->recv_displs = make_layout_array();
+}
+
+static int
+prefix_sum_displs(array_t *counts, array_t *displs)
+{
+        int i, total=0;
+        for (i=0; i<ARR_LENGTH(counts); i++) {
+                ARR_INDEX_AS(int, displs, i) = total;
+                total += ARR_INDEX_AS(int, counts, i);
+        }
+        return total;
+}
+
+int
+CEX_layout_send_displs(comm_layout_t *layout)
+{
+        return prefix_sum_displs(layout->send_counts, layout->send_displs);
+}
+
+int
+CEX_layout_recv_displs(comm_layout_t *layout)
+{
+        return prefix_sum_displs(layout->recv_counts, layout->recv_displs);
+}
+
+int
+CEX_neighbor_exchange_counts(comm_layout_t *layout)
+{
+        int res;
+
+        res = MPI_Neighbor_alltoall(ARR_DATA(layout->send_counts), 1, MPI_INT,
+                                    ARR_DATA(layout->recv_counts), 1, MPI_INT,
+                                    CEX_neighbor_comm);
+        if (unlikely(res!=0)) {
+                Fatal("MPI_Neighbor_alltoall returned %d", res);
+        }
+        return prefix_sum_displs(layout->recv_counts, layout->recv_displs);
+}
+
+void
+CEX_neighbor_exchange(comm_layout_t *layout, void *send_buf, void *recv_buf)
+{
+        int res;
+
+        res = MPI_Neighbor_alltoallv(send_buf, ARR_DATA(layout->send_counts),
+                                     ARR_DATA(layout->send_displs), MPI_BYTE,
+                                     recv_buf, ARR_DATA(layout->recv_counts),
+                                     ARR_DATA(layout->recv_displs), MPI_BYTE,
+                                     CEX_neighbor_comm);
+        if (unlikely(res!=0)) {
+                Fatal("MPI_Neighbor_alltoallv returned %d", res);
+        }
+}
+
+#endif /* MPI_NEIGHBOR_COLLECTIVES */
+
+#ifdef MPI_SHARED_MEMORY_HALOS
+
+MPI_Comm CEX_node_comm=MPI_COMM_NULL;
+int CEX_node_rank=-1;
+int CEX_have_remote_comms=1;
+
+static MPI_Win shared_win=MPI_WIN_NULL;
+static size_t shared_bytes=0;
+/* base address and size of the segment for each thread on this node */
+static void **shared_bases=NULL;
+static size_t *shared_sizes=NULL;
+
+void
+CEX_create_node_comm(void)
+{
+        int res, node_size, counter, have_remote=0;
+        MPI_Group world_group, node_group;
+        comm_t *comm;
+
+        res = MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
+                                  MPI_INFO_NULL, &CEX_node_comm);
+        if (unlikely(res!=0)) {
+                Fatal("MPI_Comm_split_type returned %d", res);
+        }
+        MPI_Comm_size(CEX_node_comm, &node_size);
+        MPI_Comm_rank(CEX_node_comm, &CEX_node_rank);
+        MPI_Comm_group(MPI_COMM_WORLD, &world_group);
+        MPI_Comm_group(CEX_node_comm, &node_group);
+        COMM_FOREACH(comm, counter) {
+                int node_rank;
+                MPI_Group_translate_ranks(world_group, 1, &comm->comm_rank,
+                                          node_group, &node_rank);
+                comm->node_rank = node_rank==MPI_UNDEFINED ? -1 : node_rank;
+                have_remote |= !COMM_IS_LOCAL(comm);
+        }
+        MPI_Group_free(&world_group);
+        MPI_Group_free(&node_group);
+        MPI_Allreduce(&have_remote, &CEX_have_remote_comms, 1, MPI_INT, 
+                      MPI_LOR, MPI_COMM_WORLD);
+        shared_bases = XNEW(void *, node_size);
+        shared_sizes = XNEW(size_t, node_size);
+        xprintf("%d threads on this node%s", node_size, 
+                CEX_have_remote_comms ? "" : "; no remote communicators");
+}
+
+void
+CEX_reserve_shared_segment(size_t bytes)
+{
+        int res, grow, any_grow, node_size, node_rank;
+        void *base;
+
+        grow = bytes > shared_bytes || shared_win==MPI_WIN_NULL;
+        MPI_Allreduce(&grow, &any_grow, 1, MPI_INT, MPI_LOR, CEX_node_comm);
+        if (likely(!any_grow)) {
+                return;
+        }
+        if (shared_win!=MPI_WIN_NULL) {
+                MPI_Win_unlock_all(shared_win);
+                MPI_Win_free(&shared_win);
+        }
+        if (grow) {
+                /* over allocate to minimize future reallocations */
+                shared_bytes = bytes + bytes / 2;
+        }
+        res = MPI_Win_allocate_shared(shared_bytes, 1, MPI_INFO_NULL, 
+                                      CEX_node_comm, &base, &shared_win);
+        if (unlikely(res!=0)) {
+                Fatal("MPI_Win_allocate_shared returned %d", res);
+        }
+        MPI_Win_lock_all(MPI_MODE_NOCHECK, shared_win);
+        MPI_Comm_size(CEX_node_comm, &node_size);
+        for (node_rank=0; node_rank<node_size; node_rank++) {
+                MPI_Aint size;
+                int disp_unit;
+                MPI_Win_shared_query(shared_win, node_rank, &size, &disp_unit,
+                                     &shared_bases[node_rank]);
+                shared_sizes[node_rank] = size;
+        }
+}
+
+void *
+CEX_shared_segment(int node_rank, size_t *bytes)
+{
+        if (bytes!=NULL) {
+                *bytes = shared_sizes[node_rank];
+        }
+        return shared_bases[node_rank];
+}
+
+void
+CEX_sync_shared_segments(void)
+{
+        MPI_Win_sync(shared_win);
+        MPI_Barrier(CEX_node_comm);
+        MPI_Win_sync(shared_win);
+}
+
+#endif /* MPI_SHARED_MEMORY_HALOS */
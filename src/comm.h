@@ -33,6 +33,8 @@
 #define _COMM_H
 
 #include <mpi.h>
+#include <stdint.h>
+
 #include "array.h"
 #include "opt.h"
 
@@ -59,6 +61,18 @@ extern int CEX_size;
 } while (0)                
 
 
+/* Large Transfers
+ * MPI counts are int, which limits a single transfer of bytes to 2 GB.
+ * Collectives over the particles of every thread instead count whole
+ * records of a contiguous datatype, s.t. they only overflow when a
+ * count of particles exceeds the range of int.
+ */
+/* contiguous datatype of `size bytes; created on first use and kept
+ * for the life of the process */
+MPI_Datatype CEX_record_datatype(size_t size);
+/* checked conversion of a global count (or displacement) to int */
+int CEX_mpi_count(int64_t count);
+
 typedef struct comm_t comm_t;
 typedef struct comm_rule_t comm_rule_t;
 
@@ -80,6 +94,10 @@ struct comm_t {
                       * each communicator has a unique index to access 
                       * this meta data */
         comm_rule_t *current_rule; /* rule we're currently executing */
+#ifdef MPI_SHARED_MEMORY_HALOS
+        int node_rank; /* rank in CEX_node_comm when the thread we're 
+                        * communicating with is on this node, otherwise -1 */
+#endif
 };
 
 extern array_t * CEX_comms;
@@ -90,6 +108,88 @@ extern array_t * CEX_comms;
 #define GET_COMM_DATA(tp, arr, comm) ARR_INDEX_AS(tp, arr, (comm)->arr_inx)
 
 
+#ifdef MPI_NEIGHBOR_COLLECTIVES
+/* Neighborhood Collectives
+ * Alternatively, all pair-wise communication can be performed as a
+ * single neighborhood collective over a distributed graph communicator
+ * connecting this thread to the threads of each of its communicators.
+ * The MPI library then schedules the exchange itself and the comm
+ * rules are not used.  The data exchanged with each neighbor is laid
+ * out contiguously in the order in which the graph communicator lists
+ * its destinations and sources, s.t. external particles are not
+ * necessarily indexed as when exchanged pair-wise.
+ */
+extern MPI_Comm CEX_neighbor_comm;
+/* position of each communicator among the destinations and sources
+ * of CEX_neighbor_comm, indexed by arr_inx */
+extern array_t *CEX_neighbor_send_slots;
+extern array_t *CEX_neighbor_recv_slots;
+
+/* byte counts and displacements of the data exchanged with each
+ * neighbor in a neighborhood collective, indexed by the position of
+ * the neighbor in CEX_neighbor_comm */
+typedef struct {
+        array_t *send_counts, *send_displs;
+        array_t *recv_counts, *recv_displs;
+} comm_layout_t;
+
+#define LAYOUT_SEND_SLOT(comm) GET_COMM_DATA(int, CEX_neighbor_send_slots, comm)
+#define LAYOUT_RECV_SLOT(comm) GET_COMM_DATA(int, CEX_neighbor_recv_slots, comm)
+
+#define LAYOUT_SEND_COUNT(lyt, comm) \
+        ARR_INDEX_AS(int, (lyt)->send_counts, LAYOUT_SEND_SLOT(comm))
+#define LAYOUT_SEND_DISPL(lyt, comm) \
+        ARR_INDEX_AS(int, (lyt)->send_displs, LAYOUT_SEND_SLOT(comm))
+#define LAYOUT_RECV_COUNT(lyt, comm) \
+        ARR_INDEX_AS(int, (lyt)->recv_counts, LAYOUT_RECV_SLOT(comm))
+#define LAYOUT_RECV_DISPL(lyt, comm) \
+        ARR_INDEX_AS(int, (lyt)->recv_displs, LAYOUT_RECV_SLOT(comm))
+
+void CEX_create_neighbor_comm(void);
+void CEX_init_comm_layout(comm_layout_t *);
+/* compute send displacements from send counts; returns total bytes sent */
+int CEX_layout_send_displs(comm_layout_t *);
+/* compute recv displacements from recv counts; returns total bytes 
+ * recieved */
+int CEX_layout_recv_displs(comm_layout_t *);
+/* exchange send counts to fill in recv counts and displacements;
+ * returns total bytes recieved */
+int CEX_neighbor_exchange_counts(comm_layout_t *);
+void CEX_neighbor_exchange(comm_layout_t *, void *send_buf, void *recv_buf);
+#endif /* MPI_NEIGHBOR_COLLECTIVES */
+
+#ifdef MPI_SHARED_MEMORY_HALOS
+# ifdef MPI_NEIGHBOR_COLLECTIVES
+#   error "can't use shared memory halos with neighborhood collectives"
+# endif
+/* Shared Memory Segments
+ * Threads on the same node can exchange data by reading from each 
+ * other's segment of an MPI-3 shared memory window, as opposed to
+ * message passing.  Each thread owns a single segment, which it writes
+ * and all other threads on the node may read following a call to
+ * CEX_sync_shared_segments.
+ */
+extern MPI_Comm CEX_node_comm;
+extern int CEX_node_rank;
+/* whether any thread has a communicator on another node, in which 
+ * case pair-wise communication is still required */
+extern int CEX_have_remote_comms;
+
+#define COMM_IS_LOCAL(comm) ((comm)->node_rank >= 0)
+
+void CEX_create_node_comm(void);
+/* ensure the segment of this thread has at least `bytes; collective over
+ * CEX_node_comm and the contents of all segments are lost when any 
+ * thread requires a larger segment */
+void CEX_reserve_shared_segment(size_t bytes);
+/* base address and size of the segment owned by a thread on this node */
+void *CEX_shared_segment(int node_rank, size_t *bytes);
+/* make all writes to this thread's segment visible to the other threads
+ * of this node and wait for them to do the same */
+void CEX_sync_shared_segments(void);
+#endif /* MPI_SHARED_MEMORY_HALOS */
+
+
 /* * * * * * * * * * * * * * * * * * * * *
  * inlined communicator helper functions *
  * * * * * * * * * * * * * * * * * * * * */
@@ -98,8 +198,8 @@ extern array_t * CEX_comms;
 #define COMM_HELPER_ATTRS              \
         GCC_ATTRIBUTE((always_inline))
 
-static inline void comm_send(comm_t *, void *, int, MPI_Datatype) COMM_HELPER_ATTRS;
-static inline void comm_recv(comm_t *, void *, int, MPI_Datatype) COMM_HELPER_ATTRS;
+static inline void comm_send(comm_t *, void *, size_t, MPI_Datatype) COMM_HELPER_ATTRS;
+static inline void comm_recv(comm_t *, void *, size_t, MPI_Datatype) COMM_HELPER_ATTRS;
 static inline void comm_send_int(comm_t *, int) COMM_HELPER_ATTRS;
 static inline int comm_recv_int(comm_t *) COMM_HELPER_ATTRS;
 static inline int msg_bytes(comm_t *) COMM_HELPER_ATTRS;
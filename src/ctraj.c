@@ -0,0 +1,392 @@
+/* -*- Mode: c -*-
+ * ctraj.c - Quantized and compressed trajectory files
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compressed Trajectories
+ * -------------------------------------------------------------------
+ * Much as XTC files, each coordinate is quantized to an integer
+ * number of levels across the box and stored in as few bits as its
+ * magnitude requires.  Particles are ordered by tag and every frame
+ * other than a keyframe stores the change of each quantized coordinate
+ * since the previous frame, which is small when frames are saved often.
+ * Changes are wrapped across the periodic boundaries and zigzag encoded
+ * s.t. small changes of either sign are small unsigned values.  Values
+ * are then bit packed in blocks of CTRAJ_BLOCK_VALUES, each block using
+ * the width of its largest value.
+ *
+ * Frames are appended and flushed one at a time, s.t. a trajectory can
+ * be read while it's being written; a trailing partial frame is ignored.
+ * Seeking to a frame decodes forward from the preceding keyframe.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "ctraj.h"
+
+#define COORDINATE(vec_p, axis) (((double *)(vec_p))[axis])
+
+static void
+io_fatal(const char *what)
+{
+        Fatal("io error %.100s compressed trajectory; %.200s (errno=%d)",
+              what, strerror(errno), errno);
+}
+
+static ctraj_t *
+make_ctraj(FILE *fp)
+{
+        ctraj_t *traj = XNEW(ctraj_t, 1);
+        XBZERO(ctraj_t, traj, 1);
+        traj->fp = fp;
+        traj->previous_frame = -1;
+        traj->values = CEX_make_array(sizeof(uint32_t), 0);
+        traj->payload = CEX_make_array(1, 0);
+        return traj;
+}
+
+void
+CEX_ctraj_close(ctraj_t *traj)
+{
+        if (traj==NULL) {
+                return;
+        }
+        fclose(traj->fp);
+        if (traj->previous) {
+                CEX_free(traj->previous);
+        }
+        CEX_free_array(traj->values);
+        CEX_free_array(traj->payload);
+        CEX_free_array(traj->offsets);
+        CEX_free_array(traj->cycles);
+        CEX_free_array(traj->keyframes);
+        CEX_free(traj);
+}
+
+
+/* Coding of Values
+ *-----------------*/
+static inline uint32_t
+quantize(double x, double box_size, uint32_t levels)
+{
+        double q = floor(x / box_size * levels);
+        if (q < 0) {
+                return 0;
+        }
+        return q >= levels ? levels - 1 : (uint32_t)q;
+}
+
+/* wrap the change of a quantized coordinate into [-levels/2, levels/2)
+ * and zigzag encode it */
+static inline uint32_t
+encode_delta(uint32_t q, uint32_t previous, uint32_t levels)
+{
+        int64_t half = levels / 2;
+        int64_t d = (int64_t)q - previous;
+        if (d >= (int64_t)levels - half) {
+                d -= levels;
+        } else if (d < -half) {
+                d += levels;
+        }
+        return (uint32_t)(((uint64_t)d << 1) ^ (uint64_t)(d >> 63));
+}
+
+static inline uint32_t
+decode_delta(uint32_t z, uint32_t previous, uint32_t levels)
+{
+        int64_t d = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+        int64_t q = (int64_t)previous + d;
+        if (q < 0) {
+                q += levels;
+        } else if (q >= levels) {
+                q -= levels;
+        }
+        return (uint32_t)q;
+}
+
+/* worst case, every value takes 32 bits */
+#define MAX_PACKED_BYTES(n) (4*(n) + (n)/CTRAJ_BLOCK_VALUES + 1)
+
+static size_t
+pack_values(unsigned char *out, const uint32_t *values, size_t n)
+{
+        unsigned char *start = out;
+        for (size_t i=0; i<n; i+=CTRAJ_BLOCK_VALUES) {
+                size_t count = n-i < CTRAJ_BLOCK_VALUES ? n-i : CTRAJ_BLOCK_VALUES;
+                uint32_t all = 0;
+                for (size_t j=0; j<count; j++) {
+                        all |= values[i+j];
+                }
+                int width = 0;
+                while (width < 32 && (all >> width)) {
+                        width++;
+                }
+                *out++ = width;
+                uint64_t acc = 0;
+                int bits = 0;
+                for (size_t j=0; j<count; j++) {
+                        acc |= (uint64_t)values[i+j] << bits;
+                        bits += width;
+                        while (bits >= 8) {
+                                *out++ = acc & 0xff;
+                                acc >>= 8;
+                                bits -= 8;
+                        }
+                }
+                if (bits > 0) {
+                        *out++ = acc;
+                }
+        }
+        return out - start;
+}
+
+static void
+unpack_values(const unsigned char *in, const unsigned char *end,
+              uint32_t *values, size_t n)
+{
+        for (size_t i=0; i<n; i+=CTRAJ_BLOCK_VALUES) {
+                size_t count = n-i < CTRAJ_BLOCK_VALUES ? n-i : CTRAJ_BLOCK_VALUES;
+                if (unlikely(in >= end)) {
+                        Fatal("truncated compressed frame");
+                }
+                int width = *in++;
+                if (unlikely(width > 32 ||
+                             (size_t)(end - in) < (count * width + 7) / 8)) {
+                        Fatal("corrupt compressed frame");
+                }
+                uint64_t mask = width==32 ? 0xffffffffU : ((uint64_t)1 << width) - 1;
+                uint64_t acc = 0;
+                int bits = 0;
+                for (size_t j=0; j<count; j++) {
+                        while (bits < width) {
+                                acc |= (uint64_t)*in++ << bits;
+                                bits += 8;
+                        }
+                        values[i+j] = acc & mask;
+                        acc >>= width;
+                        bits -= width;
+                }
+        }
+}
+
+
+/* Writing
+ *--------*/
+ctraj_t *
+CEX_ctraj_create(const char *path, vec_t box_size, double precision,
+                 int n_particles, int keyframe_interval)
+{
+        if (!(precision > 0 && precision < 1)) {
+                Fatal("bad precision %.3g; must be in range (0:1)", precision);
+        }
+        double levels = ceil(1.0 / precision);
+        if (levels > (double)(1U << 31)) {
+                Fatal("precision %.3g is too fine", precision);
+        }
+        if (n_particles < 0) {
+                Fatal("bad number of particles %d", n_particles);
+        }
+        if (keyframe_interval <= 0) {
+                Fatal("bad keyframe interval %d", keyframe_interval);
+        }
+        FILE *fp = fopen(path, "wb");
+        if (fp==NULL) {
+                Fatal("failed to open %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+        ctraj_t *traj = make_ctraj(fp);
+        ctraj_file_header_t *header = &traj->header;
+        header->magic = CTRAJ_MAGIC;
+        header->version = CTRAJ_VERSION;
+        header->n_particles = n_particles;
+        header->keyframe_interval = keyframe_interval;
+        for (int axis=0; axis<3; axis++) {
+                header->levels[axis] = (uint32_t)levels;
+                header->box_size[axis] = COORDINATE(&box_size, axis);
+        }
+        if (fwrite(header, sizeof(*header), 1, fp)!=1 || fflush(fp)!=0) {
+                io_fatal("writing");
+        }
+        traj->previous = XNEW(uint32_t, 3*n_particles + 1);
+        return traj;
+}
+
+void
+CEX_ctraj_append(ctraj_t *traj, int64_t cycle, const vec_t *positions)
+{
+        size_t n = traj->header.n_particles;
+        int keyframe = traj->n_frames % traj->header.keyframe_interval == 0;
+        CEX_prealloc_array(traj->values, 3*n);
+        uint32_t *values = ARR_DATA_AS(uint32_t, traj->values);
+        for (int axis=0; axis<3; axis++) {
+                uint32_t levels = traj->header.levels[axis];
+                double box_size = traj->header.box_size[axis];
+                uint32_t *previous = traj->previous + axis*n;
+                uint32_t *axis_values = values + axis*n;
+                for (size_t i=0; i<n; i++) {
+                        uint32_t q = quantize(COORDINATE(&positions[i], axis),
+                                              box_size, levels);
+                        axis_values[i] = encode_delta(q, keyframe ? 0 : previous[i],
+                                                      levels);
+                        previous[i] = q;
+                }
+        }
+        CEX_prealloc_array(traj->payload, MAX_PACKED_BYTES(3*n));
+        ctraj_frame_header_t header;
+        header.magic = CTRAJ_FRAME_MAGIC;
+        header.keyframe = keyframe;
+        header.cycle = cycle;
+        header.payload_bytes = pack_values(ARR_DATA_AS(unsigned char, traj->payload),
+                                           values, 3*n);
+        if (fwrite(&header, sizeof(header), 1, traj->fp)!=1 ||
+            fwrite(ARR_DATA(traj->payload), 1, header.payload_bytes, traj->fp)
+                        !=header.payload_bytes ||
+            fflush(traj->fp)!=0) {
+                io_fatal("writing");
+        }
+        traj->previous_frame = traj->n_frames++;
+}
+
+
+/* Reading
+ *--------*/
+ctraj_t *
+CEX_ctraj_open(const char *path)
+{
+        FILE *fp = fopen(path, "rb");
+        if (fp==NULL) {
+                Fatal("failed to open %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+        ctraj_t *traj = make_ctraj(fp);
+        ctraj_file_header_t *header = &traj->header;
+        if (fread(header, sizeof(*header), 1, fp)!=1) {
+                io_fatal("reading");
+        }
+        if (header->magic!=CTRAJ_MAGIC || header->version!=CTRAJ_VERSION) {
+                Fatal("%.200s isn't a version %u compressed trajectory",
+                      path, CTRAJ_VERSION);
+        }
+        traj->previous = XNEW(uint32_t, 3*header->n_particles + 1);
+        traj->offsets = CEX_make_array(sizeof(int64_t), 0);
+        traj->cycles = CEX_make_array(sizeof(int64_t), 0);
+        traj->keyframes = CEX_make_int_array(0);
+        if (fseeko(fp, 0, SEEK_END)!=0) {
+                io_fatal("seeking");
+        }
+        off_t file_size = ftello(fp);
+        off_t offset = sizeof(*header);
+        for (;;) {
+                ctraj_frame_header_t frame;
+                if (fseeko(fp, offset, SEEK_SET)!=0) {
+                        io_fatal("seeking");
+                }
+                if (fread(&frame, sizeof(frame), 1, fp)!=1) {
+                        break;
+                }
+                if (frame.magic!=CTRAJ_FRAME_MAGIC) {
+                        Fatal("corrupt frame %d in %.200s",
+                              (int)ARR_LENGTH(traj->offsets), path);
+                }
+                off_t end = offset + sizeof(frame) + frame.payload_bytes;
+                if (end > file_size) {
+                        break; /* frame still being written */
+                }
+                ARR_APPEND(int64_t, traj->offsets, offset);
+                ARR_APPEND(int64_t, traj->cycles, frame.cycle);
+                IARR_APPEND(traj->keyframes, frame.keyframe);
+                offset = end;
+        }
+        traj->n_frames = ARR_LENGTH(traj->offsets);
+        return traj;
+}
+
+static void
+decode_frame(ctraj_t *traj, int frame)
+{
+        ctraj_frame_header_t header;
+        if (fseeko(traj->fp, ARR_INDEX_AS(int64_t, traj->offsets, frame), SEEK_SET)!=0 ||
+            fread(&header, sizeof(header), 1, traj->fp)!=1) {
+                io_fatal("reading");
+        }
+        if (!header.keyframe && traj->previous_frame!=frame-1) {
+                Fatal("decoding frame %d without frame %d", frame, frame-1);
+        }
+        CEX_prealloc_array(traj->payload, header.payload_bytes);
+        if (fread(ARR_DATA(traj->payload), 1, header.payload_bytes, traj->fp)
+                        !=header.payload_bytes) {
+                io_fatal("reading");
+        }
+        size_t n = traj->header.n_particles;
+        CEX_prealloc_array(traj->values, 3*n);
+        uint32_t *values = ARR_DATA_AS(uint32_t, traj->values);
+        const unsigned char *payload = ARR_DATA_AS(unsigned char, traj->payload);
+        unpack_values(payload, payload + header.payload_bytes, values, 3*n);
+        for (int axis=0; axis<3; axis++) {
+                uint32_t levels = traj->header.levels[axis];
+                uint32_t *previous = traj->previous + axis*n;
+                uint32_t *axis_values = values + axis*n;
+                for (size_t i=0; i<n; i++) {
+                        previous[i] = decode_delta(axis_values[i],
+                                                   header.keyframe ? 0 : previous[i],
+                                                   levels);
+                }
+        }
+        traj->previous_frame = frame;
+}
+
+int64_t
+CEX_ctraj_read_frame(ctraj_t *traj, int frame, vec_t *positions)
+{
+        if (traj->offsets==NULL) {
+                Fatal("compressed trajectory not opened for reading");
+        }
+        if (frame < 0 || frame >= traj->n_frames) {
+                Fatal("bad frame %d of %d", frame, traj->n_frames);
+        }
+        int start = frame;
+        if (traj->previous_frame==frame) {
+                start = frame + 1; /* already decoded */
+        }
+        while (start > 0 && start <= frame &&
+               !ARR_INDEX_AS(int, traj->keyframes, start) &&
+               start-1 != traj->previous_frame) {
+                start--;
+        }
+        for (int f=start; f<=frame; f++) {
+                decode_frame(traj, f);
+        }
+        size_t n = traj->header.n_particles;
+        for (int axis=0; axis<3; axis++) {
+                double scale = traj->header.box_size[axis] / traj->header.levels[axis];
+                uint32_t *previous = traj->previous + axis*n;
+                for (size_t i=0; i<n; i++) {
+                        COORDINATE(&positions[i], axis) = (previous[i] + 0.5) * scale;
+                }
+        }
+        return ARR_INDEX_AS(int64_t, traj->cycles, frame);
+}
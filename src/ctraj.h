@@ -0,0 +1,89 @@
+/* -*- Mode: c -*-
+ * ctraj.h - Quantized and compressed trajectory files
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CTRAJ_H
+#define _CTRAJ_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "vector.h"
+#include "array.h"
+
+/* file layout shared with pbd.trajectory.  the file header is followed
+ * by any number of frames, each a frame header and its payload */
+#define CTRAJ_MAGIC 0x43444250U /* PBDC */
+#define CTRAJ_FRAME_MAGIC 0x46444250U /* PBDF */
+#define CTRAJ_VERSION 1U
+/* values bit packed with a common width */
+#define CTRAJ_BLOCK_VALUES 64
+
+typedef struct {
+        uint32_t magic, version;
+        uint32_t n_particles;
+        uint32_t keyframe_interval;
+        uint32_t levels[3];     /* quantization levels along each axis */
+        uint32_t pad;
+        double box_size[3];
+} ctraj_file_header_t;
+
+typedef struct {
+        uint32_t magic;
+        uint32_t keyframe;      /* deltas from 0 instead of previous frame */
+        int64_t cycle;
+        uint64_t payload_bytes;
+} ctraj_frame_header_t;
+
+typedef struct {
+        FILE *fp;
+        ctraj_file_header_t header;
+        int n_frames;
+        /* quantized positions of the last frame written or decoded,
+         * all x then all y then all z */
+        uint32_t *previous;
+        int previous_frame;
+        array_t *values;
+        array_t *payload;
+        /* reading only; file offset, cycle and keyframe flag of each frame */
+        array_t *offsets;
+        array_t *cycles;
+        array_t *keyframes;
+} ctraj_t;
+
+/* create a trajectory of `n_particles, quantizing positions to
+ * `precision times the box size along each axis and writing a keyframe
+ * every `keyframe_interval frames */
+ctraj_t *CEX_ctraj_create(const char *path, vec_t box_size, double precision,
+                          int n_particles, int keyframe_interval);
+
+/* append a frame of positions ordered by tag */
+void CEX_ctraj_append(ctraj_t *, int64_t cycle, const vec_t *positions);
+
+/* open a trajectory for reading, locating every complete frame */
+ctraj_t *CEX_ctraj_open(const char *path);
+
+/* decode frame (0 <= frame < n_frames) into positions ordered by tag,
+ * returning its cycle.  decoding starts from the last keyframe at or
+ * before frame unless frame follows the last frame decoded */
+int64_t CEX_ctraj_read_frame(ctraj_t *, int frame, vec_t *positions);
+
+void CEX_ctraj_close(ctraj_t *);
+
+#endif /* _CTRAJ_H */
@@ -0,0 +1,210 @@
+/* -*- Mode: c -*-
+ * driver.c - Standalone entry point running a simulation from files
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Standalone Driver
+ * -------------------------------------------------------------------
+ * Runs a simulation under mpirun without the Python control process
+ *
+ *   cexdrv SYSTEM CONFIGURATION CYCLES OUTPUT [INTERVAL [SEED]]
+ *
+ * SYSTEM holds the fields of the initialize_system command, including
+ * the force tables, and CONFIGURATION holds a raw vec array of the
+ * initial positions.  Both are serialized as messages (see msg.h) and are
+ * written by pbd.driver.  Every thread reads SYSTEM, while only the
+ * master reads CONFIGURATION and scatters the particles over the regular
+ * grid of cells (see grid.h).  Particles are tagged by their index in
+ * CONFIGURATION and the random state of each thread is seeded from SEED
+ * and its rank.
+ *
+ * The master writes the positions of all particles, ordered by tag, to
+ * OUTPUT initially and every INTERVAL cycles (by default only after
+ * all CYCLES), each as a frame of
+ *
+ *   int cycle; double positions[N][3];
+ *
+ * in native byte order.
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "msg.h"
+#include "comm.h"
+#include "bd.h"
+#include "init.h"
+#include "grid.h"
+#include "traj.h"
+
+static int parse_int(const char *arg, const char *name);
+static msg_t *read_msg_file(const char *path);
+static void simulate(int cycles, int interval, int64_t N_particles, const char *path);
+
+int
+main(int argc, char **argv)
+{
+        MPI_Init(&argc, &argv);
+        MPI_Comm_rank(MPI_COMM_WORLD, &CEX_rank);
+        MPI_Comm_size(MPI_COMM_WORLD, &CEX_size);
+        char thread_name[32];
+        if (IS_MASTER()) {
+                snprintf(thread_name, sizeof(thread_name), "master");
+        } else {
+                snprintf(thread_name, sizeof(thread_name), "slave%d", CEX_rank);
+        }
+        CEX_thread_name = thread_name;
+        if (argc<5 || argc>7) {
+                Fatal("usage: %.200s SYSTEM CONFIGURATION CYCLES OUTPUT "
+                      "[INTERVAL [SEED]]", argv[0]);
+        }
+        int cycles = parse_int(argv[3], "cycles");
+        int interval = argc>5 ? parse_int(argv[5], "interval") : cycles;
+        unsigned int seed = argc>6 ? (unsigned int)parse_int(argv[6], "seed") : 0;
+        if (interval < 1) {
+                interval = cycles > 0 ? cycles : 1;
+        }
+
+        msg_t *msg = read_msg_file(argv[1]);
+        CEX_initialize_system(msg);
+        REQ_MSG_EOFP(msg);
+        CEX_free_msg(msg);
+        /* decorrelate the random streams of the threads */
+        CEX_setup_random(seed + 0x9E3779B9U * (unsigned int)CEX_rank);
+
+        array_t *positions = NULL;
+        if (IS_MASTER()) {
+                msg = read_msg_file(argv[2]);
+                positions = CEX_msg_read_raw_vec_array(msg);
+                REQ_MSG_EOFP(msg);
+                CEX_free_msg(msg);
+        }
+        int64_t N_particles = CEX_scatter_grid_cells(
+                positions ? ARR_DATA(positions) : NULL,
+                positions ? ARR_LENGTH(positions) : 0);
+        if (positions) {
+                CEX_free_array(positions);
+        }
+
+        simulate(cycles, interval, N_particles, argv[4]);
+        MPI_Finalize();
+        return 0;
+}
+
+static int
+parse_int(const char *arg, const char *name)
+{
+        char *end;
+        errno = 0;
+        long value = strtol(arg, &end, 0);
+        if (errno!=0 || *arg=='\0' || *end!='\0' || value < 0 || value > 0x7fffffffL) {
+                Fatal("bad %s '%.50s'", name, arg);
+        }
+        return (int)value;
+}
+
+static msg_t *
+read_msg_file(const char *path)
+{
+        FILE *fp = fopen(path, "rb");
+        if (fp==NULL) {
+                Fatal("failed to open %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+        array_t *buffer = CEX_make_char_array(4096);
+        size_t n_read;
+        do {
+                CEX_prealloc_array(buffer, ARR_LENGTH(buffer) + 4096);
+                n_read = fread(ARR_DATA_AS(char, buffer) + ARR_LENGTH(buffer), 1,
+                               ARR_ALLOCED(buffer) - ARR_LENGTH(buffer), fp);
+                ARR_LENGTH(buffer) += n_read;
+        } while (n_read!=0);
+        if (ferror(fp)) {
+                Fatal("io error reading %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+        fclose(fp);
+        size_t length = ARR_LENGTH(buffer);
+        msg_t *msg = CEX_make_read_msg(buffer);
+        MSG_END(msg) = MSG_START(msg) + length;
+        return msg;
+}
+
+
+/* Output */
+static void
+write_frame(FILE *fp, const char *path, int cycle, int64_t N_particles)
+{
+        static array_t *frame=NULL;
+
+        if (IS_MASTER() && frame==NULL) {
+                frame = CEX_make_vec_array(N_particles);
+        }
+        int64_t total = CEX_gather_positions_by_tag(frame);
+        if (!IS_MASTER()) {
+                return;
+        }
+        if (total!=N_particles) {
+                Fatal("gathered %lld particles; expected %lld",
+                      (long long)total, (long long)N_particles);
+        }
+        if (fwrite(&cycle, sizeof(int), 1, fp)!=1 ||
+            fwrite(ARR_DATA(frame), sizeof(vec_t), N_particles, fp)!=(size_t)N_particles ||
+            fflush(fp)!=0) {
+                Fatal("io error writing %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+}
+
+static void
+simulate(int cycles, int interval, int64_t N_particles, const char *path)
+{
+        FILE *fp = NULL;
+        if (IS_MASTER()) {
+                fp = fopen(path, "wb");
+                if (fp==NULL) {
+                        Fatal("failed to open %.200s; %.200s (errno=%d)",
+                              path, strerror(errno), errno);
+                }
+        }
+        write_frame(fp, path, 0, N_particles);
+        double start = MPI_Wtime();
+        for (int cycle=0; cycle<cycles;) {
+                int n = cycles - cycle < interval ? cycles - cycle : interval;
+                if (IS_MASTER()) {
+                        CEX_master_simulate_cycles(n);
+                } else {
+                        CEX_slave_simulation_loop();
+                }
+                cycle += n;
+                write_frame(fp, path, cycle, N_particles);
+        }
+        if (IS_MASTER()) {
+                double elapsed = MPI_Wtime() - start;
+                xprintf("simulated %d cycles of %lld particles in %.3f s (%.1f cycles/s)",
+                        cycles, (long long)N_particles, elapsed,
+                        elapsed > 0 ? cycles / elapsed : 0.0);
+                fclose(fp);
+        }
+}
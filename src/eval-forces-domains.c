@@ -0,0 +1,187 @@
+
+/* Thread Domains
+ * The cell of this process is further divided into one domain for
+ * each OpenMP thread, s.t. each thread evaluates the forces on the
+ * particles within its own domain much as each process does for its
+ * own cell.  Domains are slabs along the longest axis of the cell
+ * holding equal numbers of particles, and are reassigned whenever
+ * neighbor lists are rebuilt.  As all threads share CEX_positions, a
+ * thread reads the positions in neighboring domains directly instead
+ * of exchanging them.
+ *
+ * Each domain has two lists of neighbor pairs
+ *
+ *   o Pairs within the domain, whose force is applied to both particles
+ *
+ *   o Pairs of a particle within the domain and a particle from another
+ *     domain or an external particle, whose force is only applied to
+ *     the particle within the domain
+ *
+ * s.t. no two threads write the force of the same particle and the only
+ * synchronization is the barrier ending the force evaluation.
+ */
+
+static int N_domains=0;
+static array_t *domain_pairs=NULL;
+static array_t *domain_one_sided_pairs=NULL;
+static array_t *particle_domains=NULL;
+static array_t *domain_coordinates=NULL;
+
+#define GET_DOMAIN_PAIRS(domain) \
+        ARR_INDEX_AS(array_t *, domain_pairs, domain)
+#define GET_DOMAIN_ONE_SIDED_PAIRS(domain) \
+        ARR_INDEX_AS(array_t *, domain_one_sided_pairs, domain)
+#define PARTICLE_DOMAIN(inx) ARR_INDEX_AS(int, particle_domains, inx)
+
+static void allocate_domains(int n_domains);
+static void assign_domains(void);
+
+static void
+setup_force_aux(void)
+{
+        allocate_domains(omp_get_max_threads());
+        assign_domains();
+        for (int n_counter=ARR_LENGTH(CEX_internal_neighbors) >> 1,
+                *n_ptr=ARR_DATA_AS(int, CEX_internal_neighbors);
+             n_counter -- > 0;) {
+                int part_i = *(n_ptr++);
+                int part_j = *(n_ptr++);
+                int domain_i = PARTICLE_DOMAIN(part_i);
+                int domain_j = PARTICLE_DOMAIN(part_j);
+                if (domain_i==domain_j) {
+                        array_t *pairs = GET_DOMAIN_PAIRS(domain_i);
+                        IARR_APPEND(pairs, part_i);
+                        IARR_APPEND(pairs, part_j);
+                } else {
+                        array_t *pairs_i = GET_DOMAIN_ONE_SIDED_PAIRS(domain_i);
+                        array_t *pairs_j = GET_DOMAIN_ONE_SIDED_PAIRS(domain_j);
+                        IARR_APPEND(pairs_i, part_i);
+                        IARR_APPEND(pairs_i, part_j);
+                        IARR_APPEND(pairs_j, part_j);
+                        IARR_APPEND(pairs_j, part_i);
+                }
+        }
+        for (int n_counter=ARR_LENGTH(CEX_external_neighbors) >> 1,
+                *n_ptr=ARR_DATA_AS(int, CEX_external_neighbors);
+             n_counter -- > 0;) {
+                int i_inner = *(n_ptr++);
+                int i_ext = *(n_ptr++);
+                array_t *pairs = GET_DOMAIN_ONE_SIDED_PAIRS(PARTICLE_DOMAIN(i_inner));
+                IARR_APPEND(pairs, i_inner);
+                IARR_APPEND(pairs, i_ext);
+        }
+}
+
+static void
+allocate_domains(int n_domains)
+{
+        if (domain_pairs==NULL) {
+                domain_pairs = CEX_make_array(sizeof(array_t *), 0);
+                domain_one_sided_pairs = CEX_make_array(sizeof(array_t *), 0);
+                particle_domains = CEX_make_int_array(0);
+                domain_coordinates = CEX_make_array(sizeof(double), 0);
+        }
+        while (ARR_LENGTH(domain_pairs) < n_domains) {
+                ARR_APPEND(array_t *, domain_pairs, CEX_make_int_array(0));
+                ARR_APPEND(array_t *, domain_one_sided_pairs, CEX_make_int_array(0));
+        }
+        if (n_domains!=N_domains) {
+                xprintf("evaluating forces in %d thread domains", n_domains);
+        }
+        N_domains = n_domains;
+        for (int domain=0; domain<N_domains; domain++) {
+                clear_array(GET_DOMAIN_PAIRS(domain));
+                clear_array(GET_DOMAIN_ONE_SIDED_PAIRS(domain));
+        }
+}
+
+static int
+cmp_coordinates(const double *a, const double *b)
+{
+        return (*a > *b) - (*a < *b);
+}
+
+/* divide the longest axis of the cell s.t. each domain holds an equal
+ * number of internal particles */
+static void
+assign_domains(void)
+{
+        int axis = AXIS_X;
+        vec_t width;
+        Vec3_SUB(width, CEX_this_cell->max_extent, CEX_this_cell->min_extent);
+        if (INDEX_AXIS(&width, AXIS_Y) > INDEX_AXIS(&width, axis)) {
+                axis = AXIS_Y;
+        }
+        if (INDEX_AXIS(&width, AXIS_Z) > INDEX_AXIS(&width, axis)) {
+                axis = AXIS_Z;
+        }
+        int N = CEX_N_internal_particles;
+        CEX_prealloc_array(domain_coordinates, N);
+        ARR_LENGTH(domain_coordinates) = N;
+        double *coordinates = ARR_DATA_AS(double, domain_coordinates);
+        for (int i=0; i<N; i++) {
+                coordinates[i] = INDEX_AXIS(&ARR_INDEX_AS(vec_t, CEX_positions, i), axis);
+        }
+        qsort(coordinates, N, sizeof(double),
+              (int (*)(const void *, const void *))cmp_coordinates);
+        /* lower bound of each domain after the first */
+        double bounds[N_domains];
+        for (int domain=1; domain<N_domains; domain++) {
+                bounds[domain] = N ? coordinates[(long)domain * N / N_domains] : 0;
+        }
+        CEX_prealloc_array(particle_domains, N);
+        ARR_LENGTH(particle_domains) = N;
+        for (int i=0; i<N; i++) {
+                double x = INDEX_AXIS(&ARR_INDEX_AS(vec_t, CEX_positions, i), axis);
+                int domain = 0;
+                while (domain < N_domains-1 && x >= bounds[domain+1]) {
+                        domain++;
+                }
+                PARTICLE_DOMAIN(i) = domain;
+        }
+}
+
+static void
+evaluate_forces(void)
+{
+        _SETUP_FORCE_LOCALS
+        XBZERO(vec_t, _forces, CEX_N_internal_particles);
+        #pragma omp parallel for schedule(static, 1) \
+                firstprivate(r_pair_cutoff_sqr, _box_size, _box_half, _positions, _forces, \
+                             _linterp_x_min, _inv_linterp_x_prec, _linterp_table)
+        for (int domain=0; domain<N_domains; domain++) {
+                array_t *pairs = GET_DOMAIN_PAIRS(domain);
+                for (int n_counter=ARR_LENGTH(pairs) >> 1,
+                        *n_ptr=ARR_DATA_AS(int, pairs);
+                     n_counter -- > 0;) {
+                        int part_i = *(n_ptr++);
+                        int part_j = *(n_ptr++);
+                        vec_t r;
+                        _PER_SEP(r, _positions[part_i], _positions[part_j]);
+                        double rsqr = Vec3_SQR(r);
+                        if (rsqr<r_pair_cutoff_sqr) {
+                                double force_div_rlen = _INTERPOLATE_FORCE(sqrt(rsqr));
+                                vec_t force;
+                                Vec3_MUL(force, r, force_div_rlen);
+                                Vec3_SUBTO(_forces[part_i], force);
+                                Vec3_ADDTO(_forces[part_j], force);
+                        }
+                }
+                pairs = GET_DOMAIN_ONE_SIDED_PAIRS(domain);
+                for (int n_counter=ARR_LENGTH(pairs) >> 1,
+                        *n_ptr=ARR_DATA_AS(int, pairs);
+                     n_counter -- > 0;) {
+                        int part_i = *(n_ptr++); /* within domain */
+                        int part_j = *(n_ptr++);
+                        vec_t r;
+                        _PER_SEP(r, _positions[part_i], _positions[part_j]);
+                        double rsqr = Vec3_SQR(r);
+                        if (rsqr<r_pair_cutoff_sqr) {
+                                double force_div_rlen = _INTERPOLATE_FORCE(sqrt(rsqr));
+                                vec_t force;
+                                Vec3_MUL(force, r, force_div_rlen);
+                                Vec3_SUBTO(_forces[part_i], force);
+                        }
+                }
+        }
+}
@@ -89,19 +89,14 @@ nlen(int part_i)
 
 
 static void
-evaluate_forces(void)
+evaluate_block_forces(int block)
 {
         _SETUP_FORCE_LOCALS
-        XBZERO(vec_t, _forces, CEX_N_internal_particles);
-        /* loop over all neighbors */
-        #pragma omp parallel for schedule(static) \
-                firstprivate(r_pair_cutoff_sqr, _box_size, _box_half, _positions, _forces, \
-                             _linterp_x_min, _inv_linterp_x_prec, _linterp_table) 
-        for (int i=0; i<CEX_N_internal_particles; i++) {
+        for (int b_inx=BLOCK_START(block); b_inx<BLOCK_END(block); b_inx++) {
+                int i = ARR_INDEX_AS(int, block_particles, b_inx);
                 vec_t pos_i = _positions[i], sum_force={0,0,0};
                 int *ptr = ARR_INDEX_AS(int*, neighbor_offsets, i);
                 for (int len=*(ptr++); len-- > 0; ) {
-                        //xprintf("%d %d", i, len);
                         int neighbor_index = *(ptr++);
                         vec_t r;
                         _PER_SEP(r, pos_i, _positions[neighbor_index]);
@@ -116,3 +111,17 @@ evaluate_forces(void)
                 _forces[i] = sum_force;
         }
 }
+
+/* each block of the binning grid is a task, s.t. threads that finish
+ * sparse blocks take up the remaining blocks of dense regions */
+static void
+evaluate_forces(void)
+{
+        int n_blocks = N_BLOCKS();
+        #pragma omp parallel
+        #pragma omp single
+        for (int block=0; block<n_blocks; block++) {
+                #pragma omp task firstprivate(block)
+                evaluate_block_forces(block);
+        }
+}
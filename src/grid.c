@@ -0,0 +1,413 @@
+/* -*- Mode: c -*-
+ * grid.c - Regular grid of cells derived on every thread
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Every thread derives the same grid of cells, junctions them and
+ * orders their communications as pbd.cells and pbd.sim do, s.t. a
+ * simulation is set up from positions alone without the control process
+ * partitioning them.
+ */
+
+#include <mpi.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "periodic.h"
+#include "cells.h"
+#include "bd.h"
+#include "init.h"
+#include "grid.h"
+
+/* Grid of Cells
+ * Space is divided into the most uniform grid of one cell per thread,
+ * s.t. the cell with grid index (x,y,z) is simulated by thread
+ * (x*divs[y] + y)*divs[z] + z
+ */
+static int divs[3];
+
+#define GRID_RANK(x, y, z) (((x)*divs[AXIS_Y] + (y))*divs[AXIS_Z] + (z))
+
+static void
+find_divisions(int size)
+{
+        long best = -1;
+        for (int x=1; x<=size; x++) {
+                for (int y=1; x*y<=size; y++) {
+                        if (size % (x*y)) {
+                                continue;
+                        }
+                        int z = size / (x*y);
+                        /* proportional to variance of divisions */
+                        long spread = 3L*(x*x + y*y + z*z) - (long)(x+y+z)*(x+y+z);
+                        if (best < 0 || spread < best) {
+                                best = spread;
+                                divs[AXIS_X] = x;
+                                divs[AXIS_Y] = y;
+                                divs[AXIS_Z] = z;
+                        }
+                }
+        }
+}
+
+static void
+grid_cell_extent(int rank, vec_t *min_extent, vec_t *max_extent)
+{
+        int index[3];
+        index[AXIS_Z] = rank % divs[AXIS_Z];
+        index[AXIS_Y] = (rank / divs[AXIS_Z]) % divs[AXIS_Y];
+        index[AXIS_X] = rank / (divs[AXIS_Z] * divs[AXIS_Y]);
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                double box = INDEX_AXIS(&CEX_box_size, axis);
+                INDEX_AXIS(min_extent, axis) = ((double)index[axis] / divs[axis]) * box;
+                INDEX_AXIS(max_extent, axis) = ((double)(index[axis]+1) / divs[axis]) * box;
+        }
+}
+
+static int
+grid_rank_containing(vec_t position)
+{
+        int index[3];
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                double x = INDEX_AXIS(&position, axis);
+                double box = INDEX_AXIS(&CEX_box_size, axis);
+                if (!(x >= 0 && x < box)) {
+                        Fatal("position " Vec3_FRMT("%.3f") " (nm) outside of box",
+                              Vec3_ARGS_SCALED((1.0/CEX_nm), position));
+                }
+                index[axis] = (int)floor((x / box) * divs[axis]);
+                if (index[axis] >= divs[axis]) {
+                        index[axis] = divs[axis] - 1;
+                }
+        }
+        return GRID_RANK(index[AXIS_X], index[AXIS_Y], index[AXIS_Z]);
+}
+
+/* gap and overlap between two intervals along a periodic axis */
+static void
+axis_separation(double min_i, double max_i, double min_j, double max_j,
+                double length, double *gap, double *overlap)
+{
+        *gap = length;
+        *overlap = 0;
+        for (int shift=-1; shift<=1; shift++) {
+                double lower = fmax(min_i, min_j + shift*length);
+                double upper = fmin(max_i, max_j + shift*length);
+                *gap = fmin(*gap, fmax(0, lower - upper));
+                *overlap = fmax(*overlap, upper - lower);
+        }
+}
+
+/* number of axes along which two cells overlap if they are
+ * junctioned, otherwise -1 */
+static int
+junction_overlap(int rank_i, int rank_j)
+{
+        vec_t min_i, max_i, min_j, max_j;
+        grid_cell_extent(rank_i, &min_i, &max_i);
+        grid_cell_extent(rank_j, &min_j, &max_j);
+        double distance_sqr = 0;
+        int n_overlap = 0;
+        for (int axis=AXIS_X; axis<=AXIS_Z; axis++) {
+                double gap, overlap;
+                axis_separation(INDEX_AXIS(&min_i, axis), INDEX_AXIS(&max_i, axis),
+                                INDEX_AXIS(&min_j, axis), INDEX_AXIS(&max_j, axis),
+                                INDEX_AXIS(&CEX_box_size, axis), &gap, &overlap);
+                distance_sqr += gap * gap;
+                n_overlap += overlap > 0;
+        }
+        return distance_sqr <= CEX_r_neighbor_sqr ? n_overlap : -1;
+}
+
+typedef struct {
+        int rank_i, rank_j; /* rank_i < rank_j */
+        int round;
+} link_t;
+
+/* Communication rules, as calculated by pbd.cells, pair each junctioned
+ * cell with at most one other cell in each round of communication,
+ * taking links with the most overlap first.  Rounds are then ordered
+ * from most to least links.  Links are considered in order of rank
+ * s.t. every thread derives the same rules */
+static array_t *
+calculate_rounds(int *n_rounds_p)
+{
+        array_t *links = CEX_make_array(sizeof(link_t), 0);
+        for (int n_overlap=3; n_overlap>=0; n_overlap--) {
+                for (int i=0; i<CEX_size; i++) {
+                        for (int j=i+1; j<CEX_size; j++) {
+                                if (junction_overlap(i, j)==n_overlap) {
+                                        link_t link = {i, j, -1};
+                                        ARR_APPEND(link_t, links, link);
+                                }
+                        }
+                }
+        }
+        int n_links = ARR_LENGTH(links);
+        int *busy = XNEW(int, CEX_size);
+        int n_rounds = 0, in_round = 0, assigned = 0;
+        XBZERO(int, busy, CEX_size);
+        while (assigned < n_links) {
+                link_t *next = NULL, *link; int counter;
+                ARR_FOREACH(link_t, links, link, counter) {
+                        if (link->round==-1 && !busy[link->rank_i] && !busy[link->rank_j]) {
+                                next = link;
+                                break;
+                        }
+                }
+                if (next==NULL) {
+                        /* start another round, everyone is busy */
+                        n_rounds++;
+                        in_round = 0;
+                        XBZERO(int, busy, CEX_size);
+                        continue;
+                }
+                next->round = n_rounds;
+                busy[next->rank_i] = busy[next->rank_j] = 1;
+                in_round++;
+                assigned++;
+        }
+        if (in_round) {
+                n_rounds++;
+        }
+        CEX_free(busy);
+        *n_rounds_p = n_rounds;
+        return links;
+}
+
+static void
+append_rule(array_t *rules, int inst, comm_t *comm, int tag)
+{
+        comm_rule_t rule;
+        rule.inst = inst;
+        rule.comm = comm;
+        rule.tag = tag;
+        ARR_APPEND(comm_rule_t, rules, rule);
+}
+
+/* set up this thread as its cell of the grid, with the given internal
+ * particles */
+static void
+setup_grid_cell(array_t *positions, array_t *tags)
+{
+        vec_t min_extent, max_extent;
+        grid_cell_extent(CEX_rank, &min_extent, &max_extent);
+        CEX_setup_cell_state(min_extent, max_extent, positions, tags);
+
+        /* communicators for junctioned cells, ordered by rank */
+        array_t *comms = CEX_make_array(sizeof(comm_t), 0);
+        int comm_indices[CEX_size];
+        for (int rank=0; rank<CEX_size; rank++) {
+                comm_indices[rank] = -1;
+                if (rank!=CEX_rank && junction_overlap(CEX_rank, rank) >= 0) {
+                        comm_t comm;
+                        comm.comm_rank = rank;
+                        comm.arr_inx = comm_indices[rank] = ARR_LENGTH(comms);
+                        comm.current_rule = NULL;
+#ifdef MPI_SHARED_MEMORY_HALOS
+                        comm.node_rank = -1;
+#endif
+                        ARR_APPEND(comm_t, comms, comm);
+                }
+        }
+#define RANK_COMM(rank) ((comm_t *)ARR_ADDRESS_ELEMENT(comms, comm_indices[rank]))
+
+        /* rules for the links of this cell */
+        int n_rounds;
+        array_t *links = calculate_rounds(&n_rounds);
+        int round_lengths[n_rounds+1];
+        for (int round=0; round<n_rounds; round++) {
+                round_lengths[round] = 0;
+        }
+        link_t *link; int counter;
+        ARR_FOREACH(link_t, links, link, counter) {
+                round_lengths[link->round]++;
+        }
+        array_t *rules = CEX_make_array(sizeof(comm_rule_t), 0);
+        int tag = 1;
+        for (int length=CEX_size; length>0; length--) {
+                for (int round=0; round<n_rounds; round++) {
+                        if (round_lengths[round]!=length) {
+                                continue;
+                        }
+                        ARR_FOREACH(link_t, links, link, counter) {
+                                if (link->round!=round) {
+                                        continue;
+                                }
+                                if (link->rank_i==CEX_rank) {
+                                        append_rule(rules, COMM_INST_SEND, RANK_COMM(link->rank_j), tag);
+                                        append_rule(rules, COMM_INST_RECV, RANK_COMM(link->rank_j), tag+1);
+                                } else if (link->rank_j==CEX_rank) {
+                                        append_rule(rules, COMM_INST_RECV, RANK_COMM(link->rank_i), tag);
+                                        append_rule(rules, COMM_INST_SEND, RANK_COMM(link->rank_i), tag+1);
+                                }
+                                tag += 2;
+                        }
+                }
+        }
+        CEX_free_array(links);
+        CEX_setup_cell_comm(comms, rules);
+
+        array_t *jcells = CEX_make_array(sizeof(cell_t), 0);
+        comm_t *comm;
+        COMM_FOREACH(comm, counter) {
+                cell_t jcell;
+                jcell.comm = comm;
+                grid_cell_extent(comm->comm_rank, &jcell.min_extent, &jcell.max_extent);
+                ARR_APPEND(cell_t, jcells, jcell);
+        }
+        CEX_setup_cell_junctions(jcells);
+#undef RANK_COMM
+}
+
+
+/* Scattering Particles
+ * The master divides the particles into equal consecutive blocks, one
+ * for each thread.  Each thread finds the cell containing each particle
+ * of its block, and all threads then exchange their particles by cell
+ * in a single all-to-all.  As blocks are consecutive and recieved in
+ * order of rank, each thread's particles remain ordered by tag.
+ */
+typedef struct {
+        tag_t tag;
+        vec_t position;
+} grid_record_t;
+
+int64_t
+CEX_scatter_grid_cells(const vec_t *all_positions, int64_t n_particles)
+{
+        find_divisions(CEX_size);
+        MPI_Bcast(&n_particles, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+        if (IS_MASTER()) {
+                xprintf("initializing cells for n=%d with dimensions %dx%dx%d",
+                        CEX_size, divs[AXIS_X], divs[AXIS_Y], divs[AXIS_Z]);
+        }
+
+        /* counts and displacements are in records, not bytes */
+        MPI_Datatype vec_type = CEX_record_datatype(sizeof(vec_t));
+        MPI_Datatype record_type = CEX_record_datatype(sizeof(grid_record_t));
+        int counts[CEX_size], displs[CEX_size];
+        for (int rank=0; rank<CEX_size; rank++) {
+                int64_t first = n_particles * rank / CEX_size;
+                int64_t last = n_particles * (rank+1) / CEX_size;
+                counts[rank] = CEX_mpi_count(last - first);
+                displs[rank] = CEX_mpi_count(first);
+        }
+        tag_t first_tag = displs[CEX_rank];
+        int n_block = counts[CEX_rank];
+        vec_t *block = XNEW(vec_t, n_block > 0 ? n_block : 1);
+        MPI_Scatterv((void *)all_positions, counts, displs, vec_type,
+                     block, n_block, vec_type, 0, MPI_COMM_WORLD);
+
+        int *destinations = XNEW(int, n_block > 0 ? n_block : 1);
+        for (int rank=0; rank<CEX_size; rank++) {
+                counts[rank] = 0;
+        }
+        for (int i=0; i<n_block; i++) {
+                destinations[i] = grid_rank_containing(block[i]);
+                counts[destinations[i]] ++;
+        }
+        int offset = 0;
+        for (int rank=0; rank<CEX_size; rank++) {
+                displs[rank] = offset;
+                offset += counts[rank];
+        }
+        grid_record_t *send_records = XNEW(grid_record_t, n_block > 0 ? n_block : 1);
+        for (int i=0; i<n_block; i++) {
+                grid_record_t *record = &send_records[displs[destinations[i]]++];
+                record->tag = first_tag + i;
+                record->position = block[i];
+        }
+        CEX_free(destinations);
+        CEX_free(block);
+        for (int rank=0; rank<CEX_size; rank++) {
+                displs[rank] -= counts[rank];
+        }
+
+        int recv_counts[CEX_size], recv_displs[CEX_size];
+        MPI_Alltoall(counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+        int64_t n_recv = 0;
+        for (int rank=0; rank<CEX_size; rank++) {
+                recv_displs[rank] = CEX_mpi_count(n_recv);
+                n_recv += recv_counts[rank];
+        }
+        int n_internal = CEX_mpi_count(n_recv);
+        grid_record_t *recv_records = XNEW(grid_record_t, n_internal > 0 ? n_internal : 1);
+        MPI_Alltoallv(send_records, counts, displs, record_type,
+                      recv_records, recv_counts, recv_displs, record_type,
+                      MPI_COMM_WORLD);
+        CEX_free(send_records);
+
+        array_t *positions = CEX_make_vec_array(n_internal);
+        CEX_align_array(positions, sizeof(double));
+        array_t *tags = CEX_make_array(sizeof(tag_t), n_internal);
+        CEX_align_array(tags, sizeof(tag_t));
+        for (int i=0; i<n_internal; i++) {
+                VARR_APPEND(positions, recv_records[i].position);
+                ARR_APPEND(tag_t, tags, recv_records[i].tag);
+        }
+        CEX_free(recv_records);
+        setup_grid_cell(positions, tags);
+        return n_particles;
+}
+
+int64_t
+CEX_scatter_grid_cells_from_file(const char *path)
+{
+        const vec_t *all_positions = NULL;
+        size_t size = 0;
+        int64_t n_particles = 0;
+        if (IS_MASTER()) {
+                int fd = open(path, O_RDONLY);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0) {
+                        Fatal("failed to open %.200s; %.200s (errno=%d)",
+                              path, strerror(errno), errno);
+                }
+                size = st.st_size;
+                if (size % sizeof(vec_t)) {
+                        Fatal("%.200s of %lu bytes isn't an array of positions",
+                              path, (unsigned long)size);
+                }
+                n_particles = size / sizeof(vec_t);
+                if (size) {
+                        all_positions = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                        if (all_positions==MAP_FAILED) {
+                                Fatal("failed to map %.200s; %.200s (errno=%d)",
+                                      path, strerror(errno), errno);
+                        }
+                }
+                close(fd);
+        }
+        n_particles = CEX_scatter_grid_cells(all_positions, n_particles);
+        if (all_positions!=NULL) {
+                munmap((void *)all_positions, size);
+        }
+        return n_particles;
+}
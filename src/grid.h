@@ -0,0 +1,40 @@
+/* -*- Mode: c -*-
+ * grid.h - Regular grid of cells derived on every thread
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _GRID_H
+#define _GRID_H
+
+#include <stdint.h>
+
+#include "opt.h"
+
+/* divide space into the most uniform grid of one cell per thread, as
+ * pbd.cells does by default, and set up this thread as its cell.  the
+ * master is given the positions of all `n_particles, which it scatters
+ * to their cells, tagging each by its index.  returns the number of
+ * particles on every thread.  collective; requires the random state */
+int64_t CEX_scatter_grid_cells(const vec_t *all_positions, int64_t n_particles);
+
+/* as CEX_scatter_grid_cells, with the master mapping the positions from
+ * `path (only significant on the master), a file of native doubles
+ * holding 3 per particle */
+int64_t CEX_scatter_grid_cells_from_file(const char *path);
+
+#endif /* _GRID_H */
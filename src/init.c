@@ -77,6 +77,12 @@ check_int(const char *name, int index, int value, int mn, int mx)
         return VALUE_CHECK("%d");
 }
 
+static inline long long
+check_long(const char *name, int index, long long value, long long mn, long long mx)
+{
+        return VALUE_CHECK("%lld");
+}
+
 static inline double
 check_double(const char *name, int index, double value, double mn, double mx)
 {
@@ -118,18 +124,29 @@ static inline array_t *
 read_int_array(msg_t *msg, const char *name, int mn, int mx)
 {
         check_name(msg, name);
-        array_t *arr = CEX_msg_read_int_array(msg);
+        array_t *arr = CEX_msg_read_raw_int_array(msg);
         for (int i=0; i<ARR_LENGTH(arr); i++) {
                 check_int(name, i, ARR_INDEX_AS(int, arr, i), mn, mx);
         }
         return arr;
 }
 
+static inline array_t *
+read_tag_array(msg_t *msg, const char *name)
+{
+        check_name(msg, name);
+        array_t *arr = CEX_msg_read_raw_int64_array(msg);
+        for (int i=0; i<ARR_LENGTH(arr); i++) {
+                check_long(name, i, ARR_INDEX_AS(tag_t, arr, i), 0, CEX_MAX_TAG);
+        }
+        return arr;
+}
+
 static inline array_t *
 read_double_array(msg_t *msg, const char *name, double mn, double mx)
 {
         check_name(msg, name);
-        array_t *arr = CEX_msg_read_double_array(msg);
+        array_t *arr = CEX_msg_read_raw_double_array(msg);
         for (int i=0; i<ARR_LENGTH(arr); i++) {
                 check_double(name, i, ARR_INDEX_AS(double, arr, i), mn, mx);
         }
@@ -156,7 +173,7 @@ static inline array_t *
 read_vec_array(msg_t *msg, const char *name, vec_t mn, vec_t mx)
 {
         check_name(msg, name);
-        array_t *arr = CEX_msg_read_vec_array(msg);
+        array_t *arr = CEX_msg_read_raw_vec_array(msg);
         for (int i=0; i<ARR_LENGTH(arr); i++) {
                 check_vec(name, i, ARR_INDEX_AS(vec_t, arr, i), mn, mx);
         }
@@ -212,7 +229,13 @@ void
 CEX_initialize_random(msg_t *msg)
 {
         REQ_STATE("system");
-        unsigned int seed = CEX_msg_read_uint(msg);
+        CEX_setup_random(CEX_msg_read_uint(msg));
+}
+
+void
+CEX_setup_random(unsigned int seed)
+{
+        REQ_STATE("system");
         CEX_seed_random(seed);
         vec_t pull;
         CEX_generate_gauss_vector(&pull, 1.0);
@@ -226,30 +249,51 @@ read_extent(msg_t *msg, const char *name)
 {
        vec_t vzero;
        Vec3_SETALL(vzero, 0);
-       return read_vec(msg, name, vzero, CEX_box_size);
+       /* sent as a raw vec array of one element, s.t. extents are as
+        * exact as the positions checked against them */
+       check_name(msg, name);
+       array_t *arr = CEX_msg_read_raw_vec_array(msg);
+       if (ARR_LENGTH(arr) != 1) {
+               Fatal("expected a single vector for %s; given %lu",
+                     name, (unsigned long)ARR_LENGTH(arr));
+       }
+       vec_t extent = ARR_INDEX_AS(vec_t, arr, 0);
+       CEX_free_array(arr);
+       return check_vec(name, -1, extent, vzero, CEX_box_size);
 }
 
 void
 CEX_initialize_cell_state(msg_t *msg)
+{
+        REQ_STATE("random");
+        vec_t min_extent = read_extent(msg, "min_extent");
+        vec_t max_extent = read_extent(msg, "max_extent");
+        array_t *positions = read_vec_array(msg, "positions", min_extent, max_extent);
+        array_t *tags = read_tag_array(msg, "tags");
+        CEX_setup_cell_state(min_extent, max_extent, positions, tags);
+}
+
+void
+CEX_setup_cell_state(vec_t min_extent, vec_t max_extent,
+                     array_t *positions, array_t *tags)
 {
         REQ_STATE("random");
         CEX_this_cell = XNEW(cell_t, 1);
         CEX_this_cell->comm = NULL;
-        CEX_this_cell->min_extent = read_extent(msg, "min_extent");
-        CEX_this_cell->max_extent = read_extent(msg, "max_extent");
-        array_t *positions = read_vec_array(msg, "positions",  
-                                            CEX_this_cell->min_extent, 
-                                            CEX_this_cell->max_extent);
-        array_t *tags = read_int_array(msg, "tags", 0, 10000000);
+        CEX_this_cell->min_extent = min_extent;
+        CEX_this_cell->max_extent = max_extent;
         if (ARR_LENGTH(positions) != ARR_LENGTH(tags)) {
                 Fatal("inconsistent positions and tags length: %lu and %lu respectively",
                       ARR_LENGTH(positions), ARR_LENGTH(tags));
         }
+        if (ARR_EL_SIZE(tags) != sizeof(tag_t)) {
+                Fatal("tags of %lu bytes; must be tag_t", (unsigned long)ARR_EL_SIZE(tags));
+        }
         CEX_N_internal_particles = ARR_LENGTH(positions);
         CEX_positions = positions;
         CEX_new_positions = CEX_make_vec_array(CEX_N_internal_particles);
         CEX_tags = tags;
-        CEX_align_array(CEX_tags, sizeof(int));
+        CEX_align_array(CEX_tags, sizeof(tag_t));
         CEX_forces = CEX_make_vec_array(CEX_N_internal_particles);
         CEX_align_array(CEX_forces, sizeof(double));
         CEX_random_vectors = CEX_make_vec_array(CEX_N_internal_particles);
@@ -259,6 +303,9 @@ CEX_initialize_cell_state(msg_t *msg)
         ARR_LENGTH(CEX_forces) = CEX_N_internal_particles;
         ARR_LENGTH(CEX_random_vectors) = CEX_N_internal_particles;
         ARR_LENGTH(CEX_nl_displace) = CEX_N_internal_particles;
+        CEX_images = CEX_make_array(sizeof(image_t), CEX_N_internal_particles);
+        ARR_LENGTH(CEX_images) = CEX_N_internal_particles;
+        CEX_zero_array_elements(CEX_images);
         CEX_internal_neighbors = CEX_make_int_array(2*CEX_N_internal_particles);
         CEX_align_array(CEX_internal_neighbors, sizeof(int));
         CEX_external_neighbors = CEX_make_int_array(0);
@@ -279,6 +326,9 @@ read_comm_el(msg_t *msg, array_t *arr)
         comm.comm_rank = read_int(msg, "comm_rank", 0, CEX_size-1);
         comm.arr_inx = ARR_LENGTH(arr);
         comm.current_rule = NULL;
+#ifdef MPI_SHARED_MEMORY_HALOS
+        comm.node_rank = -1;
+#endif
         ARR_APPEND(comm_t, arr, comm);
 }
 
@@ -324,19 +374,32 @@ CEX_initialize_cell_comm(msg_t *msg)
 {
         REQ_STATE("cell-state");
         CEX_comms = read_array(msg, "comms", sizeof(comm_t), &read_comm_el);
-        CEX_comm_rules = read_array(msg, "comm_rules", sizeof(comm_rule_t), 
-                                    &read_comm_rule_el);
+        CEX_setup_cell_comm(CEX_comms,
+                            read_array(msg, "comm_rules", sizeof(comm_rule_t),
+                                       &read_comm_rule_el));
+}
+
+void
+CEX_setup_cell_comm(array_t *comms, array_t *comm_rules)
+{
+        REQ_STATE("cell-state");
+        CEX_comms = comms;
+        CEX_comm_rules = comm_rules;
         xprintf("initialized %lu communicators and %lu communication rules",
                 ARR_LENGTH(CEX_comms), ARR_LENGTH(CEX_comm_rules));
         /* setup auxillary data structures */
         int N_comms = ARR_LENGTH(CEX_comms);
         CEX_send_indices = make_array_of_arrayps(sizeof(int), N_comms);
         CEX_recv_lengths = CEX_make_int_array(N_comms);
-        CEX_tmp_recv_positions = make_array_of_arrayps(sizeof(vec_t), N_comms);
-        CEX_tmp_recv_tags = make_array_of_arrayps(sizeof(int), N_comms);
+        CEX_tmp_recv_migrants = make_array_of_arrayps(sizeof(migrant_t), N_comms);
         CEX_ext_positions_offset = make_array_of_arrayps(sizeof(int), N_comms);
-        CEX_remove_indices = make_array_of_arrayps(sizeof(int), N_comms);
-        CEX_send_positions_buffers = make_array_of_arrayps(sizeof(vec_t), N_comms);
+        CEX_send_positions_buffers = make_array_of_arrayps(sizeof(halo_position_t), N_comms);
+#ifdef MPI_NEIGHBOR_COLLECTIVES
+        CEX_create_neighbor_comm();
+#endif
+#ifdef MPI_SHARED_MEMORY_HALOS
+        CEX_create_node_comm();
+#endif
         init_state = "cell-comm";
 }
 
@@ -350,97 +413,20 @@ read_jcell_el(msg_t *msg, array_t *arr)
         ARR_APPEND(cell_t, arr, jcell);
 }
 
-static cell_t *
-read_cell(msg_t *msg)
-{
-       int cell_index = read_int(msg, "cell_index", 0, ARR_LENGTH(CEX_jcells)-1);
-       //xprintf("cell_index %d %p", cell_index, ARR_ADDRESS_ELEMENT(CEX_jcells, cell_index));
-       return (cell_t *)ARR_ADDRESS_ELEMENT(CEX_jcells, cell_index);
-}
-
-static int
-read_axis(msg_t *msg)
-{
-        return read_int(msg, "axis", 0, 2);
-}
-
-static void
-read_surface_junction_el(msg_t *msg, array_t *arr)
-{
-        surface_junction_t sj;
-        sj.cell = read_cell(msg);
-        sj.axis = read_axis(msg);
-        sj.dir = read_int(msg, "dir", -1, 1);
-        if (sj.dir==0) {
-                Fatal("bad direction 0");
-        }
-        ARR_APPEND(surface_junction_t, arr, sj);
-}
-
-static void
-read_line_junction_el(msg_t *msg, array_t *arr)
-{
-        line_junction_t lj;
-        lj.cell = read_cell(msg);
-        lj.axis = read_axis(msg);
-        int axis1, axis2;
-        switch(lj.axis) {
-        case AXIS_X:
-                axis1 = AXIS_Y;
-                axis2 = AXIS_Z;
-                break;
-        case AXIS_Y:
-                axis1 = AXIS_X;
-                axis2 = AXIS_Z;
-                break;
-        case AXIS_Z:
-                axis1 = AXIS_X;
-                axis2 = AXIS_Y;
-                break;
-        default:
-                Fatal("bad axis %d", lj.axis);
-        }
-        lj.offset1 = read_double(msg, "offset1", 
-                                 INDEX_AXIS(&CEX_this_cell->min_extent, axis1),
-                                 INDEX_AXIS(&CEX_this_cell->max_extent, axis1));
-        lj.offset2 = read_double(msg, "offset2", 
-                                 INDEX_AXIS(&CEX_this_cell->min_extent, axis2),
-                                 INDEX_AXIS(&CEX_this_cell->max_extent, axis2));
-        ARR_APPEND(line_junction_t, arr, lj);
-}
-
-static void
-read_point_junction_el(msg_t *msg, array_t *arr)
+void
+CEX_initialize_cell_junctions(msg_t *msg)
 {
-        point_junction_t pj;
-        pj.cell = read_cell(msg);
-        pj.offset = read_vec(msg, "offset", 
-                             CEX_this_cell->min_extent,
-                             CEX_this_cell->max_extent);
-        ARR_APPEND(point_junction_t, arr, pj);
+        REQ_STATE("cell-comm");
+        CEX_setup_cell_junctions(read_array(msg, "jcells",
+                                            sizeof(cell_t), &read_jcell_el));
 }
 
-
 void
-CEX_initialize_cell_junctions(msg_t *msg)
+CEX_setup_cell_junctions(array_t *jcells)
 {
         REQ_STATE("cell-comm");
-        CEX_jcells = read_array(msg, "jcells",
-                                sizeof(cell_t), &read_jcell_el);
-        CEX_surface_junctions = read_array(msg, "surface_junctions", 
-                                           sizeof(surface_junction_t),
-                                           &read_surface_junction_el);
-        CEX_line_junctions = read_array(msg, "line_junctions", 
-                                           sizeof(line_junction_t),
-                                           &read_line_junction_el);
-        CEX_point_junctions = read_array(msg, "point_junctions",
-                                         sizeof(point_junction_t),
-                                         &read_point_junction_el);
-        xprintf("initialized %lu junctions: surface=%lu line=%lu point=%lu",
-                ARR_LENGTH(CEX_jcells),
-                ARR_LENGTH(CEX_surface_junctions), 
-                ARR_LENGTH(CEX_line_junctions),
-                ARR_LENGTH(CEX_point_junctions));
+        CEX_jcells = jcells;
+        xprintf("initialized %lu junctioned cells", ARR_LENGTH(CEX_jcells));
         init_state = "initialized";
 }
 
@@ -36,6 +36,16 @@ void CEX_initialize_cell_state(msg_t *msg);
 void CEX_initialize_cell_comm(msg_t *msg);
 void CEX_initialize_cell_junctions(msg_t *msg);
 
+/* The same initialization from values instead of messages, for
+ * drivers that setup cells themselves (see driver.c).  arrays are
+ * taken over and the comm of each rule and junctioned cell must point
+ * into comms */
+void CEX_setup_random(unsigned int seed);
+void CEX_setup_cell_state(vec_t min_extent, vec_t max_extent,
+                          array_t *positions, array_t *tags);
+void CEX_setup_cell_comm(array_t *comms, array_t *comm_rules);
+void CEX_setup_cell_junctions(array_t *jcells);
+
 int CEX_is_initialized(void);
 #define REQ_INIT() do {                                                 \
         if (!CEX_is_initialized()) {                                    \
@@ -21,7 +21,13 @@
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
 #include <errno.h>
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
 
 #include "debug.h"
 #include "compat.h"
@@ -30,6 +36,15 @@
 #include "periodic.h"
 #include "bd.h"
 #include "init.h"
+#include "balance.h"
+#include "ring.h"
+#include "traj.h"
+#include "checkpoint.h"
+#include "rdf.h"
+#include "clusters.h"
+#include "msd.h"
+#include "snapshot.h"
+#include "grid.h"
 
 /* entry point */
 static void main_master(int argc , char **argv);
@@ -64,32 +79,81 @@ exit_main_loop(void)
         }
 }
 
+/* as MPI counts are int, messages are sent in chunks of at most
+ * MSG_CHUNK bytes.  a chunk shorter than MSG_CHUNK (possibly empty)
+ * ends a message, s.t. most messages remain a single MPI message */
+#define MSG_CHUNK (1<<30)
+
 static void 
 msg_send(int rank, msg_t *msg)
 {
-        //xprintf("sending len=%d", CEX_msg_len(msg));
-        int res = MPI_Send(MSG_START(msg), CEX_msg_len(msg),
-                           MPI_CHAR, rank, 0, MPI_COMM_WORLD);
-        if (unlikely(res!=0)) {
-                Fatal("MPI_Send returned %d", res);
-        }
+        //xprintf("sending len=%lu", CEX_msg_len(msg));
+        char *ptr = MSG_START(msg);
+        size_t remaining = CEX_msg_len(msg);
+        int chunk;
+        do {
+                chunk = remaining < MSG_CHUNK ? (int)remaining : MSG_CHUNK;
+                int res = MPI_Send(ptr, chunk, MPI_CHAR, rank, 0, MPI_COMM_WORLD);
+                if (unlikely(res!=0)) {
+                        Fatal("MPI_Send returned %d", res);
+                }
+                ptr += chunk;
+                remaining -= chunk;
+        } while (chunk==MSG_CHUNK);
 }
 
 static void
 msg_recv(int rank, msg_t *msg)
 {
-        MPI_Status status;
-        MPI_Probe(rank, 0, MPI_COMM_WORLD, &status);
-        int nbytes = GET_MPI_STATUS_BYTES(status);
-        //xprintf("recieving len=%d", nbytes);
-        CEX_prealloc_msg(msg, nbytes);
-        int res = MPI_Recv(MSG_START(msg), nbytes, MPI_CHAR,
-                           rank, 0, MPI_COMM_WORLD, &status);
-        if (unlikely(res!=0)) {
-                Fatal("MPI_Recv returned %d", res);
-        }
+        size_t length = 0;
+        int nbytes;
+        do {
+                MPI_Status status;
+                MPI_Probe(rank, 0, MPI_COMM_WORLD, &status);
+                nbytes = GET_MPI_STATUS_BYTES(status);
+                //xprintf("recieving len=%d", nbytes);
+                CEX_prealloc_msg(msg, length + nbytes);
+                int res = MPI_Recv(MSG_START(msg) + length, nbytes, MPI_CHAR,
+                                   rank, 0, MPI_COMM_WORLD, &status);
+                if (unlikely(res!=0)) {
+                        Fatal("MPI_Recv returned %d", res);
+                }
+                length += nbytes;
+        } while (nbytes==MSG_CHUNK);
         MSG_PTR(msg) = MSG_START(msg);
-        MSG_END(msg) = MSG_START(msg) + nbytes;
+        MSG_END(msg) = MSG_START(msg) + length;
+}
+
+/* as msg_send, although the chunks are sent with non-blocking sends
+ * whose requests are appended to `requests */
+static void
+msg_isend(int rank, char *ptr, size_t remaining, array_t *requests)
+{
+        int chunk;
+        do {
+                MPI_Request request;
+                chunk = remaining < MSG_CHUNK ? (int)remaining : MSG_CHUNK;
+                int res = MPI_Isend(ptr, chunk, MPI_CHAR, rank, 0, MPI_COMM_WORLD,
+                                    &request);
+                if (unlikely(res!=0)) {
+                        Fatal("MPI_Isend returned %d", res);
+                }
+                ARR_APPEND(MPI_Request, requests, request);
+                ptr += chunk;
+                remaining -= chunk;
+        } while (chunk==MSG_CHUNK);
+}
+
+/* broadcast `length bytes from the master in chunks of MSG_CHUNK */
+static void
+bcast_bytes(char *ptr, size_t length)
+{
+        while (length > 0) {
+                int chunk = length < MSG_CHUNK ? (int)length : MSG_CHUNK;
+                MPI_Bcast(ptr, chunk, MPI_CHAR, 0, MPI_COMM_WORLD);
+                ptr += chunk;
+                length -= chunk;
+        }
 }
 
 static void
@@ -124,41 +188,85 @@ static void exit_command(msg_t *recv, msg_t *send);
 static void poll_size_command(msg_t *recv, msg_t *send);
 static void poll_thread_name_command(msg_t *recv, msg_t *send);
 static void set_thread_name_command(msg_t *recv, msg_t *send);
+static void set_num_threads_command(msg_t *recv, msg_t *send);
 /* slave specific commands */
 /* master specific commands */
 static void send_msg_command(msg_t *recv, msg_t *send);
 static void recv_msg_command(msg_t *recv, msg_t *send);
+static void send_msgs_command(msg_t *recv, msg_t *send);
+static void recv_msgs_command(msg_t *recv, msg_t *send);
+static void map_msgs_command(msg_t *recv, msg_t *send);
 /* init commands */
 static void initialize_system_command(msg_t *recv, msg_t *send);
+static void initialize_system_broadcast_command(msg_t *recv, msg_t *send);
 static void initialize_random_command(msg_t *recv, msg_t *send);
 static void initialize_cell_state_command(msg_t *recv, msg_t *send);
 static void initialize_cell_comm_command(msg_t *recv, msg_t *send);
 static void initialize_cell_junctions_command(msg_t *recv, msg_t *send);
+static void initialize_grid_cells_command(msg_t *recv, msg_t *send);
+static void initialize_grid_cells_from_file_command(msg_t *recv, msg_t *send);
 static void thread_update_neighbors_command(msg_t *recv, msg_t *send);
 static void thread_update_forces_command(msg_t *recv, msg_t *send);
 static void slave_simulation_loop_command(msg_t *recv, msg_t *send);
 static void master_simulate_cycles_command(msg_t *recv, msg_t *send);
+static void configure_balancing_command(msg_t *recv, msg_t *send);
 static void collect_thread_positions_and_tags_command(msg_t *recv, msg_t *send);
 static void collect_thread_state_command(msg_t *recv, msg_t *send);
+static void collect_thread_images_command(msg_t *recv, msg_t *send);
+static void open_trajectory_command(msg_t *recv, msg_t *send);
+static void open_compressed_trajectory_command(msg_t *recv, msg_t *send);
+static void write_trajectory_frame_command(msg_t *recv, msg_t *send);
+static void close_trajectory_command(msg_t *recv, msg_t *send);
+static void write_checkpoint_command(msg_t *recv, msg_t *send);
+static void read_checkpoint_command(msg_t *recv, msg_t *send);
+static void setup_rdf_command(msg_t *recv, msg_t *send);
+static void collect_rdf_command(msg_t *recv, msg_t *send);
+static void find_clusters_command(msg_t *recv, msg_t *send);
+static void setup_msd_command(msg_t *recv, msg_t *send);
+static void collect_msd_command(msg_t *recv, msg_t *send);
+static void take_snapshot_command(msg_t *recv, msg_t *send);
+static void fetch_snapshot_command(msg_t *recv, msg_t *send);
 
 static command_t commands[] = {
         {"exit", &exit_command},
         {"poll_size", &poll_size_command},
         {"poll_thread_name", &poll_thread_name_command},
         {"set_thread_name", &set_thread_name_command},
+        {"set_num_threads", &set_num_threads_command},
         {"send_msg", &send_msg_command},
         {"recv_msg", &recv_msg_command},
+        {"send_msgs", &send_msgs_command},
+        {"recv_msgs", &recv_msgs_command},
+        {"map_msgs", &map_msgs_command},
         {"initialize_system", &initialize_system_command},
+        {"initialize_system_broadcast", &initialize_system_broadcast_command},
         {"initialize_random", &initialize_random_command},
         {"initialize_cell_state", &initialize_cell_state_command},
         {"initialize_cell_comm", &initialize_cell_comm_command},
         {"initialize_cell_junctions", &initialize_cell_junctions_command},
+        {"initialize_grid_cells", &initialize_grid_cells_command},
+        {"initialize_grid_cells_from_file", &initialize_grid_cells_from_file_command},
         {"thread_update_neighbors", &thread_update_neighbors_command},
         {"thread_update_forces", &thread_update_forces_command},
         {"slave_simulation_loop", &slave_simulation_loop_command},
         {"master_simulate_cycles", &master_simulate_cycles_command},
+        {"configure_balancing", &configure_balancing_command},
         {"collect_thread_positions_and_tags", &collect_thread_positions_and_tags_command},
         {"collect_thread_state", &collect_thread_state_command},
+        {"collect_thread_images", &collect_thread_images_command},
+        {"open_trajectory", &open_trajectory_command},
+        {"open_compressed_trajectory", &open_compressed_trajectory_command},
+        {"write_trajectory_frame", &write_trajectory_frame_command},
+        {"close_trajectory", &close_trajectory_command},
+        {"write_checkpoint", &write_checkpoint_command},
+        {"read_checkpoint", &read_checkpoint_command},
+        {"setup_rdf", &setup_rdf_command},
+        {"collect_rdf", &collect_rdf_command},
+        {"find_clusters", &find_clusters_command},
+        {"setup_msd", &setup_msd_command},
+        {"collect_msd", &collect_msd_command},
+        {"take_snapshot", &take_snapshot_command},
+        {"fetch_snapshot", &fetch_snapshot_command},
         {NULL, NULL} /* setinel */
 };
 
@@ -213,10 +321,15 @@ static void xread(void *buf, size_t size);
 static void xwrite(void *buf, size_t size);
 static void xflush(void);
 static unsigned int read_uint(void);
-static void write_uint(unsigned int value);
+static uint64_t read_length(void);
+static void write_length(uint64_t value);
 
 static void perform_remote_command(int rank, msg_t *recv, msg_t *send);
 
+/* messages are exchanged through shared memory, with the fifos only
+ * as doorbells, when given a third command line argument */
+static int using_ring=0;
+
 static void
 main_master(int argc, char **argv)
 {
@@ -226,23 +339,38 @@ main_master(int argc, char **argv)
         msg_t *send = CEX_make_write_msg(2048);
         exit_master_command_loop = 0;
         while (!exit_master_command_loop) {
-                unsigned int msg_rank = read_uint();
-                /* read a message from reading fifo */
-                unsigned int msg_len = read_uint();
-                //xprintf("msglen %lu for rank %d", msg_len, msg_rank);
-                MSG_END(recv) = MSG_START(recv) + ARR_LENGTH(MSG_BUFFER(recv));
-                CEX_prealloc_msg(recv, msg_len);
-                xread(MSG_START(recv), msg_len);
-                MSG_END(recv) = MSG_START(recv) + msg_len;
+                unsigned int msg_rank;
+                msg_t *command = recv;
+                if (using_ring) {
+                        /* wait on doorbell, then take command from ring */
+                        char bell;
+                        xread(&bell, 1);
+                        command = CEX_ring_read_command(recv, &msg_rank);
+                } else {
+                        msg_rank = read_uint();
+                        /* read a message from reading fifo */
+                        size_t msg_len = read_length();
+                        //xprintf("msglen %lu for rank %d", msg_len, msg_rank);
+                        MSG_END(recv) = MSG_START(recv) + ARR_LENGTH(MSG_BUFFER(recv));
+                        CEX_prealloc_msg(recv, msg_len);
+                        xread(MSG_START(recv), msg_len);
+                        MSG_END(recv) = MSG_START(recv) + msg_len;
+                }
                 if (msg_rank==CEX_rank) {
-                        perform_command(recv, send);
+                        perform_command(command, send);
                 } else {
-                        perform_remote_command(msg_rank, recv, send);
+                        perform_remote_command(msg_rank, command, send);
+                }
+                if (using_ring) {
+                        CEX_ring_write_reply(send);
+                        char bell = 1;
+                        xwrite(&bell, 1);
+                } else {
+                        /* write send message to writing fifo */
+                        //xprintf("fifo write len %d", CEX_msg_len(send));
+                        write_length(CEX_msg_len(send));
+                        xwrite(MSG_START(send), CEX_msg_len(send));
                 }
-                /* write send message to writing fifo */
-                //xprintf("fifo write len %d", CEX_msg_len(send));
-                write_uint(CEX_msg_len(send));
-                xwrite(MSG_START(send), CEX_msg_len(send));
                 xflush();
         }
         CEX_free_msg(recv);
@@ -294,13 +422,17 @@ static void
 setup_fifos(int argc, char **argv)
 {
         REQ_MASTER();
-        if (argc!=3) {
-                Fatal("takes exactly 2 command line arguments; given %d", argc-1);
+        if (argc!=3 && argc!=4) {
+                Fatal("takes 2 or 3 command line arguments; given %d", argc-1);
         }
         xprintf("reading commands from fifo %.200s", argv[1]);
         xprintf("writing results to fifo %.200s", argv[2]);
         reading_fifo = open_fifo(argv[1], "r");
         writing_fifo = open_fifo(argv[2], "w");
+        if (argc==4) {
+                CEX_ring_attach(argv[3]);
+                using_ring = 1;
+        }
 }
 
 static FILE*
@@ -359,15 +491,29 @@ read_uint(void)
                 ((unsigned int)buff[3]);
 }
 
+/* message lengths on the fifos are 64-bit, s.t. messages can exceed
+ * 4 GB */
+static uint64_t
+read_length(void)
+{
+        unsigned char buff[8];
+        uint64_t value = 0;
+        xread(buff, sizeof(buff));
+        for (int i=0; i<8; i++) {
+                value = (value << 8) | buff[i];
+        }
+        return value;
+}
+
 static void
-write_uint(unsigned int value)
+write_length(uint64_t value)
 {
-        char buff[4];
+        char buff[8];
 
-        buff[0] = (char)((value>>24) & 0xffU);
-        buff[1] = (char)((value>>16) & 0xffU);
-        buff[2] = (char)((value>>8) & 0xffU);
-        buff[3] = (char)((value>>0) & 0xffU);
+        for (int i=7; i>=0; i--) {
+                buff[i] = (char)(value & 0xffU);
+                value >>= 8;
+        }
         xwrite(buff, sizeof(buff));
 }
 
@@ -381,6 +527,7 @@ static void
 exit_command(msg_t *recv, msg_t *send)
 {
         REQ_MSG_EOFP(recv);
+        CEX_complete_snapshot();
         exit_main_loop();
 }
 
@@ -416,13 +563,30 @@ set_thread_name_command(msg_t *recv, msg_t *send)
         CEX_free_array(name);
 }
 
+static void
+set_num_threads_command(msg_t *recv, msg_t *send)
+{
+        int n_threads = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        if (n_threads < 1) {
+                Fatal("bad number of threads %d", n_threads);
+        }
+#ifdef _OPENMP
+        omp_set_num_threads(n_threads);
+        /* work may be divided between threads when neighbor lists
+         * are built */
+        CEX_invalidate_neighbor_lists();
+#endif
+        /* without OpenMP there's only ever one thread */
+}
+
 /* master specific commands to allow asynchronous messaging */
 static void
 send_msg_command(msg_t *recv, msg_t *send)
 {
         REQ_MASTER();
         int send_rank = CEX_msg_read_int(recv);
-        int sub_len = CEX_msg_read_uint(recv);
+        size_t sub_len = CEX_msg_read_uint(recv);
         /* narrow to submsg */
         char *old_start = MSG_START(recv);
         char *old_end = MSG_END(recv);
@@ -445,6 +609,187 @@ recv_msg_command(msg_t *recv, msg_t *send)
         MSG_PTR(send) = MSG_END(send);
 }
 
+/* Batched Commands
+ * ----------------
+ * A batch holds one command for each of several ranks, s.t. the control
+ * process can address every thread in a single round trip through the
+ * fifos or ring, instead of a send_msg and recv_msg per slave.  A batch
+ * is a count followed by that many (int rank, submsg) pairs, with each
+ * rank at most once.  The master fans the commands out to the slaves
+ * with non-blocking sends and then collects the replies in whichever
+ * order the slaves finish.  Replies are likewise a count followed by
+ * (int rank, submsg) pairs, in order of arrival.
+ */
+typedef struct {
+        int rank;
+        char *start, *end;
+} batch_entry_t;
+
+static array_t *batch_requests = NULL;
+static msg_t *batch_reply = NULL;
+
+static array_t *
+read_batch(msg_t *recv, int allow_master)
+{
+        REQ_MASTER();
+        unsigned int n_entries = CEX_msg_read_uint(recv);
+        array_t *entries = CEX_make_array(sizeof(batch_entry_t), n_entries);
+        char seen[CEX_size];
+        memset(seen, 0, sizeof(seen));
+        for (unsigned int i=0; i<n_entries; i++) {
+                batch_entry_t entry;
+                entry.rank = CEX_msg_read_int(recv);
+                size_t length = CEX_msg_read_uint(recv);
+                if (entry.rank!=0 || !allow_master) {
+                        validate_slave_rank(entry.rank);
+                }
+                if (seen[entry.rank]) {
+                        Fatal("rank %d given twice in batch", entry.rank);
+                }
+                seen[entry.rank] = 1;
+                if (unlikely((size_t)(MSG_END(recv) - MSG_PTR(recv)) < length)) {
+                        Fatal("batch command of %lu bytes overflows message",
+                              (unsigned long)length);
+                }
+                entry.start = MSG_PTR(recv);
+                entry.end = entry.start + length;
+                MSG_PTR(recv) = entry.end;
+                ARR_APPEND(batch_entry_t, entries, entry);
+        }
+        REQ_MSG_EOFP(recv);
+        return entries;
+}
+
+/* send each slave its command, returning once all sends have completed
+ * s.t. the commands may be overwritten */
+static void
+fan_out_batch(array_t *entries)
+{
+        REQ_MASTER();
+        if (batch_requests==NULL) {
+                batch_requests = CEX_make_array(sizeof(MPI_Request), 16);
+        }
+        ARR_LENGTH(batch_requests) = 0;
+        batch_entry_t *entry; int counter;
+        ARR_FOREACH(batch_entry_t, entries, entry, counter) {
+                if (entry->rank!=0) {
+                        msg_isend(entry->rank, entry->start, entry->end - entry->start,
+                                  batch_requests);
+                }
+        }
+        MPI_Waitall(ARR_LENGTH(batch_requests),
+                    ARR_DATA_AS(MPI_Request, batch_requests), MPI_STATUSES_IGNORE);
+}
+
+static msg_t *
+get_batch_reply(void)
+{
+        if (batch_reply==NULL) {
+                batch_reply = CEX_make_write_msg(2048);
+        }
+        return batch_reply;
+}
+
+static void
+write_batch_reply(msg_t *send, int rank, msg_t *reply)
+{
+        size_t length = CEX_msg_len(reply);
+        if (unlikely(length > UINT_MAX)) {
+                Fatal("reply of %lu bytes from rank %d too large for batch",
+                      (unsigned long)length, rank);
+        }
+        CEX_msg_write_int(send, rank);
+        CEX_msg_write_uint(send, (unsigned int)length);
+        if ((size_t)(MSG_END(send) - MSG_PTR(send)) < length) {
+                CEX_prealloc_msg(send, CEX_msg_tell(send) + length);
+        }
+        memcpy(MSG_PTR(send), MSG_START(reply), length);
+        MSG_PTR(send) += length;
+}
+
+/* receive the replies of the slaves in `ranks, taking any that have
+ * already arrived before blocking on the first outstanding rank */
+static void
+collect_batch_replies(int *ranks, int n_ranks, msg_t *send)
+{
+        REQ_MASTER();
+        msg_t *reply = get_batch_reply();
+        while (n_ranks > 0) {
+                int inx = 0;
+                for (int i=0; i<n_ranks; i++) {
+                        int ready;
+                        MPI_Iprobe(ranks[i], 0, MPI_COMM_WORLD, &ready, MPI_STATUS_IGNORE);
+                        if (ready) {
+                                inx = i;
+                                break;
+                        }
+                }
+                int rank = ranks[inx];
+                ranks[inx] = ranks[--n_ranks];
+                recv_remote_command(rank, reply);
+                write_batch_reply(send, rank, reply);
+        }
+}
+
+static void
+send_msgs_command(msg_t *recv, msg_t *send)
+{
+        REQ_MASTER();
+        array_t *entries = read_batch(recv, 0);
+        fan_out_batch(entries);
+        CEX_free_array(entries);
+}
+
+static void
+recv_msgs_command(msg_t *recv, msg_t *send)
+{
+        REQ_MASTER();
+        array_t *ranks = CEX_msg_read_raw_int_array(recv);
+        REQ_MSG_EOFP(recv);
+        char seen[CEX_size];
+        memset(seen, 0, sizeof(seen));
+        int *rank, counter;
+        IARR_FOREACH(ranks, rank, counter) {
+                validate_slave_rank(*rank);
+                if (seen[*rank]) {
+                        Fatal("rank %d given twice in batch", *rank);
+                }
+                seen[*rank] = 1;
+        }
+        CEX_msg_write_uint(send, (unsigned int)ARR_LENGTH(ranks));
+        collect_batch_replies(ARR_DATA_AS(int, ranks), (int)ARR_LENGTH(ranks), send);
+        CEX_free_array(ranks);
+}
+
+/* sends, performs and receives a batch, in which the master itself may
+ * be given a command (rank 0).  the master performs its command after
+ * the slaves have been sent theirs, as the two are typically
+ * collective */
+static void
+map_msgs_command(msg_t *recv, msg_t *send)
+{
+        REQ_MASTER();
+        array_t *entries = read_batch(recv, 1);
+        fan_out_batch(entries);
+        CEX_msg_write_uint(send, (unsigned int)ARR_LENGTH(entries));
+        int slave_ranks[ARR_LENGTH(entries)];
+        int n_slaves = 0;
+        batch_entry_t *entry; int counter;
+        ARR_FOREACH(batch_entry_t, entries, entry, counter) {
+                if (entry->rank!=0) {
+                        slave_ranks[n_slaves++] = entry->rank;
+                } else {
+                        msg_t command = {NULL, entry->start, entry->end, entry->start,
+                                         MSG_R, 0};
+                        msg_t *reply = get_batch_reply();
+                        perform_command(&command, reply);
+                        write_batch_reply(send, 0, reply);
+                }
+        }
+        collect_batch_replies(slave_ranks, n_slaves, send);
+        CEX_free_array(entries);
+}
+
 /* init commands */
 static void
 initialize_system_command(msg_t *recv, msg_t *send)
@@ -453,6 +798,32 @@ initialize_system_command(msg_t *recv, msg_t *send)
         REQ_MSG_EOFP(recv);
 }
 
+/* only the master is sent the fields of initialize_system, which it
+ * broadcasts to the slaves as they're sent this command without fields.
+ * avoids forwarding a copy of the force tables to each slave in turn */
+static void
+initialize_system_broadcast_command(msg_t *recv, msg_t *send)
+{
+        int64_t length = 0;
+        if (IS_MASTER()) {
+                length = MSG_END(recv) - MSG_PTR(recv);
+        } else {
+                REQ_MSG_EOFP(recv);
+        }
+        MPI_Bcast(&length, 1, MPI_INT64_T, 0, MPI_COMM_WORLD);
+        msg_t *fields = recv;
+        if (!IS_MASTER()) {
+                fields = CEX_make_read_msg(CEX_make_char_array(length));
+                MSG_END(fields) = MSG_START(fields) + length;
+        }
+        bcast_bytes(MSG_PTR(fields), length);
+        CEX_initialize_system(fields);
+        REQ_MSG_EOFP(fields);
+        if (fields!=recv) {
+                CEX_free_msg(fields);
+        }
+}
+
 static void
 initialize_random_command(msg_t *recv, msg_t *send)
 {
@@ -481,6 +852,41 @@ initialize_cell_junctions_command(msg_t *recv, msg_t *send)
         REQ_MSG_EOFP(recv);
 }
 
+/* in place of the cell commands; only the master is sent the positions
+ * of all particles (or the path of a file of them), which it scatters
+ * over a regular grid of cells, as the slaves are sent the command
+ * without fields */
+static void
+initialize_grid_cells_command(msg_t *recv, msg_t *send)
+{
+        array_t *positions = NULL;
+        if (IS_MASTER()) {
+                positions = CEX_msg_read_raw_vec_array(recv);
+        }
+        REQ_MSG_EOFP(recv);
+        CEX_scatter_grid_cells(positions ? ARR_DATA(positions) : NULL,
+                               positions ? ARR_LENGTH(positions) : 0);
+        if (positions) {
+                CEX_free_array(positions);
+        }
+}
+
+static void
+initialize_grid_cells_from_file_command(msg_t *recv, msg_t *send)
+{
+        if (!IS_MASTER()) {
+                REQ_MSG_EOFP(recv);
+                CEX_scatter_grid_cells_from_file(NULL);
+                return;
+        }
+        array_t *path_arr = CEX_msg_read_char_array(recv);
+        REQ_MSG_EOFP(recv);
+        char path[ARR_LENGTH(path_arr)+1];
+        CEX_char_array_as_string(path_arr, path);
+        CEX_free_array(path_arr);
+        CEX_scatter_grid_cells_from_file(path);
+}
+
 /* simulation commands */
 static void
 thread_update_neighbors_command(msg_t *recv, msg_t *send)
@@ -511,6 +917,15 @@ master_simulate_cycles_command(msg_t *recv, msg_t *send)
         CEX_master_simulate_cycles(cycles);
 }
 
+static void
+configure_balancing_command(msg_t *recv, msg_t *send)
+{
+        int rebuild_interval = CEX_msg_read_int(recv);
+        double damping = CEX_msg_read_double(recv);
+        REQ_MSG_EOFP(recv);
+        CEX_configure_balancing(rebuild_interval, damping);
+}
+
 static void
 collect_thread_positions_and_tags_command(msg_t *recv, msg_t *send)
 {
@@ -529,9 +944,9 @@ collect_thread_positions_and_tags_command(msg_t *recv, msg_t *send)
 #endif
         int n_positions = ARR_LENGTH(CEX_positions);
         ARR_LENGTH(CEX_positions) = CEX_N_internal_particles;
-        CEX_msg_write_vec_array(send, CEX_positions);
+        CEX_msg_write_raw_vec_array(send, CEX_positions);
         ARR_LENGTH(CEX_positions) = n_positions;
-        CEX_msg_write_int_array(send, CEX_tags);
+        CEX_msg_write_raw_int64_array(send, CEX_tags);
 }
 
 static void
@@ -539,8 +954,181 @@ collect_thread_state_command(msg_t *recv, msg_t *send)
 {
         REQ_MSG_EOFP(recv);
         REQ_INIT();
-        CEX_msg_write_vec_array(send, CEX_positions);
-        CEX_msg_write_int_array(send, CEX_tags);
-        CEX_msg_write_int_array(send, CEX_internal_neighbors);
-        CEX_msg_write_int_array(send, CEX_external_neighbors);
+        CEX_msg_write_raw_vec_array(send, CEX_positions);
+        CEX_msg_write_raw_int64_array(send, CEX_tags);
+        CEX_msg_write_raw_int_array(send, CEX_internal_neighbors);
+        CEX_msg_write_raw_int_array(send, CEX_external_neighbors);
+}
+
+/* tags of the internal particles followed by their images, flattened
+ * as 3 ints each */
+static void
+collect_thread_images_command(msg_t *recv, msg_t *send)
+{
+        REQ_MSG_EOFP(recv);
+        REQ_INIT();
+        array_t *images = CEX_make_int_array(3*CEX_N_internal_particles);
+        XMEMCPY(image_t, ARR_DATA(images), ARR_DATA(CEX_images), CEX_N_internal_particles);
+        ARR_LENGTH(images) = 3*CEX_N_internal_particles;
+        CEX_msg_write_raw_int64_array(send, CEX_tags);
+        CEX_msg_write_raw_int_array(send, images);
+        CEX_free_array(images);
+}
+
+static void
+open_trajectory_command(msg_t *recv, msg_t *send)
+{
+        array_t *path_arr = CEX_msg_read_char_array(recv);
+        int interval = CEX_msg_read_int(recv);
+        int64_t cycle = CEX_msg_read_raw_int64(recv);
+        REQ_MSG_EOFP(recv);
+        char path[ARR_LENGTH(path_arr)+1];
+        CEX_char_array_as_string(path_arr, path);
+        CEX_free_array(path_arr);
+        CEX_open_trajectory(path, interval, cycle);
+}
+
+static void
+open_compressed_trajectory_command(msg_t *recv, msg_t *send)
+{
+        array_t *path_arr = CEX_msg_read_char_array(recv);
+        int interval = CEX_msg_read_int(recv);
+        int64_t cycle = CEX_msg_read_raw_int64(recv);
+        double precision = CEX_msg_read_double(recv);
+        int keyframe_interval = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        char path[ARR_LENGTH(path_arr)+1];
+        CEX_char_array_as_string(path_arr, path);
+        CEX_free_array(path_arr);
+        CEX_open_compressed_trajectory(path, interval, cycle,
+                                       precision, keyframe_interval);
+}
+
+static void
+write_trajectory_frame_command(msg_t *recv, msg_t *send)
+{
+        REQ_MSG_EOFP(recv);
+        REQ_INIT();
+        CEX_write_trajectory_frame();
+}
+
+static void
+close_trajectory_command(msg_t *recv, msg_t *send)
+{
+        REQ_MSG_EOFP(recv);
+        CEX_close_trajectory();
+}
+
+static void
+write_checkpoint_command(msg_t *recv, msg_t *send)
+{
+        array_t *prefix_arr = CEX_msg_read_char_array(recv);
+        int64_t cycle = CEX_msg_read_raw_int64(recv);
+        REQ_MSG_EOFP(recv);
+        char prefix[ARR_LENGTH(prefix_arr)+1];
+        CEX_char_array_as_string(prefix_arr, prefix);
+        CEX_free_array(prefix_arr);
+        CEX_write_checkpoint(prefix, cycle);
+}
+
+static void
+read_checkpoint_command(msg_t *recv, msg_t *send)
+{
+        array_t *prefix_arr = CEX_msg_read_char_array(recv);
+        REQ_MSG_EOFP(recv);
+        char prefix[ARR_LENGTH(prefix_arr)+1];
+        CEX_char_array_as_string(prefix_arr, prefix);
+        CEX_free_array(prefix_arr);
+        CEX_msg_write_raw_int64(send, CEX_read_checkpoint(prefix));
+}
+
+static void
+setup_rdf_command(msg_t *recv, msg_t *send)
+{
+        int n_bins = CEX_msg_read_int(recv);
+        double r_max = CEX_msg_read_double(recv);
+        int interval = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        CEX_setup_rdf(n_bins, r_max, interval);
+}
+
+/* only the master replies, with the histogram summed over all threads */
+static void
+collect_rdf_command(msg_t *recv, msg_t *send)
+{
+        int reset = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        int n_samples, n_particles;
+        array_t *histogram = CEX_collect_rdf(reset, &n_samples, &n_particles);
+        if (IS_MASTER()) {
+                CEX_msg_write_raw_double_array(send, histogram);
+                CEX_msg_write_int(send, n_samples);
+                CEX_msg_write_int(send, n_particles);
+                CEX_free_array(histogram);
+        }
+}
+
+/* the master replies with the cluster size distribution and, when
+ * requested, every thread with the tags and cluster labels of its
+ * internal particles */
+static void
+find_clusters_command(msg_t *recv, msg_t *send)
+{
+        double bond_distance = CEX_msg_read_double(recv);
+        int write_labels = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        array_t *labels = CEX_find_clusters(bond_distance);
+        array_t *distribution = CEX_cluster_size_distribution(labels);
+        if (IS_MASTER()) {
+                CEX_msg_write_raw_int_array(send, distribution);
+                CEX_free_array(distribution);
+        }
+        if (write_labels) {
+                CEX_msg_write_raw_int64_array(send, CEX_tags);
+                CEX_msg_write_raw_int64_array(send, labels);
+        }
+        CEX_free_array(labels);
+}
+
+static void
+setup_msd_command(msg_t *recv, msg_t *send)
+{
+        int interval = CEX_msg_read_int(recv);
+        int max_lag = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        CEX_setup_msd(interval, max_lag);
+}
+
+/* only the master replies, with the lags and mean squared displacements */
+static void
+collect_msd_command(msg_t *recv, msg_t *send)
+{
+        int reset = CEX_msg_read_int(recv);
+        REQ_MSG_EOFP(recv);
+        array_t *lags, *msd;
+        CEX_collect_msd(reset, &lags, &msd);
+        if (IS_MASTER()) {
+                CEX_msg_write_raw_int_array(send, lags);
+                CEX_msg_write_raw_double_array(send, msd);
+                CEX_free_array(lags);
+                CEX_free_array(msd);
+        }
+}
+
+static void
+take_snapshot_command(msg_t *recv, msg_t *send)
+{
+        REQ_MSG_EOFP(recv);
+        CEX_take_snapshot();
+}
+
+/* master only; positions and tags of every thread */
+static void
+fetch_snapshot_command(msg_t *recv, msg_t *send)
+{
+        REQ_MSG_EOFP(recv);
+        array_t *positions, *tags;
+        CEX_fetch_snapshot(&positions, &tags);
+        CEX_msg_write_raw_vec_array(send, positions);
+        CEX_msg_write_raw_int64_array(send, tags);
 }
@@ -0,0 +1,330 @@
+/* -*- Mode: c -*-
+ * msd.c - Mean squared displacement accumulated during simulation
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Mean Squared Displacement
+ * -------------------------------------------------------------------
+ * The unwrapped positions of the time origins must be kept per
+ * particle, but particles migrate between threads, so each thread
+ * instead keeps the origins of a fixed set of tags, those with
+ * tag % size == rank.  On sampling, every thread sends the unwrapped
+ * position of each of its internal particles to the thread owning its
+ * tag in a single all-to-all exchange.
+ *
+ * The owner keeps the origins in a multiple-tau correlator.  Level 0
+ * holds the last MSD_LEVEL_LENGTH samples, and measures lags of 1
+ * through MSD_LEVEL_LENGTH-1 samples from each new one.  Every pair of
+ * values entering level l is averaged into a single value entering
+ * level l+1, s.t. level l holds averages over blocks of 2^l samples and
+ * measures lags of j*2^l for j from MSD_LEVEL_LENGTH/2 up.  The lags
+ * are then spaced by a quarter of an octave, and the origins kept grow
+ * only with the logarithm of the longest lag.
+ */
+
+#include <mpi.h>
+#include <stdint.h>
+
+#include "opt.h"
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "periodic.h"
+#include "bd.h"
+#include "init.h"
+#include "msd.h"
+
+typedef struct {
+        tag_t tag;
+        vec_t position;
+} msd_record_t;
+
+/* origins kept at each level of the correlator */
+#define MSD_LEVEL_LENGTH 8
+/* more than enough levels for any lag of int samples */
+#define MAX_MSD_LEVELS 32
+
+static int msd_interval=0;
+static int cycles_since_sample=0;
+static int n_owned=0;
+static int n_levels=0;
+/* for each level, MSD_LEVEL_LENGTH rows of the (block averaged)
+ * unwrapped positions of the owned tags followed by a row summing the
+ * values of the next block */
+static array_t *origins=NULL;
+/* values that have entered each level, the newest in row
+ * (level_entered-1) % MSD_LEVEL_LENGTH */
+static int level_entered[MAX_MSD_LEVELS];
+/* values summed in the block row of each level */
+static int level_pending[MAX_MSD_LEVELS];
+/* index in msd_lags of the shortest lag measured at each level */
+static int level_first_lag[MAX_MSD_LEVELS];
+/* lags measured (in samples), with the sum of square displacements
+ * and number of displacements at each */
+static array_t *msd_lags=NULL;
+static array_t *lag_sums=NULL;
+static array_t *lag_counts=NULL;
+/* reused for the exchange */
+static array_t *send_records=NULL;
+static array_t *recv_records=NULL;
+static int *send_counts=NULL, *send_displs=NULL;
+static int *recv_counts=NULL, *recv_displs=NULL;
+
+#define OWNER(tag) ((int)((tag) % CEX_size))
+#define OWNED_SLOT(tag) ((int)((tag) / CEX_size))
+
+#define LEVEL_ROW(_origins, level, row) \
+        ((_origins) + ((size_t)(level) * (MSD_LEVEL_LENGTH+1) + (row)) * n_owned)
+#define LEVEL_BLOCK(_origins, level) LEVEL_ROW(_origins, level, MSD_LEVEL_LENGTH)
+#define LEVEL_SHORTEST_LAG(level) ((level)==0 ? 1 : MSD_LEVEL_LENGTH/2)
+
+static void sample_msd(void);
+
+void
+CEX_setup_msd(int interval, int max_lag)
+{
+        REQ_INIT();
+        if (interval < 0) {
+                Fatal("bad msd interval %d", interval);
+        }
+        if (max_lag <= 0) {
+                Fatal("bad msd lag %d", max_lag);
+        }
+        msd_interval = 0;
+        CEX_free_array(origins);
+        CEX_free_array(msd_lags);
+        CEX_free_array(lag_sums);
+        CEX_free_array(lag_counts);
+        origins = msd_lags = lag_sums = lag_counts = NULL;
+        if (interval==0) {
+                return;
+        }
+
+        int64_t n_internal = CEX_N_internal_particles, n_total;
+        tag_t max_tag = -1;
+        MPI_Allreduce(&n_internal, &n_total, 1, MPI_INT64_T, MPI_SUM, MPI_COMM_WORLD);
+        tag_t *tagp;
+        int counter;
+        ARR_FOREACH(tag_t, CEX_tags, tagp, counter) {
+                max_tag = *tagp > max_tag ? *tagp : max_tag;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &max_tag, 1, TAG_MPI_TYPE, MPI_MAX, MPI_COMM_WORLD);
+        if (max_tag != n_total-1) {
+                Fatal("msd requires tags 0 through %lld; found tag %lld",
+                      (long long)(n_total-1), (long long)max_tag);
+        }
+        n_owned = CEX_mpi_count(n_total / CEX_size + (CEX_rank < n_total % CEX_size));
+
+        msd_lags = CEX_make_int_array(0);
+        for (n_levels=0; n_levels<MAX_MSD_LEVELS &&
+                     (int64_t)LEVEL_SHORTEST_LAG(n_levels) << n_levels <= max_lag;
+             n_levels++) {
+                level_entered[n_levels] = 0;
+                level_pending[n_levels] = 0;
+                level_first_lag[n_levels] = ARR_LENGTH(msd_lags);
+                for (int j=LEVEL_SHORTEST_LAG(n_levels); j<MSD_LEVEL_LENGTH; j++) {
+                        int64_t lag = (int64_t)j << n_levels;
+                        if (lag > max_lag) {
+                                break;
+                        }
+                        IARR_APPEND(msd_lags, (int)lag);
+                }
+        }
+        size_t n_rows = (size_t)n_levels * (MSD_LEVEL_LENGTH+1);
+        origins = CEX_make_vec_array(n_rows * n_owned);
+        ARR_LENGTH(origins) = n_rows * n_owned;
+        CEX_zero_array_elements(origins);
+        lag_sums = CEX_make_array(sizeof(double), ARR_LENGTH(msd_lags));
+        ARR_LENGTH(lag_sums) = ARR_LENGTH(msd_lags);
+        CEX_zero_array_elements(lag_sums);
+        lag_counts = CEX_make_array(sizeof(double), ARR_LENGTH(msd_lags));
+        ARR_LENGTH(lag_counts) = ARR_LENGTH(msd_lags);
+        CEX_zero_array_elements(lag_counts);
+
+        if (send_records==NULL) {
+                send_records = CEX_make_array(sizeof(msd_record_t), 0);
+                recv_records = CEX_make_array(sizeof(msd_record_t), 0);
+                send_counts = XNEW(int, CEX_size);
+                send_displs = XNEW(int, CEX_size);
+                recv_counts = XNEW(int, CEX_size);
+                recv_displs = XNEW(int, CEX_size);
+        }
+        msd_interval = interval;
+        cycles_since_sample = 0;
+        if (IS_MASTER()) {
+                xprintf("sampling msd of %lld particles every %d cycles at %lu lags to %d cycles",
+                        (long long)n_total, interval, ARR_LENGTH(msd_lags), interval * max_lag);
+        }
+        sample_msd();
+}
+
+void
+CEX_advance_msd(void)
+{
+        if (likely(msd_interval==0 || ++cycles_since_sample < msd_interval)) {
+                return;
+        }
+        cycles_since_sample = 0;
+        sample_msd();
+}
+
+/* send the unwrapped position of every internal particle to the owner
+ * of its tag.  counts and displacements are in records */
+static void
+exchange_records(void)
+{
+        MPI_Datatype record_type = CEX_record_datatype(sizeof(msd_record_t));
+        for (int rank=0; rank<CEX_size; rank++) {
+                send_counts[rank] = 0;
+        }
+        tag_t *tagp;
+        int counter;
+        ARR_FOREACH(tag_t, CEX_tags, tagp, counter) {
+                send_counts[OWNER(*tagp)] ++;
+        }
+        int offset = 0;
+        for (int rank=0; rank<CEX_size; rank++) {
+                send_displs[rank] = offset;
+                offset += send_counts[rank];
+        }
+        CEX_prealloc_array(send_records, CEX_N_internal_particles);
+        ARR_LENGTH(send_records) = CEX_N_internal_particles;
+        msd_record_t *records = ARR_DATA_AS(msd_record_t, send_records);
+        const vec_t *positions = ARR_DATA_AS(vec_t, CEX_positions);
+        const image_t *images = ARR_DATA_AS(image_t, CEX_images);
+        for (int i=0; i<CEX_N_internal_particles; i++) {
+                tag_t tag = ARR_INDEX_AS(tag_t, CEX_tags, i);
+                msd_record_t *record = &records[send_displs[OWNER(tag)]++];
+                record->tag = tag;
+                record->position.x = positions[i].x + images[i].x * CEX_box_size.x;
+                record->position.y = positions[i].y + images[i].y * CEX_box_size.y;
+                record->position.z = positions[i].z + images[i].z * CEX_box_size.z;
+        }
+        for (int rank=0; rank<CEX_size; rank++) {
+                send_displs[rank] -= send_counts[rank];
+        }
+
+        MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+        offset = 0;
+        for (int rank=0; rank<CEX_size; rank++) {
+                recv_displs[rank] = offset;
+                offset += recv_counts[rank];
+        }
+        if (offset != n_owned) {
+                Fatal("recieved %d msd positions for %d owned tags",
+                      offset, n_owned);
+        }
+        CEX_prealloc_array(recv_records, n_owned);
+        ARR_LENGTH(recv_records) = n_owned;
+        MPI_Alltoallv(ARR_DATA(send_records), send_counts, send_displs, record_type,
+                      ARR_DATA(recv_records), recv_counts, recv_displs, record_type,
+                      MPI_COMM_WORLD);
+}
+
+/* accumulate the square displacements of the value that has just
+ * entered `level from each earlier value held at the level */
+static void
+measure_level(int level, const vec_t *newest)
+{
+        const vec_t *_origins = ARR_DATA_AS(vec_t, origins);
+        double *_sums = ARR_DATA_AS(double, lag_sums);
+        double *_counts = ARR_DATA_AS(double, lag_counts);
+        int n_lags = ARR_LENGTH(msd_lags);
+        int entered = level_entered[level];
+        for (int j=LEVEL_SHORTEST_LAG(level); j<MSD_LEVEL_LENGTH && j<entered; j++) {
+                int k = level_first_lag[level] + j - LEVEL_SHORTEST_LAG(level);
+                if (k >= n_lags) {
+                        break;
+                }
+                const vec_t *origin = LEVEL_ROW(_origins, level,
+                                                (entered-1-j) % MSD_LEVEL_LENGTH);
+                double sum = 0.0;
+                for (int slot=0; slot<n_owned; slot++) {
+                        vec_t r;
+                        Vec3_SUB(r, newest[slot], origin[slot]);
+                        sum += Vec3_SQR(r);
+                }
+                _sums[k] += sum;
+                _counts[k] += n_owned;
+        }
+}
+
+static void
+sample_msd(void)
+{
+        exchange_records();
+        vec_t *_origins = ARR_DATA_AS(vec_t, origins);
+        /* the sample enters level 0, overwriting its oldest value */
+        vec_t *newest = LEVEL_ROW(_origins, 0, level_entered[0] % MSD_LEVEL_LENGTH);
+        msd_record_t *recordp;
+        int counter;
+        ARR_FOREACH(msd_record_t, recv_records, recordp, counter) {
+                newest[OWNED_SLOT(recordp->tag)] = recordp->position;
+        }
+        for (int level=0; ; level++) {
+                level_entered[level] ++;
+                measure_level(level, newest);
+                if (level+1 == n_levels) {
+                        break;
+                }
+                vec_t *block = LEVEL_BLOCK(_origins, level);
+                for (int slot=0; slot<n_owned; slot++) {
+                        Vec3_ADDTO(block[slot], newest[slot]);
+                }
+                if (++level_pending[level] < 2) {
+                        break;
+                }
+                /* the average of the block enters the next level */
+                level_pending[level] = 0;
+                newest = LEVEL_ROW(_origins, level+1,
+                                   level_entered[level+1] % MSD_LEVEL_LENGTH);
+                for (int slot=0; slot<n_owned; slot++) {
+                        Vec3_MUL(newest[slot], block[slot], 0.5);
+                        Vec3_CLEAR(block[slot]);
+                }
+        }
+}
+
+void
+CEX_collect_msd(int reset, array_t **lags, array_t **msd)
+{
+        REQ_INIT();
+        if (msd_interval==0) {
+                Fatal("msd not setup");
+        }
+        int n_lags = ARR_LENGTH(msd_lags);
+        double sums[n_lags], counts[n_lags];
+        MPI_Reduce(ARR_DATA(lag_sums), sums, n_lags, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(ARR_DATA(lag_counts), counts, n_lags, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (reset) {
+                CEX_zero_array_elements(lag_sums);
+                CEX_zero_array_elements(lag_counts);
+        }
+        *lags = *msd = NULL;
+        if (!IS_MASTER()) {
+                return;
+        }
+        *lags = CEX_make_int_array(n_lags);
+        *msd = CEX_make_array(sizeof(double), n_lags);
+        for (int k=0; k<n_lags; k++) {
+                IARR_APPEND(*lags, ARR_INDEX_AS(int, msd_lags, k) * msd_interval);
+                ARR_APPEND(double, *msd, counts[k] > 0 ? sums[k] / counts[k] : 0.0);
+        }
+}
@@ -0,0 +1,47 @@
+/* -*- Mode: c -*-
+ * msd.h - Mean squared displacement accumulated during simulation
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _MSD_H
+#define _MSD_H
+
+#include "array.h"
+
+/* sample the unwrapped positions of all particles now and every
+ * `interval integration cycles (0 disables), accumulating the mean
+ * squared displacement at logarithmically spaced lags of up to
+ * `max_lag samples.  short lags are measured between samples and
+ * long lags between block averages of samples, as in a multiple-tau
+ * correlator.  discards any previous samples.  requires tags to be 0
+ * through N-1.  collective; must be called on every thread */
+void CEX_setup_msd(int interval, int max_lag);
+
+/* called on every thread after each integration cycle */
+void CEX_advance_msd(void);
+
+/* sum the accumulated squared displacements of all threads on the
+ * master, returning there new arrays of the lags (in integration
+ * cycles) and the mean squared displacement at each (meters^2, 0
+ * before any displacement is sampled at that lag).  when `reset the
+ * accumulated displacements are cleared, but not the time origins.
+ * collective */
+void CEX_collect_msd(int reset, array_t **lags, array_t **msd);
+
+#endif /* _MSD_H */
@@ -18,6 +18,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
+
 #include "msg.h"
 #include "mem.h"
 
@@ -53,18 +55,18 @@ CEX_msg_grow_writer(msg_t *msg)
 {
         REQ_MSG_OWN_BUFFER(msg);
         REQ_WMSG(msg);
-        int length = CEX_msg_len(msg);
+        size_t length = CEX_msg_len(msg);
         CEX_prealloc_msg(msg, length==0 ? 64 : length<<1);
         assert(!MSG_EOFP(msg));
 }
 
 void
-CEX_prealloc_msg(msg_t *msg, int req_len)
+CEX_prealloc_msg(msg_t *msg, size_t req_len)
 {
         REQ_MSG_OWN_BUFFER(msg);
         array_t *buffer = MSG_BUFFER(msg);
-        int start_offset = (int)(MSG_START(msg) - ARR_DATA_AS(char, buffer));
-        int ptr_offset = CEX_msg_tell(msg);
+        size_t start_offset = (size_t)(MSG_START(msg) - ARR_DATA_AS(char, buffer));
+        size_t ptr_offset = CEX_msg_tell(msg);
         CEX_prealloc_array(buffer, req_len+start_offset);
         MSG_START(msg) = ARR_DATA_AS(char, buffer) + start_offset;
         MSG_END(msg) = ARR_DATA_AS(char, buffer) + ARR_ALLOCED(buffer);
@@ -72,24 +74,24 @@ CEX_prealloc_msg(msg_t *msg, int req_len)
         assert(CEX_msg_tell(msg)==ptr_offset);
 }
 
-int
+size_t
 CEX_msg_len(msg_t *msg)
 {
-        return (int)(MSG_END(msg) - MSG_START(msg));        
+        return (size_t)(MSG_END(msg) - MSG_START(msg));
 }
 
-int
+size_t
 CEX_msg_tell(msg_t *msg)
 {
-        return (int)(MSG_PTR(msg) - MSG_START(msg));
+        return (size_t)(MSG_PTR(msg) - MSG_START(msg));
 }
 
 void
-CEX_msg_seek(msg_t *msg, int index)
+CEX_msg_seek(msg_t *msg, size_t index)
 {
-        if (index<0 || index >= CEX_msg_len(msg)) {
-                Fatal("seek %d out of range of message of length %d",
-                      index, CEX_msg_len(msg));
+        if (index >= CEX_msg_len(msg)) {
+                Fatal("seek %lu out of range of message of length %lu",
+                      (unsigned long)index, (unsigned long)CEX_msg_len(msg));
         }
         MSG_PTR(msg) = MSG_START(msg) + index;
 }
@@ -285,4 +287,135 @@ CEX_msg_read_vec_array(msg_t *msg)
 {
         return CEX_msg_read_array(msg, sizeof(vec_t), &vec_reader);
 }
-                
+
+/* Raw Blocks */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+#  define SWAP_RAW_BLOCKS
+#endif
+
+static void
+copy_raw_block(char *dst, const char *src, size_t n_words, size_t word_size)
+{
+#ifdef SWAP_RAW_BLOCKS
+        for (size_t i=0; i<n_words; i++, dst+=word_size, src+=word_size) {
+                for (size_t j=0; j<word_size; j++) {
+                        dst[j] = src[word_size-1-j];
+                }
+        }
+#else
+        memcpy(dst, src, n_words * word_size);
+#endif
+}
+
+static void
+write_raw_block(msg_t *msg, array_t *arr, size_t word_size)
+{
+        REQ_WMSG(msg);
+        unsigned int length = (unsigned int)ARR_LENGTH(arr);
+        if (unlikely((size_t)length != ARR_LENGTH(arr))) {
+                Fatal("cannot coere array length to unsigned int");
+        }
+        CEX_msg_write_uint(msg, length);
+        size_t n_bytes = ARR_LENGTH(arr) * ARR_EL_SIZE(arr);
+        if ((size_t)(MSG_END(msg) - MSG_PTR(msg)) < n_bytes) {
+                CEX_prealloc_msg(msg, CEX_msg_tell(msg) + n_bytes);
+        }
+        copy_raw_block(MSG_PTR(msg), ARR_DATA(arr), n_bytes / word_size, word_size);
+        MSG_PTR(msg) += n_bytes;
+}
+
+void
+CEX_msg_write_raw_int_array(msg_t *msg, array_t *arr)
+{
+        REQ_IARR(arr);
+        write_raw_block(msg, arr, sizeof(int));
+}
+
+void
+CEX_msg_write_raw_int64_array(msg_t *msg, array_t *arr)
+{
+        if (unlikely(ARR_EL_SIZE(arr)!=sizeof(int64_t))) {
+                Fatal("non int64 array (el_size=%lu)",
+                      (unsigned long)ARR_EL_SIZE(arr));
+        }
+        write_raw_block(msg, arr, sizeof(int64_t));
+}
+
+void
+CEX_msg_write_raw_double_array(msg_t *msg, array_t *arr)
+{
+        if (unlikely(ARR_EL_SIZE(arr)!=sizeof(double))) {
+                Fatal("non double array (el_size=%lu)",
+                      (unsigned long)ARR_EL_SIZE(arr));
+        }
+        write_raw_block(msg, arr, sizeof(double));
+}
+
+void
+CEX_msg_write_raw_vec_array(msg_t *msg, array_t *arr)
+{
+        REQ_VARR(arr);
+        write_raw_block(msg, arr, sizeof(double));
+}
+
+void
+CEX_msg_write_raw_int64(msg_t *msg, int64_t i)
+{
+        REQ_WMSG(msg);
+        if ((size_t)(MSG_END(msg) - MSG_PTR(msg)) < sizeof(int64_t)) {
+                CEX_prealloc_msg(msg, CEX_msg_tell(msg) + sizeof(int64_t));
+        }
+        copy_raw_block(MSG_PTR(msg), (const char *)&i, 1, sizeof(int64_t));
+        MSG_PTR(msg) += sizeof(int64_t);
+}
+
+static array_t *
+read_raw_block(msg_t *msg, size_t el_size, size_t word_size)
+{
+        size_t length = (size_t)CEX_msg_read_uint(msg);
+        size_t n_bytes = length * el_size;
+        if (unlikely((size_t)(MSG_END(msg) - MSG_PTR(msg)) < n_bytes)) {
+                Fatal("underflow in message reading");
+        }
+        array_t *arr = CEX_make_array(el_size, length);
+        copy_raw_block(ARR_DATA(arr), MSG_PTR(msg), n_bytes / word_size, word_size);
+        ARR_LENGTH(arr) = length;
+        MSG_PTR(msg) += n_bytes;
+        return arr;
+}
+
+array_t *
+CEX_msg_read_raw_int_array(msg_t *msg)
+{
+        return read_raw_block(msg, sizeof(int), sizeof(int));
+}
+
+array_t *
+CEX_msg_read_raw_int64_array(msg_t *msg)
+{
+        return read_raw_block(msg, sizeof(int64_t), sizeof(int64_t));
+}
+
+array_t *
+CEX_msg_read_raw_double_array(msg_t *msg)
+{
+        return read_raw_block(msg, sizeof(double), sizeof(double));
+}
+
+array_t *
+CEX_msg_read_raw_vec_array(msg_t *msg)
+{
+        return read_raw_block(msg, sizeof(vec_t), sizeof(double));
+}
+
+int64_t
+CEX_msg_read_raw_int64(msg_t *msg)
+{
+        int64_t i;
+        if (unlikely((size_t)(MSG_END(msg) - MSG_PTR(msg)) < sizeof(int64_t))) {
+                Fatal("underflow in message reading");
+        }
+        copy_raw_block((char *)&i, MSG_PTR(msg), 1, sizeof(int64_t));
+        MSG_PTR(msg) += sizeof(int64_t);
+        return i;
+}
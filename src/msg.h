@@ -22,6 +22,8 @@
 #ifndef _MSG_H
 #define _MSG_H
 
+#include <stdint.h>
+
 #include "opt.h"
 #include "debug.h"
 #include "array.h"
@@ -45,10 +47,11 @@ typedef struct {
 #define MSG_EOFP(msg) (MSG_PTR(msg)==MSG_END(msg))
 
 void CEX_free_msg(msg_t *);
-int CEX_msg_len(msg_t *); //GCC_ATTRIBUTE((pure));
-int CEX_msg_tell(msg_t *); //GCC_ATTRIBUTE((pure));
-void CEX_msg_seek(msg_t *, int);
-void CEX_prealloc_msg(msg_t *msg, int req_len);
+/* lengths and offsets are size_t, s.t. messages can exceed 2 GB */
+size_t CEX_msg_len(msg_t *); //GCC_ATTRIBUTE((pure));
+size_t CEX_msg_tell(msg_t *); //GCC_ATTRIBUTE((pure));
+void CEX_msg_seek(msg_t *, size_t);
+void CEX_prealloc_msg(msg_t *msg, size_t req_len);
 
 #define REQ_MSG_OWN_BUFFER(msg) do {                     \
       if (unlikely(!MSG_OWN_BUFFER(msg))) {              \
@@ -108,14 +111,36 @@ array_t *CEX_msg_read_double_array(msg_t *);
 vec_t CEX_msg_read_vec(msg_t *);
 array_t *CEX_msg_read_vec_array(msg_t *);
 
+/* Raw Blocks
+ * Arrays of ints, doubles and vectors can alternatively be encoded as
+ * their length (as an uint) followed by a single block of 32-bit
+ * integers or IEEE doubles in little-endian byte order.  These are
+ * exact and, on little-endian machines, are copied in and out of a
+ * message with a single memcpy, as opposed to element by element.
+ * Arrays of int64_t (e.g. particle tags) are likewise encoded as a
+ * block of 64-bit integers, and a single int64_t (e.g. an integration
+ * cycle) as one such integer without a length.
+ */
+void CEX_msg_write_raw_int_array(msg_t *, array_t *);
+void CEX_msg_write_raw_int64_array(msg_t *, array_t *);
+void CEX_msg_write_raw_double_array(msg_t *, array_t *);
+void CEX_msg_write_raw_vec_array(msg_t *, array_t *);
+void CEX_msg_write_raw_int64(msg_t *, int64_t);
+array_t *CEX_msg_read_raw_int_array(msg_t *);
+array_t *CEX_msg_read_raw_int64_array(msg_t *);
+array_t *CEX_msg_read_raw_double_array(msg_t *);
+array_t *CEX_msg_read_raw_vec_array(msg_t *);
+int64_t CEX_msg_read_raw_int64(msg_t *);
+
 #define REQ_MSG_EOFP(msg_form) do {                      \
       msg_t *_tmp_msg = (msg_form);                      \
       REQ_RMSG(_tmp_msg);                                     \
       if (unlikely(!MSG_EOFP(_tmp_msg))) {                    \
-              Fatal("expected EOFP with %d of %d "            \
+              Fatal("expected EOFP with %lu of %lu "          \
                     "character remaining",                         \
-                    CEX_msg_len(_tmp_msg) - CEX_msg_tell(_tmp_msg), \
-                    CEX_msg_len(_tmp_msg));                        \
+                    (unsigned long)(CEX_msg_len(_tmp_msg) -        \
+                                    CEX_msg_tell(_tmp_msg)),       \
+                    (unsigned long)CEX_msg_len(_tmp_msg));         \
       }                                                            \
 } while (0)                
 
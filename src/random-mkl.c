@@ -75,3 +75,28 @@ CEX_generate_gauss_vector(vec_t *vec, double sigma)
         vec->y = buffer[1];
         vec->z = buffer[2];
 }
+
+size_t
+CEX_random_state_size(void)
+{
+        if (unlikely(!initialized)) {
+                Fatal("random number generator not yet initialized");
+        }
+        return vslGetStreamSize(stream);
+}
+
+void
+CEX_save_random_state(void *buffer)
+{
+        check_vsl_error(vslSaveStreamM(stream, buffer));
+}
+
+void
+CEX_restore_random_state(const void *buffer)
+{
+        if (initialized) {
+                check_vsl_error(vslDeleteStream(&stream));
+        }
+        check_vsl_error(vslLoadStreamM(&stream, buffer));
+        initialized = 1;
+}
@@ -36,8 +36,11 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 #include "opt.h"
+#include "debug.h"
+#include "mem.h"
 #include "vector.h"
 #include "array.h"
 #include "random.h"
@@ -160,3 +163,36 @@ CEX_generate_gauss_vector(vec_t *vec, double sigma)
         rnd_gen_gauss2(&(vec->z), &holder);
         Vec3_MULTO(*vec, sigma);
 }
+
+/* state array followed by the number of words left and the offset of
+ * the next word */
+size_t
+CEX_random_state_size(void)
+{
+        return (rnd_N + 2) * sizeof(rnd_int_t);
+}
+
+void
+CEX_save_random_state(void *buffer)
+{
+        if (unlikely(!initialized)) {
+                Fatal("random number generator not yet initialized");
+        }
+        rnd_int_t *words = buffer;
+        XMEMCPY(rnd_int_t, words, ARR_DATA(CEX_rstate), rnd_N);
+        words[rnd_N] = CEX_rleft;
+        words[rnd_N+1] = CEX_rnext - ARR_DATA_AS(rnd_int_t, CEX_rstate);
+}
+
+void
+CEX_restore_random_state(const void *buffer)
+{
+        const rnd_int_t *words = buffer;
+        if (words[rnd_N] > rnd_N || words[rnd_N+1] > rnd_N) {
+                Fatal("corrupt random number generator state");
+        }
+        CEX_seed_random(0);
+        XMEMCPY(rnd_int_t, ARR_DATA(CEX_rstate), words, rnd_N);
+        CEX_rleft = words[rnd_N];
+        CEX_rnext = ARR_DATA_AS(rnd_int_t, CEX_rstate) + words[rnd_N+1];
+}
@@ -30,4 +30,10 @@ void CEX_generate_gauss(array_t *place, double sigma2)
 void CEX_generate_gauss_vector(vec_t *vec, double sigma2)
         GCC_ATTRIBUTE((noinline));
 
+/* the complete state of the generator, s.t. a simulation restored from
+ * a checkpoint continues with the same random numbers */
+size_t CEX_random_state_size(void);
+void CEX_save_random_state(void *buffer);
+void CEX_restore_random_state(const void *buffer);
+
 #endif /* _RANDOM_H */
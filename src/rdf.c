@@ -0,0 +1,141 @@
+/* -*- Mode: c -*-
+ * rdf.c - Radial distribution function accumulated from neighbor lists
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* Radial Distribution Function
+ * -------------------------------------------------------------------
+ * Rather than saving configurations only to histogram pair separations
+ * afterwards, each thread periodically histograms the separations of
+ * the pairs in its neighbor lists, which already hold every pair
+ * within the pair cutoff.  Positions are sampled right after forces
+ * are evaluated, when the halo positions are current.  A pair of an
+ * internal and an external particle is listed by both threads and
+ * hence counts one half on each.
+ */
+
+#include <mpi.h>
+#include <math.h>
+
+#include "opt.h"
+#include "constants.h"
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "periodic.h"
+#include "bd.h"
+#include "init.h"
+#include "rdf.h"
+
+static int rdf_interval=0;
+static int evaluations_since_sample=0;
+static int rdf_samples=0;
+static double rdf_r_max=0;
+static array_t *rdf_histogram=NULL;
+
+void
+CEX_setup_rdf(int n_bins, double r_max, int interval)
+{
+        REQ_INIT();
+        if (interval < 0) {
+                Fatal("bad rdf interval %d", interval);
+        }
+        if (n_bins <= 0) {
+                Fatal("bad number of rdf bins %d", n_bins);
+        }
+        if (!(r_max > 0 && r_max <= CEX_r_pair_cutoff)) {
+                Fatal("bad rdf range %.3g (nm); must be in range (0:%.3g]",
+                      r_max / CEX_nm, CEX_r_pair_cutoff / CEX_nm);
+        }
+        CEX_free_array(rdf_histogram);
+        rdf_histogram = CEX_make_array(sizeof(double), n_bins);
+        ARR_LENGTH(rdf_histogram) = n_bins;
+        CEX_zero_array_elements(rdf_histogram);
+        rdf_r_max = r_max;
+        rdf_interval = interval;
+        evaluations_since_sample = 0;
+        rdf_samples = 0;
+        if (IS_MASTER()) {
+                xprintf("sampling rdf in %d bins to %.2f (nm) every %d force evaluations",
+                        n_bins, r_max / CEX_nm, interval);
+        }
+}
+
+static inline void
+histogram_pairs(array_t *neighbors, double weight)
+{
+        vec_t _box_size=CEX_box_size, _box_half=CEX_box_half;
+        const vec_t * CEX_RESTRICT _positions=ARR_DATA_AS(vec_t, CEX_positions);
+        double * CEX_RESTRICT _histogram=ARR_DATA_AS(double, rdf_histogram);
+        double r_max_sqr = rdf_r_max * rdf_r_max;
+        double inv_bin_width = ARR_LENGTH(rdf_histogram) / rdf_r_max;
+        int last_bin = ARR_LENGTH(rdf_histogram) - 1;
+        for (int n_counter=ARR_LENGTH(neighbors) >> 1,
+             *n_ptr=ARR_DATA_AS(int, neighbors);
+             n_counter -- > 0;) {
+                int part_i = *(n_ptr++);
+                int part_j = *(n_ptr++);
+                vec_t r;
+                XPERIODIC_SEPARATION_VECTOR(r, _positions[part_i], _positions[part_j],
+                                            _box_size, _box_half);
+                double rsqr = Vec3_SQR(r);
+                if (rsqr < r_max_sqr) {
+                        int bin = (int)(sqrt(rsqr) * inv_bin_width);
+                        _histogram[bin < last_bin ? bin : last_bin] += weight;
+                }
+        }
+}
+
+void
+CEX_advance_rdf(void)
+{
+        if (likely(rdf_interval==0 || ++evaluations_since_sample < rdf_interval)) {
+                return;
+        }
+        evaluations_since_sample = 0;
+        histogram_pairs(CEX_internal_neighbors, 1.0);
+        histogram_pairs(CEX_external_neighbors, 0.5);
+        rdf_samples ++;
+}
+
+array_t *
+CEX_collect_rdf(int reset, int *n_samples, int *n_particles)
+{
+        REQ_INIT();
+        if (rdf_histogram==NULL) {
+                Fatal("rdf not setup");
+        }
+        int n_bins = ARR_LENGTH(rdf_histogram);
+        array_t *histogram = NULL;
+        if (IS_MASTER()) {
+                histogram = CEX_make_array(sizeof(double), n_bins);
+                ARR_LENGTH(histogram) = n_bins;
+        }
+        MPI_Reduce(ARR_DATA(rdf_histogram), IS_MASTER() ? ARR_DATA(histogram) : NULL,
+                   n_bins, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&CEX_N_internal_particles, n_particles, 1, MPI_INT, MPI_SUM,
+                   0, MPI_COMM_WORLD);
+        *n_samples = rdf_samples;
+        if (reset) {
+                CEX_zero_array_elements(rdf_histogram);
+                rdf_samples = 0;
+        }
+        return histogram;
+}
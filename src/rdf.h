@@ -0,0 +1,43 @@
+/* -*- Mode: c -*-
+ * rdf.h - Radial distribution function accumulated from neighbor lists
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _RDF_H
+#define _RDF_H
+
+#include "array.h"
+
+/* accumulate pair separations below `r_max into `n_bins equal bins
+ * every `interval force evaluations (0 disables), discarding any
+ * previous histogram.  r_max may not exceed the pair cutoff, within
+ * which the neighbor lists hold every pair.  collective; must be called
+ * on every thread */
+void CEX_setup_rdf(int n_bins, double r_max, int interval);
+
+/* called on every thread after each force evaluation */
+void CEX_advance_rdf(void);
+
+/* sum the histograms of all threads on the master, returning there a
+ * new array of the pair count in each bin along with the number of
+ * samples and the total number of particles.  when `reset the
+ * histograms are cleared.  collective */
+array_t *CEX_collect_rdf(int reset, int *n_samples, int *n_particles);
+
+#endif /* _RDF_H */
@@ -0,0 +1,210 @@
+/* -*- Mode: c -*-
+ * ring.c - Shared memory transport between master and control process
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Shared Memory Transport
+ * -------------------------------------------------------------------
+ * Instead of streaming every message through the fifos, the control
+ * process can create a file in /dev/shm that both it and the master
+ * map.  The file holds
+ *
+ *   o A header page of counters (ring_header_t)
+ *
+ *   o A single-producer/single-consumer ring of commands written by
+ *     the control process.  Each record is a ring_record_t followed by
+ *     the command (padded to 8 bytes).  The control process advances
+ *     cmd_head after writing a record and the master advances cmd_tail
+ *     after reading it, so neither takes a lock.
+ *
+ *   o A region for large payloads.  Commands too large for the ring
+ *     are written here by the control process and read in place by the
+ *     master, and every reply is copied here by the master.  Either
+ *     side grows the file when the region is too small, and the other
+ *     remaps when it sees the larger region_size.
+ *
+ * The fifos remain only as doorbells: the control process writes one
+ * byte after each command and the master one byte after each reply, s.t.
+ * both block in read() instead of polling.  As the control process waits
+ * for each reply before writing its next command, the region is never
+ * in use by both at once.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "mem.h"
+#include "msg.h"
+#include "ring.h"
+
+#define RING_MAGIC 0x50424452U /* PBDR */
+#define RING_VERSION 2U
+#define RING_HEADER_SIZE 4096
+
+/* layout shared with pbd.cex.SharedRing */
+typedef struct {
+        uint32_t magic, version;
+        uint64_t ring_size;     /* bytes in command ring; power of 2 */
+        uint64_t region_size;   /* bytes in payload region */
+        uint64_t cmd_head;      /* bytes ever written to ring */
+        uint64_t cmd_tail;      /* bytes ever read from ring */
+        uint64_t reply_length;  /* bytes of last reply in region */
+} ring_header_t;
+
+typedef struct {
+        uint32_t rank;
+        uint32_t in_region;     /* command is in region, not ring */
+        uint64_t length;
+} ring_record_t;
+
+#define RECORD_PAD(n) (((n) + 7) & ~(uint64_t)7)
+
+static int ring_fd=-1;
+static char *ring_map=NULL;
+static size_t ring_mapped=0;
+/* view of a command left in the region */
+static msg_t region_view = {NULL, NULL, NULL, NULL, MSG_R, 0};
+
+#define HEADER ((volatile ring_header_t *)ring_map)
+#define RING_DATA (ring_map + RING_HEADER_SIZE)
+#define REGION_DATA (ring_map + RING_HEADER_SIZE + HEADER->ring_size)
+#define FILE_SIZE(region_size) (RING_HEADER_SIZE + HEADER->ring_size + (region_size))
+
+static void
+map_file(size_t size)
+{
+        if (ring_map!=NULL) {
+                munmap(ring_map, ring_mapped);
+        }
+        ring_map = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, ring_fd, 0);
+        if (ring_map==MAP_FAILED) {
+                Fatal("failed to map %lu bytes of shared memory; %.200s (errno=%d)",
+                      (unsigned long)size, strerror(errno), errno);
+        }
+        ring_mapped = size;
+}
+
+void
+CEX_ring_attach(const char *path)
+{
+        ring_fd = open(path, O_RDWR);
+        if (ring_fd < 0) {
+                Fatal("failed to open %.200s; %.200s (errno=%d)",
+                      path, strerror(errno), errno);
+        }
+        map_file(RING_HEADER_SIZE);
+        if (HEADER->magic!=RING_MAGIC || HEADER->version!=RING_VERSION) {
+                Fatal("%.200s isn't a version %u command ring", path, RING_VERSION);
+        }
+        uint64_t ring_size = HEADER->ring_size;
+        if (ring_size==0 || (ring_size & (ring_size-1)) || ring_size % 8) {
+                Fatal("bad ring size %lu", (unsigned long)ring_size);
+        }
+        map_file(FILE_SIZE(HEADER->region_size));
+        xprintf("exchanging messages through shared memory %.200s "
+                "(ring %lu bytes, region %lu bytes)", path,
+                (unsigned long)HEADER->ring_size, (unsigned long)HEADER->region_size);
+}
+
+/* remap when the control process has grown the region */
+static void
+sync_region_size(void)
+{
+        size_t size = FILE_SIZE(HEADER->region_size);
+        if (size > ring_mapped) {
+                map_file(size);
+        }
+}
+
+static void
+copy_from_ring(void *dst, uint64_t pos, size_t size)
+{
+        uint64_t mask = HEADER->ring_size - 1;
+        size_t offset = pos & mask;
+        size_t first = HEADER->ring_size - offset;
+        if (first >= size) {
+                memcpy(dst, RING_DATA + offset, size);
+        } else {
+                memcpy(dst, RING_DATA + offset, first);
+                memcpy((char *)dst + first, RING_DATA, size - first);
+        }
+}
+
+msg_t *
+CEX_ring_read_command(msg_t *recv, unsigned int *rank)
+{
+        ring_record_t record;
+        uint64_t tail = HEADER->cmd_tail;
+        uint64_t head = __atomic_load_n(&((ring_header_t *)ring_map)->cmd_head,
+                                        __ATOMIC_ACQUIRE);
+        if (unlikely(head - tail < sizeof(record))) {
+                Fatal("doorbell rung without command in ring");
+        }
+        copy_from_ring(&record, tail, sizeof(record));
+        *rank = record.rank;
+        uint64_t record_size = sizeof(record);
+        msg_t *msg;
+        if (record.in_region) {
+                sync_region_size();
+                if (unlikely(record.length > HEADER->region_size)) {
+                        Fatal("command of %lu bytes overflows region",
+                              (unsigned long)record.length);
+                }
+                msg = &region_view;
+                MSG_START(msg) = REGION_DATA;
+                MSG_END(msg) = MSG_START(msg) + record.length;
+        } else {
+                msg = recv;
+                MSG_END(msg) = MSG_START(msg) + ARR_LENGTH(MSG_BUFFER(msg));
+                CEX_prealloc_msg(msg, record.length);
+                copy_from_ring(MSG_START(msg), tail + sizeof(record), record.length);
+                MSG_END(msg) = MSG_START(msg) + record.length;
+                record_size += RECORD_PAD(record.length);
+        }
+        MSG_PTR(msg) = MSG_START(msg);
+        __atomic_store_n(&((ring_header_t *)ring_map)->cmd_tail, tail + record_size,
+                         __ATOMIC_RELEASE);
+        return msg;
+}
+
+void
+CEX_ring_write_reply(msg_t *send)
+{
+        uint64_t length = CEX_msg_len(send);
+        sync_region_size();
+        if (length > HEADER->region_size) {
+                uint64_t region_size = 2 * HEADER->region_size;
+                region_size = region_size < length ? length : region_size;
+                if (ftruncate(ring_fd, FILE_SIZE(region_size)) != 0) {
+                        Fatal("failed to grow shared memory to %lu bytes; %.200s (errno=%d)",
+                              (unsigned long)FILE_SIZE(region_size), strerror(errno), errno);
+                }
+                HEADER->region_size = region_size;
+                map_file(FILE_SIZE(region_size));
+        }
+        memcpy(REGION_DATA, MSG_START(send), length);
+        __atomic_store_n(&((ring_header_t *)ring_map)->reply_length, length,
+                         __ATOMIC_RELEASE);
+}
@@ -0,0 +1,40 @@
+/* -*- Mode: c -*-
+ * ring.h - Shared memory transport between master and control process
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include "msg.h"
+
+/* map the shared memory file created by the control process */
+void CEX_ring_attach(const char *path);
+
+/* take the next command from the ring, returning its message along
+ * with the rank it's addressed to.  the returned message is either
+ * `recv (filled with a copy of the command) or a view of a large
+ * command left in place in the shared region, valid until the reply
+ * is written */
+msg_t *CEX_ring_read_command(msg_t *recv, unsigned int *rank);
+
+/* copy the reply to the last command into the shared region, growing
+ * the region when it's too small */
+void CEX_ring_write_reply(msg_t *send);
+
+#endif /* _RING_H */
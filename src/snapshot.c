@@ -0,0 +1,139 @@
+/* -*- Mode: c -*-
+ * snapshot.c - Snapshots of positions collected while integrating
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Snapshots
+ * -------------------------------------------------------------------
+ * Collecting positions through collect_thread_positions_and_tags
+ * leaves every thread idle until the control process has read each
+ * thread's reply in turn.  A snapshot instead copies the internal
+ * positions and tags of each thread into a side buffer and posts
+ * non-blocking sends of it to the master, which posts the matching
+ * recieves into a single frame.  The transfer then proceeds during the
+ * following integration cycles, and the master only waits on it when
+ * the snapshot is fetched.  Messages go over a duplicate of
+ * MPI_COMM_WORLD s.t. they can't match those of comm rules.
+ */
+
+#include <mpi.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "opt.h"
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "bd.h"
+#include "init.h"
+#include "snapshot.h"
+
+static MPI_Comm snapshot_comm=MPI_COMM_NULL;
+/* on the master, the frame of every thread; on slaves, the side
+ * buffer of this thread */
+static array_t *snapshot_positions=NULL;
+static array_t *snapshot_tags=NULL;
+static MPI_Request *requests=NULL;
+static int n_requests=0;
+static int have_snapshot=0;
+/* master only */
+static int *counts=NULL;
+static int64_t *displs=NULL;
+
+enum {
+        POSITIONS_TAG=1,
+        TAGS_TAG
+};
+
+void
+CEX_complete_snapshot(void)
+{
+        if (n_requests) {
+                MPI_Waitall(n_requests, requests, MPI_STATUSES_IGNORE);
+                n_requests = 0;
+        }
+}
+
+void
+CEX_take_snapshot(void)
+{
+        REQ_INIT();
+        if (snapshot_comm==MPI_COMM_NULL) {
+                MPI_Comm_dup(MPI_COMM_WORLD, &snapshot_comm);
+                snapshot_positions = CEX_make_vec_array(0);
+                snapshot_tags = CEX_make_array(sizeof(tag_t), 0);
+                requests = XNEW(MPI_Request, 2*CEX_size);
+                if (IS_MASTER()) {
+                        counts = XNEW(int, CEX_size);
+                        displs = XNEW(int64_t, CEX_size);
+                }
+        }
+        /* the buffers are reused */
+        CEX_complete_snapshot();
+
+        MPI_Datatype vec_type = CEX_record_datatype(sizeof(vec_t));
+        int n = CEX_N_internal_particles;
+        MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, snapshot_comm);
+        if (IS_MASTER()) {
+                int64_t total = 0;
+                for (int rank=0; rank<CEX_size; rank++) {
+                        displs[rank] = total;
+                        total += counts[rank];
+                }
+                CEX_prealloc_array(snapshot_positions, total);
+                CEX_prealloc_array(snapshot_tags, total);
+                ARR_LENGTH(snapshot_positions) = ARR_LENGTH(snapshot_tags) = total;
+                for (int rank=1; rank<CEX_size; rank++) {
+                        if (!counts[rank]) {
+                                continue;
+                        }
+                        MPI_Irecv(ARR_ADDRESS_ELEMENT(snapshot_positions, displs[rank]),
+                                  counts[rank], vec_type,
+                                  rank, POSITIONS_TAG, snapshot_comm, &requests[n_requests++]);
+                        MPI_Irecv(ARR_ADDRESS_ELEMENT(snapshot_tags, displs[rank]),
+                                  counts[rank], TAG_MPI_TYPE,
+                                  rank, TAGS_TAG, snapshot_comm, &requests[n_requests++]);
+                }
+        } else {
+                CEX_prealloc_array(snapshot_positions, n);
+                CEX_prealloc_array(snapshot_tags, n);
+                ARR_LENGTH(snapshot_positions) = ARR_LENGTH(snapshot_tags) = n;
+        }
+        XMEMCPY(vec_t, ARR_DATA(snapshot_positions), ARR_DATA(CEX_positions), n);
+        XMEMCPY(tag_t, ARR_DATA(snapshot_tags), ARR_DATA(CEX_tags), n);
+        if (!IS_MASTER() && n) {
+                MPI_Isend(ARR_DATA(snapshot_positions), n, vec_type,
+                          0, POSITIONS_TAG, snapshot_comm, &requests[n_requests++]);
+                MPI_Isend(ARR_DATA(snapshot_tags), n, TAG_MPI_TYPE,
+                          0, TAGS_TAG, snapshot_comm, &requests[n_requests++]);
+        }
+        have_snapshot = 1;
+}
+
+void
+CEX_fetch_snapshot(array_t **positions, array_t **tags)
+{
+        REQ_MASTER();
+        if (!have_snapshot) {
+                Fatal("no snapshot taken");
+        }
+        CEX_complete_snapshot();
+        *positions = snapshot_positions;
+        *tags = snapshot_tags;
+}
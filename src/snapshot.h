@@ -0,0 +1,42 @@
+/* -*- Mode: c -*-
+ * snapshot.h - Snapshots of positions collected while integrating
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include "array.h"
+
+/* copy the positions and tags of the internal particles of this
+ * thread into a side buffer and start sending it to the master,
+ * s.t. integration can resume while the snapshot is collected.
+ * replaces any earlier snapshot.  collective */
+void CEX_take_snapshot(void);
+
+/* on the master, wait for the last snapshot to be recieved and set
+ * `positions and `tags to the positions and tags of every thread,
+ * concatenated in order of rank.  the arrays are owned by this module
+ * and valid until the next snapshot */
+void CEX_fetch_snapshot(array_t **positions, array_t **tags);
+
+/* wait for the sends or recieves of the last snapshot on this thread
+ * to complete; required before exiting */
+void CEX_complete_snapshot(void);
+
+#endif /* _SNAPSHOT_H */
@@ -0,0 +1,118 @@
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "ctraj.h"
+
+#define COORDINATE(vec_p, axis) (((double *)(vec_p))[axis])
+
+#define N_PARTICLES 1000
+#define N_FRAMES 23
+#define KEYFRAME_INTERVAL 5
+#define PRECISION 1e-5
+
+static const char *path = "testctraj.tmp";
+static vec_t box_size = {2e-6, 3e-6, 1.5e-6};
+static vec_t frames[N_FRAMES][N_PARTICLES];
+
+static double
+uniform(void)
+{
+        return rand() / (RAND_MAX + 1.0);
+}
+
+/* random walk across the periodic boundaries, with occasional large
+ * jumps s.t. some blocks need wide values */
+static void
+generate_frames(void)
+{
+        for (int f=0; f<N_FRAMES; f++) {
+                for (int i=0; i<N_PARTICLES; i++) {
+                        for (int axis=0; axis<3; axis++) {
+                                double L = COORDINATE(&box_size, axis);
+                                double x;
+                                if (f==0) {
+                                        x = L * uniform();
+                                } else {
+                                        double step = (uniform() < 0.01 ? 0.5 : 1e-3) * L;
+                                        x = COORDINATE(&frames[f-1][i], axis) +
+                                                step * (2*uniform() - 1);
+                                        x = fmod(x + L, L);
+                                }
+                                COORDINATE(&frames[f][i], axis) = x;
+                        }
+                }
+        }
+}
+
+static void
+check_frame(ctraj_t *traj, int f)
+{
+        vec_t positions[N_PARTICLES];
+        int64_t cycle = CEX_ctraj_read_frame(traj, f, positions);
+        if (cycle!=100*f) {
+                Fatal("frame %d has cycle %ld", f, (long)cycle);
+        }
+        for (int i=0; i<N_PARTICLES; i++) {
+                for (int axis=0; axis<3; axis++) {
+                        double L = COORDINATE(&box_size, axis);
+                        double error = fabs(COORDINATE(&positions[i], axis) -
+                                            COORDINATE(&frames[f][i], axis));
+                        if (error > 0.5 * PRECISION * L * (1 + 1e-9)) {
+                                Fatal("frame %d particle %d axis %d off by %.3e",
+                                      f, i, axis, error);
+                        }
+                }
+        }
+}
+
+int
+main(int argc, char **argv)
+{
+        generate_frames();
+        ctraj_t *traj = CEX_ctraj_create(path, box_size, PRECISION,
+                                         N_PARTICLES, KEYFRAME_INTERVAL);
+        for (int f=0; f<N_FRAMES; f++) {
+                CEX_ctraj_append(traj, 100*f, frames[f]);
+        }
+        long size = ftell(traj->fp);
+        CEX_ctraj_close(traj);
+        printf("%d frames in %ld bytes (%.2f bytes/coordinate)\n",
+               N_FRAMES, size, size / (3.0 * N_PARTICLES * N_FRAMES));
+
+        traj = CEX_ctraj_open(path);
+        if (traj->n_frames!=N_FRAMES) {
+                Fatal("read %d frames; expected %d", traj->n_frames, N_FRAMES);
+        }
+        /* sequentially, then seeking backwards */
+        for (int f=0; f<N_FRAMES; f++) {
+                check_frame(traj, f);
+        }
+        for (int f=N_FRAMES-1; f>=0; f-=3) {
+                check_frame(traj, f);
+        }
+        check_frame(traj, 7);
+        check_frame(traj, 7);
+        CEX_ctraj_close(traj);
+
+        /* a partially written frame is ignored */
+        if (truncate(path, size - 5)!=0) {
+                Fatal("failed to truncate %s", path);
+        }
+        traj = CEX_ctraj_open(path);
+        if (traj->n_frames!=N_FRAMES-1) {
+                Fatal("read %d frames of truncated file", traj->n_frames);
+        }
+        check_frame(traj, N_FRAMES-2);
+        CEX_ctraj_close(traj);
+        unlink(path);
+        printf("ok\n");
+        return 0;
+}
@@ -1,6 +1,7 @@
 
 #include "msg.h"
 #include <assert.h>
+#include <stdint.h>
 #include <math.h>
 
 #ifdef NDEBUG
@@ -209,6 +210,57 @@ test_vec_array()
         CEX_free_array(pos2);
 }
 
+static void
+test_raw_arrays()
+{
+        array_t *ints = CEX_make_int_array(0);
+        array_t *longs = CEX_make_array(sizeof(int64_t), 0);
+        array_t *doubles = CEX_make_array(sizeof(double), 0);
+        array_t *pos = CEX_make_vec_array(0);
+        for (int i=0; i<1000; i++) {
+                IARR_APPEND(ints, i % 2 ? -i*i : i*i);
+                ARR_APPEND(int64_t, longs, ((int64_t)i << 40) + i);
+                ARR_APPEND(double, doubles, sin(i) * pow(10, i % 40 - 20));
+                add_vec(pos, i*M_PI, -1.0/(i+1), 1e-9*i);
+        }
+        msg_t *msg = CEX_make_write_msg(0);
+        CEX_msg_write_raw_int_array(msg, ints);
+        CEX_msg_write_raw_double_array(msg, doubles);
+        CEX_msg_write_raw_vec_array(msg, pos);
+        CEX_msg_write_raw_int64_array(msg, longs);
+        CEX_msg_write_raw_int64(msg, -((int64_t)1 << 40) - 3);
+        setup_read(msg);
+        /* length followed by little-endian words */
+        assert(CEX_msg_read_uint(msg)==1000);
+        assert(CEX_msg_read_char(msg)==0);
+        CEX_msg_seek(msg, 12);
+        assert(CEX_msg_read_char(msg)==4);
+        assert(CEX_msg_read_char(msg)==0);
+        CEX_msg_seek(msg, 0);
+        array_t *ints2 = CEX_msg_read_raw_int_array(msg);
+        array_t *doubles2 = CEX_msg_read_raw_double_array(msg);
+        array_t *pos2 = CEX_msg_read_raw_vec_array(msg);
+        array_t *longs2 = CEX_msg_read_raw_int64_array(msg);
+        assert(CEX_msg_read_raw_int64(msg) == -((int64_t)1 << 40) - 3);
+        REQ_MSG_EOFP(msg);
+        CEX_free_msg(msg);
+        /* exact copies */
+        assert(ARR_LENGTH(ints2)==1000 && ARR_LENGTH(doubles2)==1000 && ARR_LENGTH(pos2)==1000);
+        assert(memcmp(ARR_DATA(ints), ARR_DATA(ints2), 1000*sizeof(int))==0);
+        assert(memcmp(ARR_DATA(doubles), ARR_DATA(doubles2), 1000*sizeof(double))==0);
+        assert(memcmp(ARR_DATA(pos), ARR_DATA(pos2), 1000*sizeof(vec_t))==0);
+        assert(ARR_LENGTH(longs2)==1000);
+        assert(memcmp(ARR_DATA(longs), ARR_DATA(longs2), 1000*sizeof(int64_t))==0);
+        CEX_free_array(ints);
+        CEX_free_array(ints2);
+        CEX_free_array(longs);
+        CEX_free_array(longs2);
+        CEX_free_array(doubles);
+        CEX_free_array(doubles2);
+        CEX_free_array(pos);
+        CEX_free_array(pos2);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -219,5 +271,6 @@ main(int argc, char **argv)
         test_double();
         test_vec();
         test_vec_array();
+        test_raw_arrays();
         return 0;
 }
@@ -0,0 +1,277 @@
+/* -*- Mode: c -*-
+ * traj.c - Trajectory output written by every thread through MPI-IO
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Trajectory Output
+ * -------------------------------------------------------------------
+ * Instead of collecting positions through the master and the control
+ * process, every thread writes the records of its own internal
+ * particles straight into a shared file.  An exclusive scan of the
+ * particle counts gives each thread its offset within the frame and a
+ * single collective write places all records (and the frame header,
+ * written by the master).  The master alone appends an entry to the
+ * index file for each frame.
+ *
+ * Alternatively, the positions of all threads are gathered on the
+ * master, ordered by tag and appended to a compressed trajectory (see
+ * ctraj.c) at a fraction of the size.
+ */
+
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "mem.h"
+#include "array.h"
+#include "comm.h"
+#include "periodic.h"
+#include "bd.h"
+#include "init.h"
+#include "ctraj.h"
+#include "traj.h"
+
+#define TRAJ_CLOSED 0
+#define TRAJ_RAW 1
+#define TRAJ_COMPRESSED 2
+
+static int traj_format=TRAJ_CLOSED;
+static MPI_File traj_file=MPI_FILE_NULL;
+static FILE *index_fp=NULL;
+static MPI_Offset frame_offset=0;
+static int frame_interval=0;
+static int64_t traj_cycle=0;
+static array_t *frame_buffer=NULL;
+/* compressed trajectories; only on master */
+static ctraj_t *ctraj=NULL;
+static array_t *tag_positions=NULL;
+
+static void
+check_mpi_io(int res, const char *what)
+{
+        if (unlikely(res!=MPI_SUCCESS)) {
+                char error[MPI_MAX_ERROR_STRING];
+                int len;
+                MPI_Error_string(res, error, &len);
+                Fatal("%.50s failed; %.200s", what, error);
+        }
+}
+
+void
+CEX_open_trajectory(const char *path, int interval, int64_t cycle)
+{
+        REQ_INIT();
+        if (interval < 0) {
+                Fatal("bad trajectory interval %d", interval);
+        }
+        CEX_close_trajectory();
+        traj_format = TRAJ_RAW;
+        check_mpi_io(MPI_File_open(MPI_COMM_WORLD, (char *)path,
+                                   MPI_MODE_CREATE|MPI_MODE_WRONLY,
+                                   MPI_INFO_NULL, &traj_file),
+                     "MPI_File_open");
+        check_mpi_io(MPI_File_set_size(traj_file, 0), "MPI_File_set_size");
+        if (IS_MASTER()) {
+                char index_path[strlen(path) + 7];
+                sprintf(index_path, "%s.index", path);
+                index_fp = fopen(index_path, "wb");
+                if (index_fp==NULL) {
+                        Fatal("failed to open %.200s; %.200s (errno=%d)",
+                              index_path, strerror(errno), errno);
+                }
+                xprintf("writing trajectory to %.200s every %d cycles",
+                        path, interval);
+        }
+        if (frame_buffer==NULL) {
+                frame_buffer = CEX_make_array(1, 0);
+        }
+        frame_offset = 0;
+        frame_interval = interval;
+        traj_cycle = cycle;
+}
+
+void
+CEX_open_compressed_trajectory(const char *path, int interval, int64_t cycle,
+                               double precision, int keyframe_interval)
+{
+        REQ_INIT();
+        if (interval < 0) {
+                Fatal("bad trajectory interval %d", interval);
+        }
+        CEX_close_trajectory();
+        traj_format = TRAJ_COMPRESSED;
+        int64_t n = CEX_N_internal_particles, total;
+        MPI_Reduce(&n, &total, 1, MPI_INT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (IS_MASTER()) {
+                ctraj = CEX_ctraj_create(path, CEX_box_size, precision,
+                                         CEX_mpi_count(total), keyframe_interval);
+                if (tag_positions==NULL) {
+                        tag_positions = CEX_make_vec_array(0);
+                }
+                xprintf("writing compressed trajectory to %.200s every %d cycles",
+                        path, interval);
+        }
+        frame_interval = interval;
+        traj_cycle = cycle;
+}
+
+void
+CEX_close_trajectory(void)
+{
+        switch (traj_format) {
+        case TRAJ_RAW:
+                check_mpi_io(MPI_File_close(&traj_file), "MPI_File_close");
+                if (IS_MASTER()) {
+                        fclose(index_fp);
+                        index_fp = NULL;
+                }
+                break;
+        case TRAJ_COMPRESSED:
+                if (IS_MASTER()) {
+                        CEX_ctraj_close(ctraj);
+                        ctraj = NULL;
+                }
+                break;
+        }
+        traj_format = TRAJ_CLOSED;
+        frame_interval = 0;
+}
+
+static void write_raw_frame(void);
+static void write_compressed_frame(void);
+
+void
+CEX_write_trajectory_frame(void)
+{
+        switch (traj_format) {
+        case TRAJ_RAW:
+                write_raw_frame();
+                break;
+        case TRAJ_COMPRESSED:
+                write_compressed_frame();
+                break;
+        default:
+                Fatal("no trajectory open");
+        }
+}
+
+static void
+write_raw_frame(void)
+{
+        long long n = CEX_N_internal_particles, before = 0, total;
+        MPI_Exscan(&n, &before, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(&n, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+        if (IS_MASTER()) {
+                before = 0; /* Exscan leaves rank 0 undefined */
+        }
+        size_t header_bytes = IS_MASTER() ? sizeof(traj_frame_header_t) : 0;
+        size_t bytes = header_bytes + n * sizeof(traj_record_t);
+        CEX_prealloc_array(frame_buffer, bytes);
+        char *buffer = ARR_DATA_AS(char, frame_buffer);
+        if (IS_MASTER()) {
+                traj_frame_header_t header = {traj_cycle, total};
+                memcpy(buffer, &header, sizeof(header));
+        }
+        traj_record_t *records = (traj_record_t *)(buffer + header_bytes);
+        for (int i=0; i<n; i++) {
+                records[i].tag = ARR_INDEX_AS(tag_t, CEX_tags, i);
+                records[i].position = ARR_INDEX_AS(vec_t, CEX_positions, i);
+        }
+        MPI_Offset offset = frame_offset + (IS_MASTER() ? 0 :
+                sizeof(traj_frame_header_t) + before * sizeof(traj_record_t));
+        MPI_Status status;
+        check_mpi_io(MPI_File_write_at_all(traj_file, offset, buffer, CEX_mpi_count(bytes),
+                                           MPI_BYTE, &status),
+                     "MPI_File_write_at_all");
+        if (IS_MASTER()) {
+                traj_index_entry_t entry = {traj_cycle, frame_offset, total};
+                if (fwrite(&entry, sizeof(entry), 1, index_fp)!=1 ||
+                    fflush(index_fp)!=0) {
+                        Fatal("io error writing trajectory index; %.200s (errno=%d)",
+                              strerror(errno), errno);
+                }
+        }
+        frame_offset += sizeof(traj_frame_header_t) + total * sizeof(traj_record_t);
+}
+
+static void
+write_compressed_frame(void)
+{
+        int64_t total = CEX_gather_positions_by_tag(tag_positions);
+        if (!IS_MASTER()) {
+                return;
+        }
+        if (total!=ctraj->header.n_particles) {
+                Fatal("have %lld particles; trajectory has %u",
+                      (long long)total, ctraj->header.n_particles);
+        }
+        CEX_ctraj_append(ctraj, traj_cycle, ARR_DATA_AS(vec_t, tag_positions));
+}
+
+int64_t
+CEX_gather_positions_by_tag(array_t *positions)
+{
+        static array_t *all_tags=NULL, *all_positions=NULL;
+        MPI_Datatype vec_type = CEX_record_datatype(sizeof(vec_t));
+        int n = CEX_N_internal_particles;
+        int counts[CEX_size], displs[CEX_size];
+        MPI_Gather(&n, 1, MPI_INT, counts, 1, MPI_INT, 0, MPI_COMM_WORLD);
+        int64_t total = 0;
+        if (IS_MASTER()) {
+                for (int rank=0; rank<CEX_size; rank++) {
+                        displs[rank] = CEX_mpi_count(total);
+                        total += counts[rank];
+                }
+                if (all_tags==NULL) {
+                        all_tags = CEX_make_array(sizeof(tag_t), 0);
+                        all_positions = CEX_make_vec_array(0);
+                }
+                CEX_prealloc_array(all_tags, total);
+                CEX_prealloc_array(all_positions, total);
+        }
+        MPI_Gatherv(ARR_DATA(CEX_tags), n, TAG_MPI_TYPE,
+                    IS_MASTER() ? ARR_DATA(all_tags) : NULL, counts, displs,
+                    TAG_MPI_TYPE, 0, MPI_COMM_WORLD);
+        MPI_Gatherv(ARR_DATA(CEX_positions), n, vec_type,
+                    IS_MASTER() ? ARR_DATA(all_positions) : NULL, counts, displs,
+                    vec_type, 0, MPI_COMM_WORLD);
+        if (!IS_MASTER()) {
+                return 0;
+        }
+        CEX_prealloc_array(positions, total);
+        for (int64_t i=0; i<total; i++) {
+                tag_t tag = ARR_INDEX_AS(tag_t, all_tags, i);
+                if (unlikely(tag < 0 || tag >= total)) {
+                        Fatal("tag %lld outside of range [0:%lld) of gathered particles",
+                              (long long)tag, (long long)total);
+                }
+                ARR_INDEX_AS(vec_t, positions, tag) =
+                        ARR_INDEX_AS(vec_t, all_positions, i);
+        }
+        ARR_LENGTH(positions) = total;
+        return total;
+}
+
+int
+CEX_advance_trajectory(void)
+{
+        traj_cycle++;
+        return frame_interval && traj_cycle % frame_interval == 0;
+}
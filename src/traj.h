@@ -0,0 +1,76 @@
+/* -*- Mode: c -*-
+ * traj.h - Trajectory output written by every thread through MPI-IO
+ *--------------------------------------------------------------------------
+ * Copyright (C) 2009, Matthew Hagy (hagy@gatech.edu)
+ * All rights reserved.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TRAJ_H
+#define _TRAJ_H
+
+#include <stdint.h>
+
+#include "vector.h"
+#include "array.h"
+
+/* file layout shared with pbd.trajectory.  each frame is a header
+ * followed by one record for each particle, in no particular order */
+typedef struct {
+        int64_t cycle;
+        int64_t n_particles;
+} traj_frame_header_t;
+
+typedef struct {
+        int64_t tag;
+        vec_t position;
+} traj_record_t;
+
+/* the index file (trajectory path with suffix .index) holds one entry
+ * for each frame, s.t. frames can be read in any order */
+typedef struct {
+        int64_t cycle;
+        int64_t offset;         /* of frame header, in bytes */
+        int64_t n_particles;
+} traj_index_entry_t;
+
+/* truncate and open `path for writing, the next integration cycle being
+ * `cycle.  a frame is written every `interval cycles during simulation
+ * (0 to only write frames explicitly).  collective */
+void CEX_open_trajectory(const char *path, int interval, int64_t cycle);
+
+/* as CEX_open_trajectory, but the master alone writes frames of all
+ * positions ordered by tag to a compressed trajectory (see ctraj.h).
+ * requires tags to be 0 through N-1.  collective */
+void CEX_open_compressed_trajectory(const char *path, int interval, int64_t cycle,
+                                    double precision, int keyframe_interval);
+
+/* collective */
+void CEX_close_trajectory(void);
+
+/* write the internal particles of every thread as one frame.  collective */
+void CEX_write_trajectory_frame(void);
+
+/* gather the positions of every thread's internal particles into
+ * `positions on the master, indexed by tag, returning the number of
+ * particles (0 on slaves, where `positions isn't used).  requires tags
+ * to be 0 through N-1.  collective */
+int64_t CEX_gather_positions_by_tag(array_t *positions);
+
+/* called on master after each integration cycle; true when a frame is
+ * due, s.t. the master must have every thread write it */
+int CEX_advance_trajectory(void);
+
+#endif /* _TRAJ_H */